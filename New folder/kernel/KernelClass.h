@@ -12,6 +12,11 @@
 
 #include "taskring.h"
 #include "mq.h"
+#include "watchdog.h"
+#include "timerservice.h"
+#include "timebase.h"
+#include "cyclic.h"
+#include "preempt.h"
 
 namespace Kernel {
 
@@ -23,8 +28,56 @@ namespace Kernel {
 
 			/// Accessible members
 
+#ifdef KERNEL_HOST
+
+			// Host builds: each instance owns its subsystems and its own clock,
+			// and each thread has its own instance (see host/host.cpp)
+
+			TaskRing		TaskManager;
+			MQClass			MessageQueue;
+			WDTClass		Watchdog;
+			TimerService	Timers;
+#ifdef KERNEL_MODE_PREEMPTIVE
+			PreemptClass	Preempt;
+#endif
+			unsigned long	Clock=0;			// virtual time, microseconds
+
+			///////////////////////////////////////////////////////////////////////////////
+			/// Advance
+			///
+			/// Move this instance's virtual clock on, and take any scheduler ticks
+			/// that fall due
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned long us - microseconds
+			/// @return: none
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			void Advance(unsigned long us)
+			{
+				Clock+=us;
+				if(HostClockHook) HostClockHook(0);
+#ifdef KERNEL_MODE_PREEMPTIVE
+				Preempt.Tick();
+#endif
+			};
+#else
 			TaskRing&	TaskManager=TaskRing::Get();
 			MQClass&	MessageQueue=MQClass::Get();
+			WDTClass&	Watchdog=WDTClass::Get();
+			TimerService&	Timers=TimerService::Get();
+#endif
+#ifdef KERNEL_MODE_CYCLIC
+			CyclicClass&	Cyclic=CyclicClass::Get();
+#endif
+#ifdef KERNEL_TIMEBASE
+			TimebaseClass&	Timebase=TimebaseClass::Get();
+#endif
+#if defined(KERNEL_MODE_PREEMPTIVE) && !defined(KERNEL_HOST)
+			PreemptClass&	Preempt=PreemptClass::Get();
+#endif
 
 			////////////////////////////////////////////////////////////////////////////////
 			/// KernelClass
@@ -0,0 +1,189 @@
+///////////////////////////////////////////////////////////////////////////////
+/// compacttimer.h
+///
+/// Compact task-time timers
+///
+/// An OSTimer takes 16 bytes, enough for a 49-day freezable periodic timer.
+/// Most timers time less than a minute and are never frozen. Kernel::Timer
+/// carries only what it is configured for:
+///
+///	T			- the counter type. unsigned char spans 255ms, unsigned int
+///				  65.5s, unsigned long 49 days.
+///	Freezable	- true to add Freeze and Thaw
+///	Period		- a fixed timeout in ms, or 0 for one given at run time
+///
+/// The size is one T, plus one more T for a run-time timeout, plus a T and a
+/// byte if Freezable:
+///
+///	Kernel::Timer<unsigned int,false,750>	LEDTimer;		// 2 bytes
+///	Kernel::Timer<unsigned int>				ErrTimer(2000);	// 4 bytes
+///	Kernel::Timer<unsigned char>			KeyTimer(10);	// 2 bytes
+///
+/// Set, isExpired, Freeze and Thaw behave as in OSTimer, so changing the type
+/// of a declaration is enough to convert one. With a fixed period, Set takes
+/// no argument. Next re-arms from the previous deadline rather than from now,
+/// for periodic use without drift. The timeout must be less than the span of
+/// T, and a timer must be polled within that span of expiring.
+///
+/// Timers read the kernel pass time (see kerneltime.h).
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COMPACTTIMER_H_
+#define _COMPACTTIMER_H_
+
+#include "kerneltime.h"
+
+namespace Kernel {
+
+	//
+	// Timeout storage: a member for a run-time timeout, nothing for a fixed one
+
+	template<typename T, unsigned long Period>
+	class TimerTimeout {
+		protected:
+			TimerTimeout(T) {};
+			T Timeout(void) const { return (T)Period; };
+	};
+
+	template<typename T>
+	class TimerTimeout<T,0> {
+		protected:
+			T time;
+			TimerTimeout(T timeout) : time(timeout) {};
+			T Timeout(void) const { return time; };
+			void SetTimeout(T timeout) { time=timeout; };
+	};
+
+	//
+	// Freeze storage: only for freezable timers
+
+	template<typename T, bool Freezable>
+	class TimerFreeze {
+		protected:
+			T Stopped(T now) const { return now; };
+	};
+
+	template<typename T>
+	class TimerFreeze<T,true> {
+		protected:
+			T freeze;
+			unsigned char frozen;
+			TimerFreeze() : freeze(0), frozen(0) {};
+			T Stopped(T now) const { return frozen?freeze:now; };
+	};
+
+	//
+	// Compact NBT class
+
+	template<typename T=unsigned int, bool Freezable=false, unsigned long Period=0>
+	class Timer : private TimerTimeout<T,Period>, private TimerFreeze<T,Freezable> {
+
+		private:
+
+			T tmr;
+
+			T Elapsed(void) const { return (T)(this->Stopped((T)Now())-tmr); };
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// Timer
+			///
+			/// CONSTRUCTOR
+			///
+			/// Start a timer. With a fixed period the argument is ignored.
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			Timer(T timeout=0) : TimerTimeout<T,Period>(timeout), tmr((T)Now()) {};
+
+			////////////////////////////////////////////////////////////////////////
+			/// Set
+			///
+			/// Restart the timer with a new timeout. Run-time timeout only.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: T timeout - ms
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Set(T timeout) { tmr=(T)Now(); this->SetTimeout(timeout); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Set
+			///
+			/// Restart the timer with its current timeout
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Set(void) { tmr=(T)Now(); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Next
+			///
+			/// Re-arm an expired timer one timeout after its last deadline, so a
+			/// timer re-armed this way does not drift
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Next(void) { tmr+=this->Timeout(); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// isExpired
+			///
+			/// Check if the timer has expired. It may have done some time ago -
+			/// this is not interrupt driven
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: int. Nonzero if timer has expired
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int isExpired(void) const { return Elapsed()>this->Timeout(); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Freeze, Thaw
+			///
+			/// Stop a timer from counting, and resume it. Freezable timers only.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Freeze(void)
+			{
+				if(!this->frozen) {
+					this->freeze=(T)Now();
+					this->frozen=1;
+				}
+			};
+
+			void Thaw(void)
+			{
+				if(this->frozen) {
+					tmr+=(T)((T)Now()-this->freeze);
+					this->frozen=0;
+				}
+			};
+	};
+}
+
+#endif
@@ -0,0 +1,168 @@
+///////////////////////////////////////////////////////////////////////////////
+/// coroutine.cpp
+///
+/// Stackless coroutine tasks
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "coroutine.h"
+#include "mq.h"
+#include "kerneltime.h"
+
+namespace Kernel {
+
+	////////////////////////////////////////////////////////////////////////
+	/// Coroutine
+	///
+	/// CONSTRUCTOR
+	///
+	/// Initializes the coroutine to start from the top of its handler
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	Coroutine::Coroutine(void) : wait(CO_WAIT_NONE), msgid(MSG_ID_NOMESSAGE), wake(0), pNextWaiter(NULL), lc(0)
+	{
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// isReady
+	///
+	/// Check if the awaited condition has been met. Clears the wait if so.
+	/// A message wait is cleared by the message queue, not here.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: int. Nonzero if the coroutine may be resumed
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int Coroutine::isReady(void)
+	{
+		switch(wait) {
+			case CO_WAIT_NONE:
+				return 1;
+
+			case CO_WAIT_TIMER:
+				// signed difference so this survives the clock wrapping
+				if((long)(Now()-wake)>=0) {
+					wait=CO_WAIT_NONE;
+					return 1;
+				}
+				return 0;
+
+			case CO_WAIT_FLAGS_ANY:
+			case CO_WAIT_FLAGS_ALL: {
+				unsigned char got=(wait==CO_WAIT_FLAGS_ANY)?group->ConsumeAny(mask):group->ConsumeAll(mask);
+				if(got) {
+					mask=got;
+					wait=CO_WAIT_NONE;
+					return 1;
+				}
+				return 0;
+			}
+
+			default:
+				return 0;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Detach, Attach
+	///
+	/// Take a message wait off the message queue's waiter list while the
+	/// task is off the ring, and put it back when it returns. The wait
+	/// itself stands, so a resumed coroutine carries on waiting.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void Coroutine::Detach(void)
+	{
+		if(wait==CO_WAIT_MESSAGE) {
+			MQClass::Get().RemoveWaiter(this);
+		}
+	}
+
+	void Coroutine::Attach(void)
+	{
+		if(wait==CO_WAIT_MESSAGE) {
+			MQClass::Get().AddWaiter(this);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// AwaitTimer
+	///
+	/// Arrange for the coroutine not to be resumed until ms milliseconds
+	/// have elapsed.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned long ms - delay in milliseconds
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void Coroutine::AwaitTimer(unsigned long ms)
+	{
+		wake=Now()+ms;
+		wait=CO_WAIT_TIMER;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// AwaitMessage
+	///
+	/// Arrange for the coroutine not to be resumed until a message with the
+	/// given ID has been dispatched by the message queue. If the ID is
+	/// invalid the coroutine is not suspended, so it will simply run on.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: int msgid - message ID to wait for
+	/// @return: zero if the wait was set up, nonzero if msgid is invalid
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int Coroutine::AwaitMessage(int id)
+	{
+		int rc=-1;
+		if(id>=0 && id<MSG_MAX_MSG_IDS) {
+			msgid=id;
+			message=NULL;
+			wait=CO_WAIT_MESSAGE;
+			rc=MQClass::Get().AddWaiter(this);
+			if(rc) {
+				wait=CO_WAIT_NONE;
+			}
+		}
+		return rc;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// AwaitFlags
+	///
+	/// Arrange for the coroutine not to be resumed until any (or all) of
+	/// the given flags are set in an event flag group. The task ring polls
+	/// the group each time round, so no waiter list is needed.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: EventFlags& flags - event flag group
+	/// @param: unsigned char bits - flags to wait for
+	/// @param: unsigned char all - nonzero to wait for all of them
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void Coroutine::AwaitFlags(EventFlags& flags, unsigned char bits, unsigned char all)
+	{
+		group=&flags;
+		mask=bits;
+		wait=all?CO_WAIT_FLAGS_ALL:CO_WAIT_FLAGS_ANY;
+	}
+}
@@ -0,0 +1,293 @@
+///////////////////////////////////////////////////////////////////////////////
+/// coroutine.h
+///
+/// Stackless coroutine tasks
+///
+/// Allows a task handler to be written as straight-line code that waits for
+/// a timer or a message, rather than as a switch-based state machine. The
+/// coroutine keeps only its resume point and its wait condition - local
+/// variables are NOT preserved across a wait, so anything that must survive
+/// should be static or live in the task context.
+///
+/// Because the resume point is implemented with a switch statement, a
+/// coroutine body may not itself use 'switch' around a CO_ macro.
+///
+///	void BlinkTask(Kernel::Coroutine& co, void * context)
+///	{
+///		CO_BEGIN(co);
+///		for(;;) {
+///			PORTB |= 0b00100000;
+///			CO_AWAIT_TIMER(co,500);
+///			PORTB &= ~0b00100000;
+///			CO_AWAIT_MESSAGE(co,MSG_ID_CHANGE_LED);
+///		}
+///		CO_END(co);
+///	}
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _COROUTINE_H_
+#define _COROUTINE_H_
+
+#include "sysincs.h"
+#include "eventflags.h"
+
+namespace Kernel {
+
+	class Coroutine;
+
+	//
+	// Prototype of a coroutine task handler
+
+	typedef void (* PFNCOROUTINE)(Coroutine& co, void * context);
+
+	//
+	// What a suspended coroutine is waiting for
+
+	typedef enum _COWAIT {
+		CO_WAIT_NONE,
+		CO_WAIT_TIMER,
+		CO_WAIT_MESSAGE,
+		CO_WAIT_FLAGS_ANY,
+		CO_WAIT_FLAGS_ALL
+	} COWAIT;
+
+	//
+	// Coroutine state block. Ten bytes per coroutine.
+
+	class Coroutine {
+
+		private:
+
+			friend class TaskRing;		// checks isReady before resuming us
+			friend class MQClass;		// wakes us when our message is dispatched
+
+			unsigned char	wait;		// COWAIT
+			signed char		msgid;		// message we are waiting for
+			union {
+				unsigned long	wake;		// kernel time at which a timer wait ends
+				void *			message;	// context of the message that woke us
+				struct {
+					EventFlags *	group;		// event flag group we are waiting on
+					unsigned char	mask;		// flags awaited, then the flags consumed
+				};
+			};
+			Coroutine *		pNextWaiter;	// link in the message queue waiter list
+
+			////////////////////////////////////////////////////////////////////////
+			/// isReady
+			///
+			/// Check if the awaited condition has been met. Clears the wait if so.
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: int. Nonzero if the coroutine may be resumed
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int isReady(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Detach, Attach
+			///
+			/// The coroutine's task is leaving the ring, or coming back to it.
+			/// A message wait is taken off the message queue's waiter list, so
+			/// messages dispatched meanwhile do not reach the coroutine, and put
+			/// back on it when the task is resumed.
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Detach(void);
+			void Attach(void);
+
+		public:
+
+			unsigned short	lc;			// resume point. Managed by the CO_ macros
+
+			////////////////////////////////////////////////////////////////////////
+			/// Coroutine
+			///
+			/// CONSTRUCTOR
+			///
+			/// Initializes the coroutine to start from the top of its handler
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			Coroutine(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// AwaitTimer
+			///
+			/// Arrange for the coroutine not to be resumed until ms milliseconds
+			/// have elapsed. Use CO_AWAIT_TIMER rather than calling this directly.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned long ms - delay in milliseconds
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void AwaitTimer(unsigned long ms);
+
+			////////////////////////////////////////////////////////////////////////
+			/// AwaitMessage
+			///
+			/// Arrange for the coroutine not to be resumed until a message with the
+			/// given ID has been dispatched by the message queue. Use
+			/// CO_AWAIT_MESSAGE rather than calling this directly.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: int msgid - message ID to wait for
+			/// @return: zero if the wait was set up, nonzero if msgid is invalid
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int AwaitMessage(int msgid);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Message
+			///
+			/// Return the context of the message that ended the last
+			/// CO_AWAIT_MESSAGE. Only valid immediately after the wait, and only
+			/// useful for messages posted with MQ_OWNER_CALLER (the queue frees
+			/// any context it owns once dispatch is done).
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: void * - message context
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void * Message(void) { return message; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// AwaitFlags
+			///
+			/// Arrange for the coroutine not to be resumed until any (or all) of
+			/// the given flags are set in an event flag group. The flags are
+			/// consumed when the coroutine is resumed. Use CO_AWAIT_FLAGS or
+			/// CO_AWAIT_ALL_FLAGS rather than calling this directly.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: EventFlags& flags - event flag group
+			/// @param: unsigned char bits - flags to wait for
+			/// @param: unsigned char all - nonzero to wait for all of them
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void AwaitFlags(EventFlags& flags, unsigned char bits, unsigned char all);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Flags
+			///
+			/// Return the flags consumed by the last CO_AWAIT_FLAGS or
+			/// CO_AWAIT_ALL_FLAGS. Only valid immediately after the wait.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned char - flags consumed
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char Flags(void) { return mask; };
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CO_BEGIN
+	///
+	/// Must be the first statement in a coroutine handler
+	///
+	/// @param: co - the Coroutine passed to the handler
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	#define CO_BEGIN(co) \
+		switch((co).lc) { case 0:
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CO_YIELD
+	///
+	/// Return to the kernel, resuming here the next time the task comes round
+	///
+	/// @param: co - the Coroutine passed to the handler
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	#define CO_YIELD(co) \
+		do { (co).lc=__LINE__; return; case __LINE__:; } while(0)
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CO_AWAIT_TIMER
+	///
+	/// Return to the kernel. The kernel will not resume the coroutine until ms
+	/// milliseconds have passed.
+	///
+	/// @param: co - the Coroutine passed to the handler
+	/// @param: ms - delay in milliseconds
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	#define CO_AWAIT_TIMER(co,ms) \
+		do { (co).AwaitTimer(ms); CO_YIELD(co); } while(0)
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CO_AWAIT_MESSAGE
+	///
+	/// Return to the kernel. The kernel will not resume the coroutine until a
+	/// message with ID id has been dispatched. The message context is then
+	/// available through co.Message()
+	///
+	/// @param: co - the Coroutine passed to the handler
+	/// @param: id - message ID
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	#define CO_AWAIT_MESSAGE(co,id) \
+		do { (co).AwaitMessage(id); CO_YIELD(co); } while(0)
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CO_AWAIT_FLAGS, CO_AWAIT_ALL_FLAGS
+	///
+	/// Return to the kernel. The kernel will not resume the coroutine until any
+	/// (or all) of the flags in mask are set in the group. The flags are cleared
+	/// as the coroutine resumes, and are available through co.Flags()
+	///
+	/// @param: co - the Coroutine passed to the handler
+	/// @param: group - an EventFlags group
+	/// @param: mask - flags to wait for
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	#define CO_AWAIT_FLAGS(co,group,mask) \
+		do { (co).AwaitFlags(group,mask,0); CO_YIELD(co); } while(0)
+
+	#define CO_AWAIT_ALL_FLAGS(co,group,mask) \
+		do { (co).AwaitFlags(group,mask,1); CO_YIELD(co); } while(0)
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CO_END
+	///
+	/// Must be the last statement in a coroutine handler. A coroutine that runs
+	/// off the end starts again from CO_BEGIN next time round.
+	///
+	/// @param: co - the Coroutine passed to the handler
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	#define CO_END(co) \
+		} (co).lc=0;
+}
+
+#endif
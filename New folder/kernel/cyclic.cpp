@@ -0,0 +1,259 @@
+///////////////////////////////////////////////////////////////////////////////
+/// cyclic.cpp
+///
+/// Time-triggered cyclic executive
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "cyclic.h"
+
+#ifdef KERNEL_MODE_CYCLIC
+
+#include "KernelClass.h"
+#include "interrupts.h"
+
+namespace Kernel {
+
+	// Executive internals
+
+	class CYCLICINTERNALS {
+		public:
+			const CYCLICFRAME *		schedule;		// in flash
+			unsigned char			nframes;
+			unsigned char			minor;			// ms per minor frame
+			unsigned char			frame;			// frame to run next
+			volatile unsigned char	ticks;			// ms ticks into the current minor frame
+			volatile unsigned char	due;			// frame starts not yet serviced
+			CYCLICSTATS				stats;
+			CYCLICINTERNALS() : schedule(NULL),nframes(0),minor(1),frame(0),ticks(0),due(0) {
+				stats.frames=0;
+				stats.overruns=0;
+				stats.lastoverrun=0;
+			};
+	};
+
+	static CYCLICINTERNALS * pCyclicInternals=NULL;
+
+	////////////////////////////////////////////////////////////////////////
+	/// CyclicClass
+	///
+	/// CONSTRUCTOR, PRIVATE
+	///
+	/// Initialize the executive. Nothing runs until Start is called.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	CyclicClass::CyclicClass(void)
+	{
+		pCyclicInternals=new CYCLICINTERNALS;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Get
+	///
+	/// Returns a reference to the singleton class.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC, STATIC
+	/// @param: none
+	/// @return: CyclicClass&
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	CyclicClass& CyclicClass::Get(void)
+	{
+		static CyclicClass cyc;
+		return cyc;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Start
+	///
+	/// Install the schedule and start the Timer2 frame tick. Timer2 runs
+	/// in CTC mode at clk/64, so OCR2A=249 gives a 1ms tick at 16MHz.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: const CYCLICFRAME * schedule - schedule in flash
+	/// @param: unsigned char nframes - number of minor frames
+	/// @param: unsigned char minor - minor frame length in ms
+	/// @return: zero for success
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int CyclicClass::Start(const CYCLICFRAME * schedule, unsigned char nframes, unsigned char minor)
+	{
+		int rc=-1;
+		if(schedule && nframes && minor) {
+			INTDisableMasterInterrupts();
+			pCyclicInternals->schedule=schedule;
+			pCyclicInternals->nframes=nframes;
+			pCyclicInternals->minor=minor;
+			pCyclicInternals->frame=0;
+			pCyclicInternals->ticks=0;
+			pCyclicInternals->due=1;			// run the first frame straight away
+
+			TCCR2A=(1<<WGM21);					// CTC
+			TCCR2B=(1<<CS22);					// clk/64
+			OCR2A=(F_CPU/64/1000)-1;
+			TCNT2=0;
+			TIFR2=(1<<OCF2A);
+			TIMSK2=(1<<OCIE2A);
+			INTEnableMasterInterrupts();
+			rc=0;
+		}
+		return rc;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Tick
+	///
+	/// Called from the Timer2 interrupt every millisecond. Marks a new
+	/// frame as due at each minor frame boundary.
+	///
+	/// @context: INTERRUPT
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void CyclicClass::Tick(void)
+	{
+		if(++pCyclicInternals->ticks>=pCyclicInternals->minor) {
+			pCyclicInternals->ticks=0;
+			if(pCyclicInternals->due<255) {
+				pCyclicInternals->due++;
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Run
+	///
+	/// Called by the kernel in place of the task ring. Waits for the next
+	/// frame to become due, then runs its slots. If another frame became
+	/// due while this one was running, this frame overran: the frames
+	/// that were missed are skipped so the schedule keeps to real time.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void CyclicClass::Run(void)
+	{
+		CYCLICINTERNALS * internal=pCyclicInternals;
+
+		if(!internal->schedule || !internal->due) {
+			return;
+		}
+
+		INTDisableMasterInterrupts();
+		internal->due--;
+		INTEnableMasterInterrupts();
+
+		const CYCLICFRAME * pFrame=internal->schedule+internal->frame;
+		const CYCLICSLOT * pSlot=(const CYCLICSLOT *)pgm_read_ptr(&pFrame->slots);
+		unsigned char count=pgm_read_byte(&pFrame->count);
+
+		while(count--) {
+			PFNTASKHANDLER handler=(PFNTASKHANDLER)pgm_read_ptr(&pSlot->handler);
+			handler(pgm_read_ptr(&pSlot->context));
+			pSlot++;
+		}
+		internal->stats.frames++;
+
+		// check for overrun. If further frames have started while this one
+		// ran, run only the latest of them next, and skip the others.
+
+		INTDisableMasterInterrupts();
+		unsigned char missed=internal->due;
+		if(missed) {
+			internal->due=1;
+		}
+		INTEnableMasterInterrupts();
+
+		if(missed) {
+			internal->stats.overruns++;
+			internal->stats.lastoverrun=internal->frame;
+			internal->frame=(internal->frame+missed)%internal->nframes;
+		} else {
+			internal->frame=(internal->frame+1)%internal->nframes;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// GetStats
+	///
+	/// Return frame and overrun counts
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: CYCLICSTATS * stats - filled in
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void CyclicClass::GetStats(CYCLICSTATS * stats)
+	{
+		if(stats) {
+			*stats=pCyclicInternals->stats;
+		}
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CyclicMessagePump
+	///
+	/// A slot handler that processes up to two queued messages
+	///
+	/// @context: TASK
+	/// @scope: EXPORTED
+	/// @param: void * - unused
+	/// @return: none
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	void CyclicMessagePump(void *)
+	{
+		MQClass::Get().Loop(2);
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CyclicTaskRing
+	///
+	/// A slot handler that runs one step of the task ring
+	///
+	/// @context: TASK
+	/// @scope: EXPORTED
+	/// @param: void * - unused
+	/// @return: none
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	void CyclicTaskRing(void *)
+	{
+		TaskRing::Get().Loop();
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR(TIMER2_COMPA_vect)
+///
+/// Interrupt Service Routine: 1ms frame tick
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(TIMER2_COMPA_vect)
+{
+	Kernel::CyclicClass::Get().Tick();
+}
+
+#endif
@@ -0,0 +1,291 @@
+///////////////////////////////////////////////////////////////////////////////
+/// cyclic.h
+///
+/// Time-triggered cyclic executive
+///
+/// An alternative to the task ring for builds that need bounded jitter. A
+/// static schedule of minor frames is declared at compile time. Timer2 ticks
+/// every millisecond; at the start of each minor frame the kernel runs that
+/// frame's slots in order, then idles until the next frame. The schedule
+/// repeats once all frames (the major frame) have run. A frame that is still
+/// running when the next one is due is counted as an overrun, and the missed
+/// frames are skipped so the schedule stays aligned with real time.
+///
+/// Each slot declares a worst-case execution time, and CYCLIC_CHECK_SCHEDULE
+/// fails the build if any frame's WCETs add up to more than the minor frame.
+///
+/// Enabled by defining KERNEL_MODE_CYCLIC in kernelcfg.h.
+///
+///	CYCLIC_FRAME(Fast) {
+///		CYCLIC_SLOT(SpeedControl,NULL,300),
+///		CYCLIC_SLOT(CyclicMessagePump,NULL,400)
+///	};
+///	CYCLIC_FRAME(Slow) {
+///		CYCLIC_SLOT(SpeedControl,NULL,300),
+///		CYCLIC_SLOT(DisplayRefresh,NULL,1500)
+///	};
+///	CYCLIC_SCHEDULE(Schedule) {
+///		CYCLIC_FRAME_REF(Fast), CYCLIC_FRAME_REF(Fast), CYCLIC_FRAME_REF(Slow)
+///	};
+///	CYCLIC_CHECK_SCHEDULE(Schedule,2000);
+///
+///	Kernel::OS.Cyclic.Start(Schedule,2);		// in UserInit: 2ms minor frames
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _CYCLIC_H_
+#define _CYCLIC_H_
+
+#include "sysincs.h"
+#include "taskring.h"
+
+//
+// A slot: one handler call within a frame, with its worst-case execution
+// time in microseconds
+
+typedef struct _CYCLICSLOT {
+	PFNTASKHANDLER		handler;
+	void *				context;
+	unsigned int		wcet;
+} CYCLICSLOT;
+
+//
+// A minor frame: the slots run at one timer tick
+
+typedef struct _CYCLICFRAME {
+	const CYCLICSLOT *	slots;
+	unsigned char		count;
+} CYCLICFRAME;
+
+///////////////////////////////////////////////////////////////////////////////
+/// CyclicFrameWCET
+///
+/// Sum of the WCETs of a frame's slots. Evaluated at compile time.
+///
+/// @param: slots - slot array
+/// @param: count - number of slots
+/// @return: total WCET in microseconds
+///
+///////////////////////////////////////////////////////////////////////////////
+
+constexpr unsigned long CyclicFrameWCET(const CYCLICSLOT * slots, unsigned char count)
+{
+	return count ? slots[0].wcet+CyclicFrameWCET(slots+1,count-1) : 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CyclicScheduleFits
+///
+/// Check that every frame of a schedule fits in the minor frame. Evaluated
+/// at compile time.
+///
+/// @param: frames - frame array
+/// @param: count - number of frames
+/// @param: budget - minor frame length in microseconds
+/// @return: true if every frame fits
+///
+///////////////////////////////////////////////////////////////////////////////
+
+constexpr bool CyclicScheduleFits(const CYCLICFRAME * frames, unsigned char count, unsigned long budget)
+{
+	return count ? (CyclicFrameWCET(frames[0].slots,frames[0].count)<=budget) &&
+				   CyclicScheduleFits(frames+1,count-1,budget) : true;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CYCLIC_FRAME, CYCLIC_SLOT
+///
+/// Declare a minor frame in flash, and the slots within it
+///
+/// @param: name - name of the frame
+/// @param: handler, context - as for RegisterTaskHandler
+/// @param: wcet - worst-case execution time of the handler in microseconds
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define CYCLIC_FRAME(name) \
+	static constexpr CYCLICSLOT name[] PROGMEM =
+
+#define CYCLIC_SLOT(handler,context,wcet) \
+	{ handler, context, wcet }
+
+///////////////////////////////////////////////////////////////////////////////
+/// CYCLIC_SCHEDULE, CYCLIC_FRAME_REF
+///
+/// Declare the major frame in flash: the list of minor frames in the order
+/// they run
+///
+/// @param: name - name of the schedule
+/// @param: frame - a frame declared with CYCLIC_FRAME
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define CYCLIC_SCHEDULE(name) \
+	static constexpr CYCLICFRAME name[] PROGMEM =
+
+#define CYCLIC_FRAME_REF(frame) \
+	{ frame, sizeof(frame)/sizeof(frame[0]) }
+
+///////////////////////////////////////////////////////////////////////////////
+/// CYCLIC_CHECK_FRAME, CYCLIC_CHECK_SCHEDULE
+///
+/// Fail the build if the declared WCETs of a frame (or of any frame in a
+/// schedule) exceed the minor frame length. Leave some margin for the
+/// kernel's own per-frame overhead and for interrupts.
+///
+/// @param: name - frame or schedule
+/// @param: budget - minor frame length in microseconds
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define CYCLIC_CHECK_FRAME(name,budget) \
+	static_assert(CyclicFrameWCET(name,sizeof(name)/sizeof(name[0]))<=(budget), \
+		"cyclic frame " #name ": slot WCETs exceed the minor frame")
+
+#define CYCLIC_CHECK_SCHEDULE(name,budget) \
+	static_assert(CyclicScheduleFits(name,sizeof(name)/sizeof(name[0]),(budget)), \
+		"cyclic schedule " #name ": a frame's slot WCETs exceed the minor frame")
+
+#ifdef KERNEL_MODE_CYCLIC
+
+namespace Kernel {
+
+	//
+	// Overrun statistics
+
+	typedef struct _CYCLICSTATS {
+		unsigned long		frames;			// frames run
+		unsigned long		overruns;		// frames that ran into the next one
+		unsigned char		lastoverrun;	// index of the last frame to overrun
+	} CYCLICSTATS;
+
+	class CyclicClass {
+
+		private:
+
+			friend void ::loop();		// the kernel needs to access the Run function
+
+			////////////////////////////////////////////////////////////////////////
+			/// CyclicClass
+			///
+			/// CONSTRUCTOR, PRIVATE
+			///
+			/// Initialize the executive. Nothing runs until Start is called.
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			CyclicClass(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Run
+			///
+			/// Called by the kernel in place of the task ring. Waits for the next
+			/// frame tick and runs the frame's slots.
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Run(void);
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// Get
+			///
+			/// Returns a reference to the singleton class.
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC, STATIC
+			/// @param: none
+			/// @return: CyclicClass&
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			static CyclicClass& Get(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Start
+			///
+			/// Install the schedule and start the Timer2 frame tick.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: const CYCLICFRAME * schedule - schedule in flash
+			/// @param: unsigned char nframes - number of minor frames
+			/// @param: unsigned char minor - minor frame length in ms
+			/// @return: zero for success
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int Start(const CYCLICFRAME * schedule, unsigned char nframes, unsigned char minor);
+
+			template<unsigned char N>
+			int Start(const CYCLICFRAME (&schedule)[N], unsigned char minor) { return Start(schedule,N,minor); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// GetStats
+			///
+			/// Return frame and overrun counts
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: CYCLICSTATS * stats - filled in
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void GetStats(CYCLICSTATS * stats);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Tick
+			///
+			/// Called from the Timer2 interrupt. Not for application use.
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Tick(void);
+	};
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CyclicMessagePump
+	///
+	/// A slot handler that processes queued messages, so message handlers still
+	/// run in cyclic mode. Give it a WCET that covers two messages.
+	///
+	/// @context: TASK
+	/// @scope: EXPORTED
+	/// @param: void * context - unused
+	/// @return: none
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	void CyclicMessagePump(void * context);
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// CyclicTaskRing
+	///
+	/// A slot handler that runs one step of the task ring, for modules written
+	/// as ordinary tasks. Its WCET is that of the slowest registered task.
+	///
+	/// @context: TASK
+	/// @scope: EXPORTED
+	/// @param: void * context - unused
+	/// @return: none
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	void CyclicTaskRing(void * context);
+}
+
+#endif
+
+#endif
@@ -0,0 +1,102 @@
+///////////////////////////////////////////////////////////////////////////////
+/// eventflags.cpp
+///
+/// Event flag groups
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "eventflags.h"
+
+namespace Kernel {
+
+	////////////////////////////////////////////////////////////////////////
+	/// Set
+	///
+	/// Set flags from task code. An interrupt may set other flags in the
+	/// same byte, so the read-modify-write is done with interrupts off.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned char mask - flags to set
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void EventFlags::Set(unsigned char mask)
+	{
+		unsigned char sreg=SREG;
+		cli();
+		flags|=mask;
+		SREG=sreg;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Clear
+	///
+	/// Clear flags without consuming them
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned char mask - flags to clear
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void EventFlags::Clear(unsigned char mask)
+	{
+		unsigned char sreg=SREG;
+		cli();
+		flags&=~mask;
+		SREG=sreg;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// ConsumeAny
+	///
+	/// Return whichever of the given flags are set, and clear them. The
+	/// test and the clear are one atomic step, so an event raised between
+	/// them can not be lost.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned char mask - flags of interest
+	/// @return: unsigned char - the flags that were set. Zero if none.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned char EventFlags::ConsumeAny(unsigned char mask)
+	{
+		unsigned char sreg=SREG;
+		cli();
+		unsigned char set=flags&mask;
+		flags&=~set;
+		SREG=sreg;
+		return set;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// ConsumeAll
+	///
+	/// If all of the given flags are set, clear them. Otherwise leave
+	/// every flag as it is.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned char mask - flags of interest
+	/// @return: unsigned char - mask if all were set, otherwise zero
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned char EventFlags::ConsumeAll(unsigned char mask)
+	{
+		unsigned char set=0;
+		unsigned char sreg=SREG;
+		cli();
+		if((flags&mask)==mask) {
+			flags&=~mask;
+			set=mask;
+		}
+		SREG=sreg;
+		return set;
+	}
+}
@@ -0,0 +1,146 @@
+///////////////////////////////////////////////////////////////////////////////
+/// eventflags.h
+///
+/// Event flag groups
+///
+/// A lightweight way for an interrupt to tell task code that something has
+/// happened - a tacho edge, an encoder step, a keypad interrupt - without
+/// allocating a message. A group holds eight flags. An ISR sets flags with
+/// SetFromISR, which is a single read-modify-write of one byte (5 cycles for
+/// a statically allocated group and a constant mask). Task code polls for any
+/// or all of a set of flags, and the flags it finds are cleared as they are
+/// consumed. Coroutines can wait on a group with CO_AWAIT_FLAGS.
+///
+/// Setting a flag that is already set has no further effect, so a group
+/// records that an event happened, not how many times.
+///
+///	Kernel::EventFlags MotorEvents;
+///	#define EV_TACHO	0x01
+///	#define EV_STALL	0x02
+///
+///	ISR(INT0_vect) { MotorEvents.SetFromISR(EV_TACHO); }
+///
+///	void SpeedTask(void * context)
+///	{
+///		if(MotorEvents.ConsumeAny(EV_TACHO)) {
+///			...
+///		}
+///	}
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _EVENTFLAGS_H_
+#define _EVENTFLAGS_H_
+
+#include "sysincs.h"
+
+namespace Kernel {
+
+	class EventFlags {
+
+		private:
+
+			volatile unsigned char	flags;
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// EventFlags
+			///
+			/// CONSTRUCTOR
+			///
+			/// Initializes the group with all flags clear
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			EventFlags(void) : flags(0) {};
+
+			////////////////////////////////////////////////////////////////////////
+			/// SetFromISR
+			///
+			/// Set flags. Interrupts are already off in an ISR, so no further
+			/// protection is needed.
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: unsigned char mask - flags to set
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void SetFromISR(unsigned char mask) { flags|=mask; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Set
+			///
+			/// Set flags from task code
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char mask - flags to set
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Set(unsigned char mask);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Clear
+			///
+			/// Clear flags without consuming them
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char mask - flags to clear
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Clear(unsigned char mask);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Peek
+			///
+			/// Return the flags that are set, without clearing them
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned char - the flags
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char Peek(void) { return flags; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// ConsumeAny
+			///
+			/// Return whichever of the given flags are set, and clear them
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char mask - flags of interest
+			/// @return: unsigned char - the flags that were set. Zero if none.
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char ConsumeAny(unsigned char mask);
+
+			////////////////////////////////////////////////////////////////////////
+			/// ConsumeAll
+			///
+			/// If all of the given flags are set, clear them. Otherwise leave
+			/// every flag as it is.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char mask - flags of interest
+			/// @return: unsigned char - mask if all were set, otherwise zero
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char ConsumeAll(unsigned char mask);
+	};
+}
+
+#endif
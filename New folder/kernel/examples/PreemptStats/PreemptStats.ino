@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////////
+/// PreemptStats
+///
+/// Measures the preemptive scheduler: every second the idle task prints the
+/// PreemptClass::GetStats figures - context switches, ticks and the last and
+/// longest pass through the switch code in CPU cycles - and each task's
+/// stack high-water mark, on the serial port at 115200 baud.
+///
+/// Two tasks give the scheduler work. FastTask, at priority 2, wakes on every
+/// tick and signals SlowTask every tenth; SlowTask, at priority 1, waits for
+/// the signal and does a little arithmetic through a few nested calls, so its
+/// stack is used more deeply.
+///
+/// Select KERNEL_MODE_PREEMPTIVE and KERNEL_PREEMPT_PROFILE in kernelcfg.h
+/// before building. Runs on an Uno, or under simavr, which copies the UART to
+/// the console:
+///
+///	simavr -m atmega328p -f 16000000 PreemptStats.ino.elf
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+
+#ifndef KERNEL_MODE_PREEMPTIVE
+#error "PreemptStats needs KERNEL_MODE_PREEMPTIVE, and KERNEL_PREEMPT_PROFILE, set in kernelcfg.h"
+#endif
+
+#define STATS_PERIOD_MS		1000
+#define STATS_SLOW_EVERY	10			// ticks between signals to SlowTask
+
+PRE_STACK(FastStack,96);
+PRE_STACK(SlowStack,128);
+
+static int FastID, SlowID;
+static volatile unsigned long SlowSum=0;
+
+//////////////////////////////////////////////////////////////////////////////
+/// Sum
+///
+/// A few nested calls, to use some stack
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: depth - unsigned char. Calls still to make
+/// @return: unsigned long. A sum, so the calls are not optimized out
+///
+/////////////////////////////////////////////////////////////////////////////
+
+static unsigned long Sum(unsigned char depth)
+{
+	volatile unsigned char local[8];
+
+	for(unsigned char n=0;n<sizeof(local);n++) {
+		local[n]=n+depth;
+	}
+	return depth?Sum(depth-1)+local[depth&7]:local[0];
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// FastTask
+///
+/// Priority 2: wake every tick, and signal SlowTask every STATS_SLOW_EVERY
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: context - void *. Unused
+/// @return: NONE
+///
+/////////////////////////////////////////////////////////////////////////////
+
+static void FastTask(void *)
+{
+	unsigned char count=0;
+
+	for(;;) {
+		PRESleep(1);
+		if(++count==STATS_SLOW_EVERY) {
+			count=0;
+			Kernel::OS.Preempt.Signal(SlowID);
+		}
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// SlowTask
+///
+/// Priority 1: wait for FastTask's signal, then do some work
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: context - void *. Unused
+/// @return: NONE
+///
+/////////////////////////////////////////////////////////////////////////////
+
+static void SlowTask(void *)
+{
+	for(;;) {
+		PREWait();
+		SlowSum+=Sum(4);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// StatsTask
+///
+/// Task ring handler, so in the idle task: print the statistics once every
+/// STATS_PERIOD_MS
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: context - void *. Unused
+/// @return: NONE
+///
+/////////////////////////////////////////////////////////////////////////////
+
+static void StatsTask(void *)
+{
+	static unsigned long last=0;
+	Kernel::PRESTATS stats;
+
+	if(millis()-last<STATS_PERIOD_MS) {
+		return;
+	}
+	last=millis();
+	Kernel::OS.Preempt.GetStats(&stats);
+	Serial.print(F("switches "));
+	Serial.print(stats.switches);
+	Serial.print(F(" ticks "));
+	Serial.print(stats.ticks);
+	Serial.print(F(" switch cycles "));
+	Serial.print(stats.switchcycles);
+	Serial.print(F(" max "));
+	Serial.print(stats.maxswitchcycles);
+	Serial.print(F(" stack fast "));
+	Serial.print(stats.stackused[FastID]);
+	Serial.print(F("/"));
+	Serial.print(sizeof(FastStack));
+	Serial.print(F(" slow "));
+	Serial.print(stats.stackused[SlowID]);
+	Serial.print(F("/"));
+	Serial.println(sizeof(SlowStack));
+}
+
+//////////////////////////////////////////////////////////////////////////////
+/// UserInit
+///
+/// Called once by the kernel on startup: open the serial port and start the
+/// tasks
+///
+/////////////////////////////////////////////////////////////////////////////
+
+void UserInit()
+{
+	Serial.begin(115200);
+	Kernel::OS.TaskManager.RegisterTaskHandler(StatsTask,NULL);
+	SlowID=Kernel::OS.Preempt.CreateTask(SlowTask,NULL,1,SlowStack,sizeof(SlowStack));
+	FastID=Kernel::OS.Preempt.CreateTask(FastTask,NULL,2,FastStack,sizeof(FastStack));
+}
@@ -0,0 +1,86 @@
+///////////////////////////////////////////////////////////////////////////////
+/// Arduino.h (host)
+///
+/// Minimal stand-in for the Arduino core, for building the kernel on a PC
+/// with KERNEL_HOST defined. Only what the kernel and the drivers use is
+/// provided.
+///
+/// Time is virtual: millis() and micros() read the clock of the calling
+/// thread's kernel instance, which only moves when the test harness calls
+/// Kernel::OS.Advance() (or the code under test calls delay()). With the
+/// peripheral simulator in use (see sim.h), register accesses and calls to
+/// millis() and micros() also take their time on the AVR.
+///
+/// Build with the kernel sources and host.cpp, e.g. (all one command)
+///
+///	g++ -std=gnu++11 -fpermissive -pthread -DKERNEL_HOST -Ikernel/host -Ikernel
+///		kernel/*.cpp kernel/host/host.cpp rig.cpp
+///
+/// and for drivers, add the simulator and the drivers themselves:
+///
+///		kernel/host/sim.cpp kernel/host/simdevices.cpp part2_template_files/iic.cpp
+///
+/// kernel/host/Makefile builds and runs the rigs in kernel/host/rigs this way.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+
+typedef bool	boolean;
+typedef uint8_t	byte;
+
+#ifndef F_CPU
+#define F_CPU	16000000UL
+#endif
+
+#define HIGH	1
+#define LOW		0
+
+#define F(s)	(s)
+
+// Called when the virtual clock is read or moved on, with the AVR cycles the
+// read takes. Set by the peripheral simulator; NULL without it.
+
+extern thread_local void (* HostClockHook)(unsigned int cycles);
+
+//
+// Serial output goes to stdout
+
+class Print {
+	public:
+		size_t print(const char * s);
+		size_t print(unsigned long n, int base=10);
+		size_t print(long n, int base=10);
+		size_t print(unsigned int n, int base=10) { return print((unsigned long)n,base); };
+		size_t print(int n, int base=10) { return print((long)n,base); };
+		size_t println(void);
+		template<typename T> size_t println(T v) { size_t n=print(v); return n+println(); };
+		template<typename T> size_t println(T v, int base) { size_t n=print(v,base); return n+println(); };
+};
+
+class HardwareSerial : public Print {
+	public:
+		void begin(unsigned long) {};
+};
+
+extern HardwareSerial Serial;
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+extern "C" {
+	void setup(void);
+	void loop(void);
+}
+
+#endif
@@ -0,0 +1,24 @@
+///////////////////////////////////////////////////////////////////////////////
+/// avr/interrupt.h (host)
+///
+/// ISRs become plain functions that a test harness can call to simulate the
+/// interrupt, or that the peripheral simulator runs. cli() and sei() track
+/// the I flag in the thread's SREG; sei() also lets the simulator run any
+/// interrupt left pending.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HOST_AVR_INTERRUPT_H_
+#define _HOST_AVR_INTERRUPT_H_
+
+#include <avr/io.h>
+
+extern thread_local void (* HostClockHook)(unsigned int cycles);
+
+#define ISR(vector, ...)	extern "C" void vector(void)
+#define ISR_NAKED
+
+#define cli()	(SREG&=~_BV(SREG_I))
+#define sei()	do { SREG|=_BV(SREG_I); if(HostClockHook) HostClockHook(0); } while(0)
+
+#endif
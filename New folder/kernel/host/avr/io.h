@@ -0,0 +1,142 @@
+///////////////////////////////////////////////////////////////////////////////
+/// avr/io.h (host)
+///
+/// The registers the kernel touches, one set per thread so that each
+/// simulated controller has its own
+///
+/// The peripheral registers the drivers use (TWI, the IO ports, pin change
+/// and external interrupts) are proxies onto the peripheral simulator in
+/// host/sim.cpp: reading or writing one runs the simulated hardware. Code
+/// that uses them must be linked with sim.cpp.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HOST_AVR_IO_H_
+#define _HOST_AVR_IO_H_
+
+#include <stdint.h>
+
+extern thread_local volatile uint8_t SREG;
+extern thread_local volatile uint8_t WDTCSR;
+extern thread_local volatile uint8_t MCUSR;
+
+namespace Host {
+
+	//
+	// Simulated peripheral registers
+
+	enum HOSTREG {
+		REG_PINB, REG_DDRB, REG_PORTB,
+		REG_PINC, REG_DDRC, REG_PORTC,
+		REG_PIND, REG_DDRD, REG_PORTD,
+		REG_PCICR, REG_PCIFR, REG_PCMSK0, REG_PCMSK1, REG_PCMSK2,
+		REG_EICRA, REG_EIMSK, REG_EIFR,
+		REG_TWBR, REG_TWSR, REG_TWAR, REG_TWDR, REG_TWCR,
+		REG_COUNT
+	};
+
+	uint8_t RegRead(HOSTREG reg);
+	void RegWrite(HOSTREG reg, uint8_t value);
+
+	//
+	// A register: reads and writes go to the simulator
+
+	class Reg {
+
+		private:
+
+			HOSTREG	reg;
+
+		public:
+
+			explicit Reg(HOSTREG r) : reg(r) {};
+
+			operator uint8_t() const { return RegRead(reg); };
+			Reg& operator=(uint8_t v) { RegWrite(reg,v); return *this; };
+			Reg& operator=(const Reg& r) { RegWrite(reg,(uint8_t)r); return *this; };
+			Reg& operator|=(uint8_t v) { RegWrite(reg,RegRead(reg)|v); return *this; };
+			Reg& operator&=(uint8_t v) { RegWrite(reg,RegRead(reg)&v); return *this; };
+			Reg& operator^=(uint8_t v) { RegWrite(reg,RegRead(reg)^v); return *this; };
+	};
+}
+
+#define PINB	(Host::Reg(Host::REG_PINB))
+#define DDRB	(Host::Reg(Host::REG_DDRB))
+#define PORTB	(Host::Reg(Host::REG_PORTB))
+#define PINC	(Host::Reg(Host::REG_PINC))
+#define DDRC	(Host::Reg(Host::REG_DDRC))
+#define PORTC	(Host::Reg(Host::REG_PORTC))
+#define PIND	(Host::Reg(Host::REG_PIND))
+#define DDRD	(Host::Reg(Host::REG_DDRD))
+#define PORTD	(Host::Reg(Host::REG_PORTD))
+#define PCICR	(Host::Reg(Host::REG_PCICR))
+#define PCIFR	(Host::Reg(Host::REG_PCIFR))
+#define PCMSK0	(Host::Reg(Host::REG_PCMSK0))
+#define PCMSK1	(Host::Reg(Host::REG_PCMSK1))
+#define PCMSK2	(Host::Reg(Host::REG_PCMSK2))
+#define EICRA	(Host::Reg(Host::REG_EICRA))
+#define EIMSK	(Host::Reg(Host::REG_EIMSK))
+#define EIFR	(Host::Reg(Host::REG_EIFR))
+#define TWBR	(Host::Reg(Host::REG_TWBR))
+#define TWSR	(Host::Reg(Host::REG_TWSR))
+#define TWAR	(Host::Reg(Host::REG_TWAR))
+#define TWDR	(Host::Reg(Host::REG_TWDR))
+#define TWCR	(Host::Reg(Host::REG_TWCR))
+
+// SREG
+
+#define SREG_I	7
+
+// WDTCSR
+
+#define WDIF	7
+#define WDIE	6
+#define WDP3	5
+#define WDCE	4
+#define WDE		3
+#define WDP2	2
+#define WDP1	1
+#define WDP0	0
+
+// MCUSR
+
+#define WDRF	3
+#define BORF	2
+#define EXTRF	1
+#define PORF	0
+
+// PCICR, PCIFR
+
+#define PCIE2	2
+#define PCIE1	1
+#define PCIE0	0
+#define PCIF2	2
+#define PCIF1	1
+#define PCIF0	0
+
+// EICRA, EIMSK, EIFR
+
+#define ISC11	3
+#define ISC10	2
+#define ISC01	1
+#define ISC00	0
+#define INT1	1
+#define INT0	0
+#define INTF1	1
+#define INTF0	0
+
+// TWCR, TWSR
+
+#define TWINT	7
+#define TWEA	6
+#define TWSTA	5
+#define TWSTO	4
+#define TWWC	3
+#define TWEN	2
+#define TWIE	0
+#define TWPS1	1
+#define TWPS0	0
+
+#define _BV(b)	(1<<(b))
+
+#endif
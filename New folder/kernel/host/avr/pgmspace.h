@@ -0,0 +1,20 @@
+///////////////////////////////////////////////////////////////////////////////
+/// avr/pgmspace.h (host)
+///
+/// There is one address space on the host, so flash reads are plain reads
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HOST_AVR_PGMSPACE_H_
+#define _HOST_AVR_PGMSPACE_H_
+
+#include <stdint.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(addr)		(*(const uint8_t *)(addr))
+#define pgm_read_word(addr)		(*(const uint16_t *)(addr))
+#define pgm_read_dword(addr)	(*(const uint32_t *)(addr))
+#define pgm_read_ptr(addr)		(*(void * const *)(addr))
+
+#endif
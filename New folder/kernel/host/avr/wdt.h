@@ -0,0 +1,28 @@
+///////////////////////////////////////////////////////////////////////////////
+/// avr/wdt.h (host)
+///
+/// Watchdog periods, a reset that does nothing and a disable that clears
+/// WDTCSR. A test harness simulates expiry by calling WDT_vect().
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _HOST_AVR_WDT_H_
+#define _HOST_AVR_WDT_H_
+
+#include <avr/io.h>
+
+#define WDTO_15MS	0
+#define WDTO_30MS	1
+#define WDTO_60MS	2
+#define WDTO_120MS	3
+#define WDTO_250MS	4
+#define WDTO_500MS	5
+#define WDTO_1S		6
+#define WDTO_2S		7
+#define WDTO_4S		8
+#define WDTO_8S		9
+
+#define wdt_reset()	do {} while(0)
+#define wdt_disable()	do { WDTCSR=0; } while(0)
+
+#endif
@@ -0,0 +1,129 @@
+///////////////////////////////////////////////////////////////////////////////
+/// host.cpp
+///
+/// Host build support: per-thread registers and the virtual clock
+///
+/// Each thread that uses the kernel gets its own Kernel::OS, with its own
+/// task ring, message queue, watchdog and clock, so independent simulated
+/// controllers can run on as many threads as the machine has cores:
+///
+///	static void Rig(int seed)
+///	{
+///		setup();								// calls UserInit for this rig
+///		for(int pass=0;pass<1000000;pass++) {
+///			loop();
+///			Kernel::OS.Advance(50);				// 50us of virtual time per pass
+///		}
+///	}
+///
+///	std::vector<std::thread> rigs;
+///	for(int i=0;i<200;i++) rigs.emplace_back(Rig,i);
+///	for(auto& t : rigs) t.join();
+///
+/// Module state in the application must be per-instance too: declare it
+/// with KERNEL_INSTANCE (see sysincs.h).
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+
+#ifdef KERNEL_HOST
+
+#include <stdio.h>
+
+thread_local volatile uint8_t SREG=_BV(SREG_I);
+thread_local volatile uint8_t WDTCSR=0;
+thread_local volatile uint8_t MCUSR=0;
+
+thread_local void (* HostClockHook)(unsigned int cycles)=NULL;
+
+HardwareSerial Serial;
+
+// AVR cycles taken by millis() and micros(), charged when the simulator runs
+
+#define HOST_MILLIS_CYCLES	20
+#define HOST_MICROS_CYCLES	40
+
+///////////////////////////////////////////////////////////////////////////////
+/// millis, micros
+///
+/// Virtual time of the calling thread's kernel instance
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: none
+/// @return: unsigned long - time since the instance started
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long millis(void)
+{
+	if(HostClockHook) {
+		HostClockHook(HOST_MILLIS_CYCLES);
+	}
+	return Kernel::OS.Clock/1000;
+}
+
+unsigned long micros(void)
+{
+	if(HostClockHook) {
+		HostClockHook(HOST_MICROS_CYCLES);
+	}
+	return Kernel::OS.Clock;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// delay, delayMicroseconds
+///
+/// Busy waits take no real time: they move the virtual clock on
+///
+/// @context: TASK
+/// @scope: EXPORTED
+/// @param: time to wait
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void delay(unsigned long ms)
+{
+	Kernel::OS.Advance(ms*1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+	Kernel::OS.Advance(us);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Print
+///
+/// Serial output, to stdout
+///
+/// @context: TASK
+/// @scope: PUBLIC
+/// @param: what to print
+/// @return: size_t - characters printed
+///
+///////////////////////////////////////////////////////////////////////////////
+
+size_t Print::print(const char * s)
+{
+	return fputs(s,stdout)<0?0:strlen(s);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+	return printf(base==16?"%lx":"%lu",n);
+}
+
+size_t Print::print(long n, int base)
+{
+	return (base==16)?printf("%lx",n):printf("%ld",n);
+}
+
+size_t Print::println(void)
+{
+	return print("\n");
+}
+
+#endif
@@ -0,0 +1,169 @@
+///////////////////////////////////////////////////////////////////////////////
+/// iiclock.cpp
+///
+/// Host rig: the I2C bus lock held by a preemptive task across sleeps
+///
+/// A preemptive task takes the lock, sleeps, writes to the LCD backpack's
+/// latch, sleeps again, writes once more and unlocks. Meanwhile the task
+/// ring runs two handlers that take a millisecond or two, so the scheduler
+/// ticks, and the task runs and sleeps, under whichever handler the ring is
+/// calling. The handlers try the lock too: the idle task must be refused
+/// while the task holds it, and get it once the task lets go.
+///
+/// Built with KERNEL_MODE_PREEMPTIVE, and with any of the driver options
+/// (IIC_ASYNC for one). Prints each failure and returns nonzero if there
+/// were any.
+///
+///	g++ -std=gnu++11 -fpermissive -DKERNEL_HOST -DKERNEL_MODE_PREEMPTIVE
+///		-Ikernel/host -Ikernel -Ipart2_template_files kernel/*.cpp
+///		kernel/host/*.cpp part2_template_files/iic.cpp kernel/host/rigs/iiclock.cpp
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+#include "sim.h"
+#include "simdevices.h"
+#include "iic.h"
+#include <stdio.h>
+
+#ifndef KERNEL_MODE_PREEMPTIVE
+#error "iiclock tests the bus lock from a preemptive task: build with KERNEL_MODE_PREEMPTIVE"
+#endif
+
+#define RIG_LCD_ADDR	(0x3f<<1)		// as display.h, shifted
+#define RIG_SLEEP_MS	3
+#define RIG_PASSES		100				// ring passes: long enough for the task to finish
+
+static Host::SimPCF8574 Backpack(RIG_LCD_ADDR);
+
+PRE_STACK(OwnerStack,128);
+
+static int Failures=0;
+static int LockRC=IIC_PENDING, WriteRC[2]={IIC_PENDING,IIC_PENDING};
+static unsigned char Latched[2];
+static unsigned char Held=0, Done=0;
+static unsigned long Refused=0, Taken=0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Check
+///
+/// Report a failed expectation
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: bool ok, const char * what, long got, long want
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void Check(bool ok, const char * what, long got, long want)
+{
+	if(!ok) {
+		printf("FAIL: %s: got %ld, want %ld\n",what,got,want);
+		Failures++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// OwnerTask
+///
+/// Preemptive task: hold the lock over two writes, sleeping between them.
+/// Under IIC_ASYNC the writes are posted, so the latch is read after the
+/// sleep that follows each.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: void * - unused
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void OwnerTask(void *)
+{
+	static unsigned char data[2]={0x55,0xaa};
+
+	LockRC=IICLock();
+	Held=(LockRC==IIC_OK);
+	PRESleep(RIG_SLEEP_MS);
+	for(int n=0;n<2;n++) {
+		WriteRC[n]=IICWrite(RIG_LCD_ADDR,&data[n],1);
+		PRESleep(RIG_SLEEP_MS);
+		Latched[n]=Backpack.Latch;
+	}
+	Held=0;
+	IICUnlock();
+	Done=1;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// RingTask, RingTaskA, RingTaskB
+///
+/// Task ring handlers: take a millisecond or two, so ticks fall inside
+/// them, and try the lock from the idle task. There are two, different so
+/// the compiler can not merge them, and the handler the ring is calling
+/// changes between the task's sleeps.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: unsigned int ms - time to take, or void * - unused
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void RingTask(unsigned int ms)
+{
+	delay(ms);
+	unsigned char held=Held;
+	int rc=IICLock();
+	if(rc==IIC_OK) {
+		Taken++;
+		Check(!held,"idle task took the lock the preemptive task holds",rc,IIC_ERR_BUSY);
+		IICUnlock();
+	} else {
+		Refused++;
+		Check(held,"idle task refused the free lock",rc,IIC_OK);
+	}
+}
+
+static void RingTaskA(void *)
+{
+	RingTask(1);
+}
+
+static void RingTaskB(void *)
+{
+	RingTask(2);
+}
+
+void UserInit(void)
+{
+	Kernel::OS.TaskManager.RegisterTaskHandler(RingTaskA,NULL);
+	Kernel::OS.TaskManager.RegisterTaskHandler(RingTaskB,NULL);
+	Kernel::OS.Preempt.CreateTask(OwnerTask,NULL,1,OwnerStack,sizeof(OwnerStack));
+}
+
+int main(void)
+{
+	Host::Sim.Attach(Backpack);
+	IICInitialize();
+	setup();
+	for(int pass=0;pass<RIG_PASSES;pass++) {
+		loop();
+	}
+
+	Check(Done,"task finished",Done,1);
+	Check(LockRC==IIC_OK,"lock",LockRC,IIC_OK);
+	Check(WriteRC[0]==IIC_OK,"write after a sleep",WriteRC[0],IIC_OK);
+	Check(Latched[0]==0x55,"latch after the first write",Latched[0],0x55);
+	Check(WriteRC[1]==IIC_OK,"write after two sleeps",WriteRC[1],IIC_OK);
+	Check(Latched[1]==0xaa,"latch after the second write",Latched[1],0xaa);
+	Check(Refused>0,"idle task refused while the lock was held",Refused,1);
+	Check(Taken>0,"idle task took the lock once it was free",Taken,1);
+
+	int rc=IICLock();
+	Check(rc==IIC_OK,"lock free at the end",rc,IIC_OK);
+	IICUnlock();
+
+	printf("iiclock: %lu refused, %lu taken, %d failures\n",Refused,Taken,Failures);
+	return Failures?1:0;
+}
@@ -0,0 +1,160 @@
+///////////////////////////////////////////////////////////////////////////////
+/// keyint.cpp
+///
+/// Host rig: the keypad task in KEY_INTERRUPT mode against the simulator
+///
+/// The keypad's MCP23017 is modelled on the bus with INTA wired to PD2, and
+/// KEYTaskHandler runs on the task ring, one pass per millisecond. The rig
+/// checks that an idle keypad puts nothing on the bus, that a press pulls
+/// INTA low and the next pass starts scanning, and that once the key is let
+/// go the scan stops with every column driven low again and the bus goes
+/// quiet. Build it with the other driver options (IIC_ASYNC, KEY_FULLSCAN)
+/// to test those modes too.
+///
+/// Prints each failure and returns nonzero if there were any.
+///
+///	g++ -std=gnu++11 -fpermissive -DKERNEL_HOST -DKEY_INTERRUPT -Ikernel/host -Ikernel
+///		-Ipart2_template_files -Ipart1_template_files/SevenSeg kernel/*.cpp kernel/host/*.cpp
+///		part2_template_files/iic.cpp part2_template_files/mcp23017.cpp
+///		part2_template_files/keypad.cpp kernel/host/rigs/keyint.cpp
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+#include "sim.h"
+#include "simdevices.h"
+#include "iic.h"
+#include "mcp23017.h"
+#include "keypad.h"
+#include <stdio.h>
+
+#ifndef KEY_INTERRUPT
+#error "keyint tests the keypad's interrupt on change: build with KEY_INTERRUPT"
+#endif
+
+#define RIG_KEY_ADDR	0x40			// as keypad.cpp
+#define RIG_INTA		2				// PD2
+#define RIG_COLUMNS		3				// GPA0-2
+#define RIG_PASS_US		1000			// virtual time per pass
+#define RIG_IDLE_PASSES	50				// passes watched for traffic while idle
+#define RIG_HOLD_PASSES	20				// passes a key is held down
+#define RIG_STOP_PASSES	10				// passes allowed for the scan to stop
+
+static Host::SimMCP23017 Keypad(RIG_KEY_ADDR);
+
+// keypad.cpp's task handler. KEYInitializeKeypad is left to register it; the
+// rig does so itself.
+
+void KEYTaskHandler(void * context);
+
+static int Failures=0;
+
+void UserInit(void)
+{
+	Kernel::OS.TaskManager.RegisterTaskHandler(KEYTaskHandler,NULL);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Check
+///
+/// Report a failed expectation
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: bool ok, const char * what, unsigned long got, unsigned long want
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void Check(bool ok, const char * what, unsigned long got, unsigned long want)
+{
+	if(!ok) {
+		printf("FAIL: %s: got %lu, want %lu\n",what,got,want);
+		Failures++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Run
+///
+/// Run the kernel for a number of passes, and return the bus bit times they
+/// took
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: int passes
+/// @return: unsigned long - bit times
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long Run(int passes)
+{
+	unsigned long bits=Host::Sim.BusBits;
+
+	while(passes--) {
+		loop();
+		Kernel::OS.Advance(RIG_PASS_US);
+	}
+	return Host::Sim.BusBits-bits;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// INTA
+///
+/// The level of INTA at the AVR's pin
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: none
+/// @return: unsigned long - 1 high, 0 low
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned long INTA(void)
+{
+	return (Host::Sim.Pins(Host::SIM_PORTD)>>RIG_INTA)&1;
+}
+
+int main(void)
+{
+	Host::Sim.Attach(Keypad);
+	Keypad.ConnectInterrupt(0,Host::SIM_PORTD,RIG_INTA);
+	IICInitialize();
+	KEYInitializeKeypad();
+	setup();
+	Run(RIG_STOP_PASSES);
+
+	// Idle: every column low, INTA high and no traffic at all
+
+	Check(Keypad.Register(MCP_OLATA)==0x00,"idle column drive",Keypad.Register(MCP_OLATA),0x00);
+	Check(INTA()==1,"INTA while idle",INTA(),1);
+	unsigned long idle=Run(RIG_IDLE_PASSES);
+	Check(idle==0,"bit times while idle",idle,0);
+
+	// A press pulls its row low, INTA falls and the next pass scans
+
+	unsigned long interrupts=Host::Sim.Interrupted;
+	Keypad.Press(1,RIG_COLUMNS+2,true);
+	Check(INTA()==0,"INTA on a press",INTA(),0);
+	Check(Host::Sim.Interrupted>interrupts,"pin change interrupts on a press",Host::Sim.Interrupted-interrupts,1);
+	unsigned long first=Run(1);
+	Check(first>0,"bit times on the pass after a press",first,1);
+	unsigned long held=Run(RIG_HOLD_PASSES);
+	Check(held>0,"bit times while a key is held",held,1);
+
+	// Let go: the scan stops, the columns go back low and the bus is quiet
+
+	Keypad.Press(1,RIG_COLUMNS+2,false);
+	Run(RIG_STOP_PASSES);
+	Check(Keypad.Register(MCP_OLATA)==0x00,"column drive after release",Keypad.Register(MCP_OLATA),0x00);
+	Check(INTA()==1,"INTA after release",INTA(),1);
+	unsigned long after=Run(RIG_IDLE_PASSES);
+	Check(after==0,"bit times once released",after,0);
+
+	IICSTATS stats;
+	IICGetStats(&stats);
+	Check(stats.timeouts==0,"bus timeouts",stats.timeouts,0);
+	printf("keyint: %lu bit times on the first pass, %lu a pass held, %d failures\n",
+		first,held/RIG_HOLD_PASSES,Failures);
+	return Failures?1:0;
+}
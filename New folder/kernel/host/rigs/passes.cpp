@@ -0,0 +1,159 @@
+///////////////////////////////////////////////////////////////////////////////
+/// passes.cpp
+///
+/// Host rig: scheduling passes per second with the Arduino core's main()
+/// and with KERNEL_OWNS_MAIN's
+///
+/// Both drivers run the same kernel loop() over the same tasks. The core's
+/// calls serialEventRun() after every pass; the kernel's calls it every
+/// KERNEL_SERIALEVENT_PASSES passes. serialEventRun here is the core's own
+/// (HardwareSerial.cpp), with Serial in use and no serialEvent() handler,
+/// as in most sketches.
+///
+/// Times are the PC's, so the passes per second are not the Uno's: the
+/// ratio of the two is the figure to look at. On the part, build with
+/// KERNEL_PASS_COUNTER and sample Kernel::Passes once a second.
+///
+///	g++ -std=gnu++11 -fpermissive -O2 -DKERNEL_HOST -Ikernel/host -Ikernel
+///		kernel/*.cpp kernel/host/host.cpp kernel/host/rigs/passes.cpp
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+#include <stdio.h>
+#include <chrono>
+
+#define RIG_PASSES		200000UL		// passes per run
+#define RIG_PASS_US		25				// virtual time per pass
+#define RIG_RUNS		60				// runs of each driver, taken in turn
+
+//
+// The core's serial event poll. The core also tests the addresses of
+// serialEventRun and Serial0_available, which are weak there; here they are
+// defined, so only serialEvent's is tested.
+
+void serialEvent(void) __attribute__((weak));
+bool Serial0_available(void) __attribute__((noinline));
+
+static volatile unsigned char RxHead=0, RxTail=0;
+
+bool Serial0_available(void)
+{
+	return RxHead!=RxTail;
+}
+
+void serialEventRun(void) __attribute__((noinline));
+
+void serialEventRun(void)
+{
+	if(serialEvent && Serial0_available()) {
+		serialEvent();
+	}
+}
+
+//
+// A typical task set: a periodic timer, a message and two polled tasks
+
+static KERNEL_INSTANCE Kernel::OSTimer Tick(10);
+static KERNEL_INSTANCE unsigned long Ticks=0, Messages=0, Polls=0;
+
+static void TickTask(void *)
+{
+	if(Tick.isExpired()) {
+		Ticks++;
+		Kernel::OS.MessageQueue.Post(1,NULL,Kernel::MQ_OWNER_CALLER,Kernel::MQ_CONTEXT_TASK);
+	}
+}
+
+static void PollTask(void *)
+{
+	Polls++;
+}
+
+static void OnMessage(void *)
+{
+	Messages++;
+}
+
+void UserInit(void)
+{
+	Tick.SetPeriodic(10);
+	Kernel::OS.TaskManager.RegisterTaskHandler(TickTask,NULL);
+	Kernel::OS.TaskManager.RegisterTaskHandler(PollTask,NULL);
+	Kernel::OS.TaskManager.RegisterTaskHandler(PollTask,NULL);
+	Kernel::OS.MessageQueue.Subscribe(1,OnMessage);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// CoreMain, KernelMain
+///
+/// The loops of the two main()s, for a fixed number of passes
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: unsigned long passes
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void CoreMain(unsigned long passes)
+{
+	while(passes--) {
+		loop();
+		serialEventRun();
+		Kernel::OS.Advance(RIG_PASS_US);
+	}
+}
+
+static void KernelMain(unsigned long passes)
+{
+	unsigned char serial=KERNEL_SERIALEVENT_PASSES;
+	while(passes--) {
+		loop();
+		if(--serial==0) {
+			serial=KERNEL_SERIALEVENT_PASSES;
+			serialEventRun();
+		}
+		Kernel::OS.Advance(RIG_PASS_US);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Rate
+///
+/// Passes per second of one run of a driver, keeping the best so far. The
+/// best of many short runs is the least disturbed by the rest of the PC.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: driver
+/// @param: double& best - the best rate so far
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void Rate(void (* driver)(unsigned long), double& best)
+{
+	auto start=std::chrono::steady_clock::now();
+	driver(RIG_PASSES);
+	std::chrono::duration<double> took=std::chrono::steady_clock::now()-start;
+	double rate=RIG_PASSES/took.count();
+	if(rate>best) {
+		best=rate;
+	}
+}
+
+int main(void)
+{
+	double core=0, kernel=0;
+
+	setup();
+	for(int run=0;run<RIG_RUNS;run++) {				// in turn, so both see the same load
+		Rate(CoreMain,core);
+		Rate(KernelMain,kernel);
+	}
+	printf("core main:   %10.0f passes/s\n",core);
+	printf("kernel main: %10.0f passes/s (%+.1f%%)\n",kernel,(kernel/core-1.0)*100.0);
+	printf("ticks %lu messages %lu polls %lu\n",Ticks,Messages,Polls);
+	return (Ticks && Ticks==Messages)?0:1;
+}
@@ -0,0 +1,163 @@
+///////////////////////////////////////////////////////////////////////////////
+/// seqlock.cpp
+///
+/// Host rig: SeqLock<T>::Read and DoubleBuffer<T>::Read against writes that
+/// land part way through their copy
+///
+/// The value type copies itself one word at a time and can run an "ISR"
+/// after any word, so each test puts the writes exactly where they do the
+/// most harm instead of waiting for a timer to hit them:
+///
+///	- SeqLock: one write after each word of the copy, then a write in each
+///	  of several copies running. Read must retry and return a whole value.
+///	- DoubleBuffer: one write during the copy needs no retry and returns the
+///	  value being copied; two writes, the second overwriting the copy being
+///	  read, must retry.
+///
+/// Prints each failure and returns nonzero if there were any.
+///
+///	g++ -std=gnu++11 -fpermissive -DKERNEL_HOST -Ikernel/host -Ikernel
+///		kernel/*.cpp kernel/host/host.cpp kernel/host/rigs/seqlock.cpp
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+#include <stdio.h>
+
+#define RIG_WORDS		8
+
+void UserInit(void) {}
+
+//
+// A value whose copies can be interrupted
+
+static void (* Isr)(void)=NULL;			// run after word IsrAt of a copy
+static int IsrAt=-1;
+static int IsrTimes=0;					// copies still to interrupt
+static bool InIsr=false;
+static unsigned long Copies=0;			// copies made by reads
+
+struct Value {
+
+	unsigned long	w[RIG_WORDS];
+
+	Value(unsigned long g=0) { for(int i=0;i<RIG_WORDS;i++) w[i]=g; };
+	Value(const Value& v) { memcpy(w,v.w,sizeof(w)); };
+
+	Value& operator=(const Value& v)
+	{
+		int fire=(IsrTimes>0 && !InIsr);	// an ISR's own copies are not interrupted
+		if(fire) {
+			IsrTimes--;
+			Copies++;
+		}
+		for(int i=0;i<RIG_WORDS;i++) {
+			w[i]=v.w[i];
+			if(fire && i==IsrAt && Isr) {
+				InIsr=true;
+				Isr();
+				InIsr=false;
+			}
+		}
+		return *this;
+	};
+
+	bool Whole(void) const
+	{
+		for(int i=1;i<RIG_WORDS;i++) {
+			if(w[i]!=w[0]) {
+				return false;
+			}
+		}
+		return true;
+	};
+};
+
+static Kernel::SeqLock<Value> Seq(Value(1));
+static Kernel::DoubleBuffer<Value> Dbl(Value(1));
+static unsigned long Gen=1;						// last value published
+static int Writes=1;							// publishes per ISR
+
+static void SeqIsr(void)
+{
+	for(int n=0;n<Writes;n++) {
+		Seq.WriteFromISR(Value(++Gen));
+	}
+}
+
+static void DblIsr(void)
+{
+	for(int n=0;n<Writes;n++) {
+		Dbl.WriteFromISR(Value(++Gen));
+	}
+}
+
+static int Failures=0;
+
+///////////////////////////////////////////////////////////////////////////////
+/// Check
+///
+/// Report a failed expectation
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: bool ok, const char * what, int at - word the ISR ran after
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void Check(bool ok, const char * what, int at)
+{
+	if(!ok) {
+		printf("FAIL: %s (ISR after word %d)\n",what,at);
+		Failures++;
+	}
+}
+
+int main(void)
+{
+	// Values are taken by copy construction: only the reads' own copies
+	// use operator=, so only they are interrupted.
+
+	// SeqLock: one write mid-copy costs one retry and gives the new value
+
+	for(int at=0;at<RIG_WORDS;at++) {
+		Isr=SeqIsr; IsrAt=at; IsrTimes=1; Writes=1; Copies=0;
+		Value v=Seq.Read();
+		Check(v.Whole(),"seqlock read torn",at);
+		Check(v.w[0]==Gen,"seqlock read not the latest",at);
+		Check(Copies==1 && IsrTimes==0,"seqlock did not retry",at);
+	}
+
+	// SeqLock: a write in each of the first five copies
+
+	for(int at=0;at<RIG_WORDS;at++) {
+		Isr=SeqIsr; IsrAt=at; IsrTimes=5; Writes=1;
+		Value v=Seq.Read();
+		Check(v.Whole() && v.w[0]==Gen,"seqlock read torn under repeated writes",at);
+		Check(IsrTimes==0,"seqlock gave up retrying",at);
+	}
+
+	// DoubleBuffer: one write mid-copy leaves the copy being read alone
+
+	for(int at=0;at<RIG_WORDS;at++) {
+		unsigned long was=Dbl.ReadFromISR().w[0];
+		Isr=DblIsr; IsrAt=at; IsrTimes=2; Writes=1;
+		Value v=Dbl.Read();
+		Check(v.Whole() && v.w[0]==was,"double buffer read torn by one write",at);
+		Check(IsrTimes==1,"double buffer retried after one write",at);
+	}
+
+	// DoubleBuffer: two writes mid-copy, the second into the copy being read
+
+	for(int at=0;at<RIG_WORDS-1;at++) {
+		Isr=DblIsr; IsrAt=at; IsrTimes=1; Writes=2;
+		Value v=Dbl.Read();
+		Check(v.Whole() && v.w[0]==Gen,"double buffer read torn by two writes",at);
+		Check(IsrTimes==0,"double buffer did not retry",at);
+	}
+
+	IsrTimes=0;
+	printf("seqlock: %d failures\n",Failures);
+	return Failures?1:0;
+}
@@ -0,0 +1,222 @@
+///////////////////////////////////////////////////////////////////////////////
+/// simkeypad.cpp
+///
+/// Host rig: the keypad and I2C drivers against the peripheral simulator
+///
+/// The keypad's MCP23017 and the LCD backpack's PCF8574 are modelled on the
+/// bus. Each key in turn, then two at once, is pressed and read back with
+/// KEYScan; a register read is checked against its bit count on the bus,
+/// and a byte written to the backpack against its latch. Then the bus
+/// faults: a slave stuck holding SDA low, which must time out, be recovered
+/// within the keypad's latency bound and leave the bus working; an address
+/// no device answers; and lost arbitration. Last, a second expander's
+/// output latch write loses arbitration, and must be sent again by the next
+/// MCPFlush, even when it failed after it was posted. Build it with any of
+/// the driver options (IIC_ASYNC, KEY_INTERRUPT, KEY_FULLSCAN) to test that
+/// mode.
+///
+/// Prints each failure and returns nonzero if there were any.
+///
+///	g++ -std=gnu++11 -fpermissive -DKERNEL_HOST -Ikernel/host -Ikernel
+///		-Ipart2_template_files -Ipart1_template_files/SevenSeg kernel/*.cpp kernel/host/*.cpp
+///		part2_template_files/iic.cpp part2_template_files/mcp23017.cpp
+///		part2_template_files/keypad.cpp kernel/host/rigs/simkeypad.cpp
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+#include "sim.h"
+#include "simdevices.h"
+#include "iic.h"
+#include "mcp23017.h"
+#include "keypad.h"
+#include <stdio.h>
+
+#define RIG_KEY_ADDR	0x40			// as keypad.cpp
+#define RIG_LCD_ADDR	(0x3f<<1)		// as display.h, shifted
+#define RIG_EXP_ADDR	(0x21<<1)		// the second expander
+#define RIG_COLUMNS		3				// GPA0-2
+#define RIG_ROWS		4				// GPA3-6
+#define RIG_READ_BITS	39				// start, SLA+W, reg, repeated start, SLA+R, data, stop
+#define RIG_NO_ADDR		(0x22<<1)		// nothing answers here
+#define RIG_STUCK		5				// SCL clocks a stuck slave needs to let go
+#define RIG_RECOVER_US	150				// IICRecover's 100us, and the scan's own bus time
+
+// Longest a keypad scan may take on a stuck bus: the polled driver gives up
+// after IIC_TIMEOUT_US, the interrupt-driven one once the timeout, rounded
+// up to whole milliseconds plus one, has passed. With KEY_INTERRUPT the scan
+// then writes the columns back low, 29 bit times at 100kHz.
+
+#ifdef IIC_ASYNC
+#define RIG_TIMEOUT_US	(((IIC_TIMEOUT_US+999)/1000+1)*1000UL)
+#else
+#define RIG_TIMEOUT_US	IIC_TIMEOUT_US
+#endif
+#ifdef KEY_INTERRUPT
+#define RIG_COLUMNS_US	300
+#else
+#define RIG_COLUMNS_US	0
+#endif
+#define RIG_SCAN_MAX_US	(RIG_TIMEOUT_US+RIG_RECOVER_US+RIG_COLUMNS_US)
+
+static Host::SimMCP23017 Keypad(RIG_KEY_ADDR);
+static Host::SimPCF8574 Backpack(RIG_LCD_ADDR);
+static Host::SimMCP23017 Expander(RIG_EXP_ADDR);
+
+static int Failures=0;
+
+void UserInit(void) {}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Check
+///
+/// Report a failed expectation
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: bool ok, const char * what, unsigned int got, unsigned int want
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void Check(bool ok, const char * what, unsigned int got, unsigned int want)
+{
+	if(!ok) {
+		printf("FAIL: %s: got %03x, want %03x\n",what,got,want);
+		Failures++;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// Scan
+///
+/// Read the keypad, and check the result against the keys down
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: unsigned int want - keys expected down, bit row*3+col
+/// @param: const char * what - for the report
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void Scan(unsigned int want, const char * what)
+{
+	unsigned int keys=0;
+	int rc=KEYScan(&keys);
+
+	Check(rc==IIC_OK,what,(unsigned int)rc,IIC_OK);
+	Check(keys==want,what,keys,want);
+}
+
+int main(void)
+{
+	setup();
+	Host::Sim.Attach(Keypad);
+	Host::Sim.Attach(Backpack);
+	Host::Sim.Attach(Expander);
+	Keypad.ConnectInterrupt(0,Host::SIM_PORTD,2);
+	IICInitialize();
+	KEYInitializeKeypad();
+
+	// With IIC_ASYNC and KEY_FULLSCAN the keypad's first full scan is queued
+	// behind its setup, and KEYScan is refused until it is off the bus
+
+#if defined(IIC_ASYNC) && defined(KEY_FULLSCAN) && !defined(KEY_INTERRUPT)
+	unsigned int early=0;
+	int refused=KEYScan(&early);
+	Check(refused==IIC_ERR_BUSY,"scan during the background scan",(unsigned int)refused,(unsigned int)IIC_ERR_BUSY);
+#endif
+	Kernel::OS.Advance(5000);
+
+	// Every key on its own, then two in different columns
+
+	Scan(0,"no key");
+	for(unsigned char col=0;col<RIG_COLUMNS;col++) {
+		for(unsigned char row=0;row<RIG_ROWS;row++) {
+			Keypad.Press(col,RIG_COLUMNS+row,true);
+			Scan(1<<(row*RIG_COLUMNS+col),"one key");
+			Keypad.Press(col,RIG_COLUMNS+row,false);
+		}
+	}
+	Keypad.Press(0,RIG_COLUMNS+1,true);
+	Keypad.Press(2,RIG_COLUMNS+3,true);
+	Scan((1<<(1*RIG_COLUMNS+0))|(1<<(3*RIG_COLUMNS+2)),"two keys");
+	Keypad.Press(0,RIG_COLUMNS+1,false);
+	Keypad.Press(2,RIG_COLUMNS+3,false);
+
+	// A register read is 39 bit times on the bus. With IIC_ASYNC, first let
+	// anything the keypad left queued finish.
+
+	MCPDEV dev;
+	unsigned char port;
+	MCPInitialize(&dev,RIG_KEY_ADDR);
+	Kernel::OS.Advance(5000);
+	unsigned long bits=Host::Sim.BusBits;
+	int rc=MCPReadPort(&dev,MCP_PORTA,&port);
+	Check(rc==IIC_OK,"register read",(unsigned int)rc,IIC_OK);
+	Check(Host::Sim.BusBits-bits==RIG_READ_BITS,"register read bit times",Host::Sim.BusBits-bits,RIG_READ_BITS);
+
+	// A byte written to the backpack lands in its latch
+
+	unsigned char lcd=0x08;
+	rc=IICWriteRead(RIG_LCD_ADDR,&lcd,1,NULL,0);
+	Check(rc==IIC_OK,"backpack write",(unsigned int)rc,IIC_OK);
+	Check(Backpack.Latch==lcd,"backpack latch",Backpack.Latch,lcd);
+
+	IICSTATS stats;
+	IICGetStats(&stats);
+	Check(stats.timeouts==0,"bus timeouts",stats.timeouts,0);
+
+	// A slave stuck holding SDA low: the scan times out within the bound,
+	// the bus is recovered, and the next scan goes through
+
+	unsigned int keys=0;
+	Host::Sim.StickBus(RIG_STUCK);
+	unsigned long long start=Host::Sim.Now();
+	rc=KEYScan(&keys);
+	unsigned long us=(unsigned long)((Host::Sim.Now()-start)/SIM_CYCLES_PER_US);
+	Check(rc==IIC_ERR_TIMEOUT,"stuck bus",(unsigned int)rc,(unsigned int)IIC_ERR_TIMEOUT);
+	Check(us<=RIG_SCAN_MAX_US,"stuck bus scan time, us",us,RIG_SCAN_MAX_US);
+	IICSTATS after;
+	IICGetStats(&after);
+	Check(after.timeouts==stats.timeouts+1,"stuck bus timeouts",after.timeouts,stats.timeouts+1);
+	Check(after.recoveries>stats.recoveries,"stuck bus recoveries",after.recoveries,stats.recoveries+1);
+	Scan(0,"scan after recovery");
+
+	// No device at the address
+
+	rc=IICWriteRead(RIG_NO_ADDR,&lcd,1,NULL,0);
+	Check(rc==IIC_ERR_ADDR,"no device",(unsigned int)rc,(unsigned int)IIC_ERR_ADDR);
+
+	// Arbitration lost on the start
+
+	Host::Sim.ForceStatus(0x38);
+	rc=IICWriteRead(RIG_LCD_ADDR,&lcd,1,NULL,0);
+	Check(rc==IIC_ERR_ARB,"arbitration lost",(unsigned int)rc,(unsigned int)IIC_ERR_ARB);
+	IICGetStats(&after);
+	Check(after.addrnacks==stats.addrnacks+1,"address nacks",after.addrnacks,stats.addrnacks+1);
+	Check(after.arblost==stats.arblost+1,"arbitration lost",after.arblost,stats.arblost+1);
+	Scan(0,"scan after the faults");
+
+	// A latch write that loses arbitration is sent again by the next flush.
+	// With IIC_ASYNC it is posted, and fails only after MCPFlush returns.
+
+	MCPDEV exp;
+	MCPInitialize(&exp,RIG_EXP_ADDR);
+	rc=MCPFlush(&exp);
+	Check(rc==IIC_OK,"expander setup",(unsigned int)rc,IIC_OK);
+	Kernel::OS.Advance(5000);
+	MCPSetRegister(&exp,MCP_OLATA,0x5a);
+	Host::Sim.ForceStatus(0x38);
+	MCPFlush(&exp);
+	Kernel::OS.Advance(5000);
+	Check(Expander.Register(MCP_OLATA)==0x00,"latch after a lost write",Expander.Register(MCP_OLATA),0x00);
+	rc=MCPFlush(&exp);
+	Check(rc==IIC_OK,"flush after a lost write",(unsigned int)rc,IIC_OK);
+	Kernel::OS.Advance(5000);
+	Check(Expander.Register(MCP_OLATA)==0x5a,"latch after a lost write is resent",Expander.Register(MCP_OLATA),0x5a);
+
+	printf("simkeypad: %lu bit times, %lu interrupts, %d failures\n",Host::Sim.BusBits,Host::Sim.Interrupted,Failures);
+	return Failures?1:0;
+}
@@ -0,0 +1,632 @@
+///////////////////////////////////////////////////////////////////////////////
+/// sim.cpp
+///
+/// Host peripheral simulator
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+
+#ifdef KERNEL_HOST
+
+#include "sim.h"
+
+// The ISRs the code under test may define. Those it does not are NULL.
+
+extern "C" void INT0_vect(void) __attribute__((weak));
+extern "C" void INT1_vect(void) __attribute__((weak));
+extern "C" void PCINT0_vect(void) __attribute__((weak));
+extern "C" void PCINT1_vect(void) __attribute__((weak));
+extern "C" void PCINT2_vect(void) __attribute__((weak));
+extern "C" void TWI_vect(void) __attribute__((weak));
+
+// TWI master states
+
+#define TWI_IDLE		0			// no start sent
+#define TWI_ADDR		1			// start sent: TWDR holds SLA+R/W
+#define TWI_MT			2			// transmitting
+#define TWI_MR			3			// receiving
+#define TWI_NOSLAVE		4			// address not acknowledged
+
+#define SIM_SDA			(1<<4)		// PC4
+#define SIM_SCL			(1<<5)		// PC5
+
+#define SIM_STORM		64			// interrupts in a row before a storm is cut short
+
+namespace Host {
+
+	thread_local SimClass Sim;
+
+	////////////////////////////////////////////////////////////////////////
+	/// RegRead, RegWrite
+	///
+	/// Register proxies: pass the access on to this thread's simulator
+	///
+	/// @context: ANY
+	/// @scope: EXPORTED
+	/// @param: HOSTREG reg - the register
+	/// @param: uint8_t value - to write
+	/// @return: uint8_t - value read
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	uint8_t RegRead(HOSTREG reg)
+	{
+		return Sim.Read(reg);
+	}
+
+	void RegWrite(HOSTREG reg, uint8_t value)
+	{
+		Sim.Write(reg,value);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimClass
+	///
+	/// CONSTRUCTOR
+	///
+	/// Power-on state: all pins inputs, peripherals off, and the TWI pins
+	/// pulled up, as they are on the board. Hooks the kernel clock.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	SimClass::SimClass(void)
+	{
+		for(int p=0;p<SIM_NPORTS;p++) {
+			ddr[p]=port[p]=drive[p]=level[p]=pullup[p]=pcmsk[p]=0;
+		}
+		pullup[SIM_PORTC]=SIM_SDA|SIM_SCL;
+		for(int p=0;p<SIM_NPORTS;p++) {
+			pins[p]=Level((SIMPORT)p);
+		}
+		pcicr=pcifr=eicra=eimsk=eifr=0;
+		twbr=twsr=twdr=twcr=0;
+		twar=0xfe;
+		twstate=TWI_IDLE;
+		twheld=false;
+		twdev=NULL;
+		twstatus=twrx=twfault=0;
+		twdone=twstopdone=SIM_NEVER;
+		stuck=0;
+		sclheld=0;
+		bus=NULL;
+		devices=NULL;
+		inISR=0;
+		lastread=-1;
+
+		Cycles=0;
+		AccessCycles=2;
+		SpinCycles=12;
+		BusBits=Starts=Stops=Nacks=Collisions=0;
+		BusCycles=0;
+		Interrupted=Storms=0;
+
+		HostClockHook=ClockHook;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// ClockHook
+	///
+	/// Called by the host core when the kernel clock is read or moved on
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE, STATIC
+	/// @param: unsigned int cycles - time the read takes on the AVR
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::ClockHook(unsigned int cycles)
+	{
+		Sim.Spend(cycles);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Attach
+	///
+	/// Put a device on the bus, or on the pins
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: the device
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::Attach(I2CDevice& dev)
+	{
+		dev.pNext=bus;
+		bus=&dev;
+	}
+
+	void SimClass::Attach(PinDevice& dev)
+	{
+		dev.pNext=devices;
+		devices=&dev;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Drive, Release, PullUp
+	///
+	/// Drive a pin from outside, stop driving it, or set the external
+	/// pull-ups on a port
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: the pin, or the port and a pull-up mask
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::Drive(SIMPORT p, unsigned char bit, unsigned char high)
+	{
+		drive[p]|=(1<<bit);
+		level[p]=high?(level[p]|(1<<bit)):(level[p]&~(1<<bit));
+		PinsUpdate(p);
+	}
+
+	void SimClass::Release(SIMPORT p, unsigned char bit)
+	{
+		drive[p]&=~(1<<bit);
+		PinsUpdate(p);
+	}
+
+	void SimClass::PullUp(SIMPORT p, unsigned char mask)
+	{
+		pullup[p]=mask;
+		PinsUpdate(p);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Level
+	///
+	/// Pin levels: outputs as the CPU drives them, then inputs as a device
+	/// drives them, then pulled up internally or externally, else low. The
+	/// TWI, when on, holds SDA and SCL high between operations; a stuck
+	/// slave holds SDA low.
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: SIMPORT p - the port
+	/// @return: unsigned char - levels
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned char SimClass::Level(SIMPORT p)
+	{
+		unsigned char out=ddr[p];
+		unsigned char v=(port[p]&out)|(drive[p]&~out&level[p])|(~out&~drive[p]&(port[p]|pullup[p]));
+
+		if(p==SIM_PORTC) {
+			if(twcr&(1<<TWEN)) {
+				v|=SIM_SDA|SIM_SCL;
+			}
+			if(stuck) {
+				v&=~SIM_SDA;
+			}
+		}
+		return v;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// PinsUpdate
+	///
+	/// After anything that may have changed a port's pin levels: raise pin
+	/// change and external interrupt flags, and tell the pin devices
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: SIMPORT p - the port
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::PinsUpdate(SIMPORT p)
+	{
+		unsigned char was=pins[p];
+		unsigned char now=Level(p);
+		unsigned char changed=was^now;
+
+		if(!changed) {
+			return;
+		}
+		pins[p]=now;
+
+		if(changed&pcmsk[p]) {
+			pcifr|=(1<<p);						// PCIF0-2 follow ports B, C, D
+		}
+		if(p==SIM_PORTD) {
+			for(int i=0;i<2;i++) {
+				unsigned char bit=1<<(2+i);		// INT0 on PD2, INT1 on PD3
+				unsigned char sense=(eicra>>(2*i))&3;
+				if((changed&bit) && (sense==1 || (sense==2 && !(now&bit)) || (sense==3 && (now&bit)))) {
+					eifr|=(1<<i);
+				}
+			}
+		}
+
+		for(PinDevice * dev=devices;dev;dev=dev->pNext) {
+			dev->PinsChanged(p,was,now);
+		}
+		Interrupts();
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Interrupts
+	///
+	/// Run the ISRs of any interrupts pending and enabled, highest priority
+	/// first, while the I flag is set and no ISR is running. An ISR that
+	/// leaves its interrupt pending is run again, as on the AVR, up to
+	/// SIM_STORM times in a row.
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::Interrupts(void)
+	{
+		for(int run=0;!inISR && (SREG&_BV(SREG_I));run++) {
+			void (* vector)(void)=NULL;
+
+			for(int i=0;i<2 && !vector;i++) {
+				if(eimsk&(1<<i)) {
+					unsigned char sense=(eicra>>(2*i))&3;
+					if(sense==0 && !(pins[SIM_PORTD]&(1<<(2+i)))) {
+						vector=i?INT1_vect:INT0_vect;		// low level: no flag
+					} else if(sense && (eifr&(1<<i))) {
+						eifr&=~(1<<i);
+						vector=i?INT1_vect:INT0_vect;
+					}
+				}
+			}
+			for(int p=0;p<SIM_NPORTS && !vector;p++) {
+				if((pcicr&(1<<p)) && (pcifr&(1<<p))) {
+					pcifr&=~(1<<p);
+					vector=(p==0)?PCINT0_vect:(p==1)?PCINT1_vect:PCINT2_vect;
+				}
+			}
+			if(!vector && (twcr&(1<<TWINT)) && (twcr&(1<<TWIE))) {
+				vector=TWI_vect;
+			}
+			if(!vector) {
+				return;
+			}
+			if(run==SIM_STORM) {
+				Storms++;
+				return;
+			}
+
+			Interrupted++;
+			inISR=1;
+			SREG&=~_BV(SREG_I);
+			vector();
+			SREG|=_BV(SREG_I);
+			inISR=0;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Spend, Sync
+	///
+	/// Move time on, completing bus operations as they fall due and taking
+	/// their interrupts at that time. Sync catches up with the kernel clock
+	/// when the harness has moved it on.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC, PRIVATE
+	/// @param: unsigned long cycles - CPU cycles
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::Spend(unsigned long cycles)
+	{
+		unsigned long long kernel=(unsigned long long)Kernel::OS.Clock*SIM_CYCLES_PER_US;
+		unsigned long long target=((kernel>Cycles)?kernel:Cycles)+cycles;
+
+		for(;;) {
+			unsigned long long next=(twdone<twstopdone)?twdone:twstopdone;
+			if(next>target) {
+				break;
+			}
+			if(next>Cycles) {
+				Cycles=next;
+			}
+			if(twstopdone<=Cycles) {
+				twstopdone=SIM_NEVER;
+				twcr&=~(1<<TWSTO);
+			}
+			if(twdone<=Cycles) {
+				TWIComplete();
+			}
+			Kernel::OS.Clock=Cycles/SIM_CYCLES_PER_US;
+			Interrupts();
+		}
+		if(target>Cycles) {
+			Cycles=target;
+		}
+		Kernel::OS.Clock=Cycles/SIM_CYCLES_PER_US;
+		Interrupts();
+	}
+
+	void SimClass::Sync(void)
+	{
+		Spend(0);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// TWIBitCycles
+	///
+	/// One SCL period: F_CPU/(16+2*TWBR*4^TWPS) Hz
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: unsigned long - CPU cycles
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned long SimClass::TWIBitCycles(void)
+	{
+		return 16+((unsigned long)twbr<<(2*(twsr&3)+1));
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// TWIOperate
+	///
+	/// A write to TWCR. With TWINT written as one, start the operation the
+	/// other bits ask for: a stop, a start, or a byte out or in. It completes,
+	/// setting TWINT, after its bus time: one SCL period for a start or stop,
+	/// nine for a byte and its acknowledge.
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: unsigned char v - value written
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::TWIOperate(unsigned char v)
+	{
+		const unsigned char ctl=(1<<TWEA)|(1<<TWSTA)|(1<<TWSTO)|(1<<TWEN)|(1<<TWIE);
+
+		twcr=(v&ctl)|(twcr&((1<<TWINT)|(1<<TWWC)));
+
+		if(!(v&(1<<TWEN))) {					// off: abandon everything
+			twcr&=~((1<<TWINT)|(1<<TWSTA)|(1<<TWSTO)|(1<<TWWC));
+			twstate=TWI_IDLE;
+			twheld=false;
+			twdev=NULL;
+			twdone=twstopdone=SIM_NEVER;
+			PinsUpdate(SIM_PORTC);
+			return;
+		}
+		PinsUpdate(SIM_PORTC);
+		if(!(v&(1<<TWINT))) {
+			return;
+		}
+		twcr&=~((1<<TWINT)|(1<<TWWC));
+
+		unsigned long bit=TWIBitCycles();
+		unsigned long long start=Cycles;
+		unsigned int bits;
+
+		if(v&(1<<TWSTO)) {
+			for(I2CDevice * dev=bus;dev;dev=dev->pNext) {
+				dev->Stop();
+			}
+			Stops++;
+			BusBits++;
+			BusCycles+=bit;
+			twstate=TWI_IDLE;
+			twheld=false;
+			twdev=NULL;
+			twstopdone=stuck?SIM_NEVER:Cycles+bit;
+			if(!(v&(1<<TWSTA))) {
+				return;							// no TWINT after a stop
+			}
+			start=Cycles+bit;					// the start follows the stop
+		}
+
+		if(twfault) {
+			twstatus=twfault;
+			twfault=0;
+			twstate=TWI_IDLE;
+			twheld=false;
+			twdev=NULL;
+			bits=1;
+		} else if(v&(1<<TWSTA)) {
+			for(I2CDevice * dev=bus;dev;dev=dev->pNext) {
+				dev->Stop();
+			}
+			twstatus=twheld?0x10:0x08;
+			twstate=TWI_ADDR;
+			twheld=true;
+			twdev=NULL;
+			Starts++;
+			bits=1;
+		} else {
+			bool ack;
+			bits=9;
+			switch(twstate) {
+				case TWI_ADDR:
+					twdev=NULL;
+					for(I2CDevice * dev=bus;dev && !twdev;dev=dev->pNext) {
+						if(dev->addr==(twdr&0xfe)) {
+							twdev=dev;
+						}
+					}
+					ack=twdev && twdev->Address(twdr&1);
+					if(twdr&1) {
+						twstatus=ack?0x40:0x48;
+						twstate=ack?TWI_MR:TWI_NOSLAVE;
+					} else {
+						twstatus=ack?0x18:0x20;
+						twstate=ack?TWI_MT:TWI_NOSLAVE;
+					}
+					if(!ack) {
+						twdev=NULL;
+						Nacks++;
+					}
+					break;
+
+				case TWI_MT:
+					ack=twdev->Write(twdr);
+					twstatus=ack?0x28:0x30;
+					if(!ack) {
+						Nacks++;
+					}
+					break;
+
+				case TWI_MR:
+					twrx=twdev->Read(v&(1<<TWEA));
+					twstatus=(v&(1<<TWEA))?0x50:0x58;
+					break;
+
+				default:						// nothing sensible to do: bus error
+					twstatus=0x00;
+					twstate=TWI_IDLE;
+					twheld=false;
+					bits=1;
+					break;
+			}
+		}
+
+		BusBits+=bits;
+		BusCycles+=(unsigned long long)bits*bit;
+		twdone=stuck?SIM_NEVER:start+(unsigned long long)bits*bit;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// TWIComplete
+	///
+	/// The operation on the bus has finished: set the status and TWINT
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::TWIComplete(void)
+	{
+		twdone=SIM_NEVER;
+		twsr=(twsr&3)|twstatus;
+		if(twstatus==0x50 || twstatus==0x58) {
+			twdr=twrx;
+		}
+		twcr|=(1<<TWINT);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Read
+	///
+	/// Register read. Reading the register just read is taken as one turn
+	/// of a polling loop.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC
+	/// @param: HOSTREG reg - the register
+	/// @return: unsigned char - its value
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned char SimClass::Read(HOSTREG reg)
+	{
+		Spend((lastread==reg)?SpinCycles:AccessCycles);
+		lastread=reg;
+		switch(reg) {
+			case REG_PINB:		return Level(SIM_PORTB);
+			case REG_DDRB:		return ddr[SIM_PORTB];
+			case REG_PORTB:		return port[SIM_PORTB];
+			case REG_PINC:		return Level(SIM_PORTC);
+			case REG_DDRC:		return ddr[SIM_PORTC];
+			case REG_PORTC:		return port[SIM_PORTC];
+			case REG_PIND:		return Level(SIM_PORTD);
+			case REG_DDRD:		return ddr[SIM_PORTD];
+			case REG_PORTD:		return port[SIM_PORTD];
+			case REG_PCICR:		return pcicr;
+			case REG_PCIFR:		return pcifr;
+			case REG_PCMSK0:	return pcmsk[SIM_PORTB];
+			case REG_PCMSK1:	return pcmsk[SIM_PORTC];
+			case REG_PCMSK2:	return pcmsk[SIM_PORTD];
+			case REG_EICRA:		return eicra;
+			case REG_EIMSK:		return eimsk;
+			case REG_EIFR:		return eifr;
+			case REG_TWBR:		return twbr;
+			case REG_TWSR:		return twsr;
+			case REG_TWAR:		return twar;
+			case REG_TWDR:		return twdr;
+			case REG_TWCR:		return twcr;
+			default:			return 0;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Write
+	///
+	/// Register write. Flag registers clear the bits written as one. With
+	/// the TWI off, SCL driven low and then released counts as one clock
+	/// towards freeing a stuck bus.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC
+	/// @param: HOSTREG reg - the register
+	/// @param: unsigned char value - to write
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimClass::Write(HOSTREG reg, unsigned char value)
+	{
+		Spend(AccessCycles);
+		lastread=-1;
+		switch(reg) {
+			case REG_PINB:		port[SIM_PORTB]^=value;	PinsUpdate(SIM_PORTB);	break;
+			case REG_DDRB:		ddr[SIM_PORTB]=value;	PinsUpdate(SIM_PORTB);	break;
+			case REG_PORTB:		port[SIM_PORTB]=value;	PinsUpdate(SIM_PORTB);	break;
+			case REG_PINC:		port[SIM_PORTC]^=value;	PinsUpdate(SIM_PORTC);	break;
+			case REG_DDRC:		ddr[SIM_PORTC]=value;	PinsUpdate(SIM_PORTC);	break;
+			case REG_PORTC:		port[SIM_PORTC]=value;	PinsUpdate(SIM_PORTC);	break;
+			case REG_PIND:		port[SIM_PORTD]^=value;	PinsUpdate(SIM_PORTD);	break;
+			case REG_DDRD:		ddr[SIM_PORTD]=value;	PinsUpdate(SIM_PORTD);	break;
+			case REG_PORTD:		port[SIM_PORTD]=value;	PinsUpdate(SIM_PORTD);	break;
+			case REG_PCICR:		pcicr=value&7;			Interrupts();			break;
+			case REG_PCIFR:		pcifr&=~value;									break;
+			case REG_PCMSK0:	pcmsk[SIM_PORTB]=value;							break;
+			case REG_PCMSK1:	pcmsk[SIM_PORTC]=value;							break;
+			case REG_PCMSK2:	pcmsk[SIM_PORTD]=value;							break;
+			case REG_EICRA:		eicra=value&0x0f;								break;
+			case REG_EIMSK:		eimsk=value&3;			Interrupts();			break;
+			case REG_EIFR:		eifr&=~value;									break;
+			case REG_TWBR:		twbr=value;										break;
+			case REG_TWSR:		twsr=(twsr&0xf8)|(value&3);						break;
+			case REG_TWAR:		twar=value;										break;
+			case REG_TWDR:
+				if(twdone!=SIM_NEVER) {
+					twcr|=(1<<TWWC);			// written while the TWI is busy
+					Collisions++;
+				} else {
+					twdr=value;
+				}
+				break;
+			case REG_TWCR:		TWIOperate(value);								break;
+			default:															break;
+		}
+
+		if(reg==REG_DDRC || reg==REG_PORTC) {
+			unsigned char held=!(twcr&(1<<TWEN)) && (ddr[SIM_PORTC]&SIM_SCL) && !(port[SIM_PORTC]&SIM_SCL);
+			if(sclheld && !held && stuck) {
+				stuck--;
+				PinsUpdate(SIM_PORTC);
+			}
+			sclheld=held;
+		}
+	}
+}
+
+#endif
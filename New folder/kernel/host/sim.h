@@ -0,0 +1,319 @@
+///////////////////////////////////////////////////////////////////////////////
+/// sim.h
+///
+/// Host peripheral simulator
+///
+/// Runs the drivers on a PC, against register-level models of the parts of
+/// the ATmega328p they use, for testing and for measuring bus and bit-bang
+/// timing without an Uno:
+///
+///	- IO ports B, C and D: PORTx, DDRx and PINx, with internal and external
+///	  pull-ups. Writing 1 to a PINx bit toggles PORTx, as on the part.
+///	- Pin change interrupts PCINT0-2 and external interrupts INT0/INT1 on
+///	  PD2/PD3, with their flag and mask registers and all four INTx senses.
+///	- The TWI master: TWBR, TWSR, TWDR and TWCR, status codes as in the data
+///	  sheet, and bit timing from TWBR and the prescaler. An operation takes
+///	  its bus time before TWINT sets, so polling loops and the interrupt
+///	  see the real sequence.
+///
+/// Devices attach to the bus or to the pins (see simdevices.h). Interrupts
+/// run the ISR the code under test defines with ISR(), when the I flag is set
+/// and no ISR is running, in vector order.
+///
+/// Time is in CPU cycles and drives the kernel instance's clock, so millis()
+/// and micros() see it. It moves on:
+///
+///	- by AccessCycles on each register access, and by the AVR cost of each
+///	  millis() or micros() call, so polling loops progress. A read of the
+///	  register just read, as in a loop polling it, costs SpinCycles instead:
+///	  one turn of a typical polling loop, with its counter and branch;
+///	- by delay(), delayMicroseconds() and Kernel::OS.Advance().
+///
+/// C code between register accesses takes no time, so times measured are
+/// bus and peripheral time plus a floor for the driver's own time, not its
+/// full CPU time.
+///
+/// Each thread has its own simulator, like its own kernel instance:
+///
+///	static Host::SimMCP23017 Keypad(0x40);
+///
+///	Host::Sim.Attach(Keypad);
+///	IICInitialize();
+///	...
+///	printf("%lu bit times\n",Host::Sim.BusBits);
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SIM_H_
+#define _SIM_H_
+
+#include <Arduino.h>
+
+namespace Host {
+
+	#define SIM_CYCLES_PER_US	(F_CPU/1000000UL)
+	#define SIM_NEVER			(~0ULL)
+
+	//
+	// Ports
+
+	enum SIMPORT {
+		SIM_PORTB,
+		SIM_PORTC,
+		SIM_PORTD,
+		SIM_NPORTS
+	};
+
+	//
+	// An I2C slave. The simulated TWI calls these as the master drives the bus.
+
+	class I2CDevice {
+
+		friend class SimClass;
+
+		private:
+
+			I2CDevice *		pNext;				// bus link
+
+		public:
+
+			unsigned char	addr;				// address, top 7 bits
+
+			I2CDevice(unsigned char address) : pNext(NULL), addr(address&0xfe) {};
+
+			// Addressed, for reading or writing. Return true to acknowledge.
+
+			virtual bool Address(bool) { return true; };
+
+			// A byte written to the device. Return true to acknowledge.
+
+			virtual bool Write(unsigned char) { return true; };
+
+			// A byte to be read from the device; ack is whether the master
+			// will acknowledge it, asking for more.
+
+			virtual unsigned char Read(bool) { return 0xff; };
+
+			// A stop, or a start (repeated or not) addressing any device
+
+			virtual void Stop(void) {};
+	};
+
+	//
+	// A device on the IO pins. Told about every change of pin level.
+
+	class PinDevice {
+
+		friend class SimClass;
+
+		private:
+
+			PinDevice *		pNext;
+
+		public:
+
+			PinDevice(void) : pNext(NULL) {};
+
+			// Pin levels on a port have changed
+
+			virtual void PinsChanged(SIMPORT, unsigned char, unsigned char) {};
+	};
+
+	class SimClass {
+
+		private:
+
+			unsigned char	ddr[SIM_NPORTS];
+			unsigned char	port[SIM_NPORTS];
+			unsigned char	drive[SIM_NPORTS];		// pins driven by devices
+			unsigned char	level[SIM_NPORTS];		// and the levels they drive
+			unsigned char	pins[SIM_NPORTS];		// levels as last seen
+			unsigned char	pullup[SIM_NPORTS];		// external pull-ups
+
+			unsigned char	pcicr, pcifr, pcmsk[SIM_NPORTS];
+			unsigned char	eicra, eimsk, eifr;
+
+			unsigned char	twbr, twsr, twar, twdr, twcr;
+			unsigned char	twstate;				// see TWI_xx in sim.cpp
+			bool			twheld;					// we hold the bus: the next start is a repeat
+			I2CDevice *		twdev;					// device addressed
+			unsigned char	twstatus;				// status when the operation completes
+			unsigned char	twrx;					// byte being received
+			unsigned long long twdone;				// when it completes
+			unsigned long long twstopdone;			// when a stop completes
+			unsigned char	twfault;				// status to force on the next operation
+			unsigned int	stuck;					// SCL clocks until a stuck slave lets go
+			unsigned char	sclheld;				// SCL being pulled low by the CPU
+
+			I2CDevice *		bus;
+			PinDevice *		devices;
+			unsigned char	inISR;
+			int				lastread;				// register of a read just done, or -1
+
+			void Sync(void);
+			void TWIOperate(unsigned char twcr);
+			void TWIComplete(void);
+			unsigned long TWIBitCycles(void);
+			void PinsUpdate(SIMPORT p);
+			void Interrupts(void);
+			unsigned char Level(SIMPORT p);
+
+			static void ClockHook(unsigned int cycles);
+
+		public:
+
+			// Time
+
+			unsigned long long	Cycles;				// since the simulator started
+			unsigned int		AccessCycles;		// charged per register access
+			unsigned int		SpinCycles;			// per read repeating the last one
+
+			// Bus counters
+
+			unsigned long		BusBits;			// SCL periods, starts and stops
+			unsigned long long	BusCycles;			// CPU cycles the bus was busy
+			unsigned long		Starts;				// including repeated starts
+			unsigned long		Stops;
+			unsigned long		Nacks;
+			unsigned long		Collisions;			// TWDR written with TWINT clear
+
+			// Interrupts run, and interrupt storms cut short
+
+			unsigned long		Interrupted;
+			unsigned long		Storms;
+
+			SimClass(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Attach
+			///
+			/// Put a device on the bus, or on the pins
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: the device. It must outlive the simulator, or the thread.
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Attach(I2CDevice& dev);
+			void Attach(PinDevice& dev);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Drive, Release
+			///
+			/// Drive a pin from outside, or stop driving it. An output pin keeps
+			/// the level the CPU gives it.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: SIMPORT p - the port
+			/// @param: unsigned char bit - the pin, 0-7
+			/// @param: unsigned char high - nonzero for high
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Drive(SIMPORT p, unsigned char bit, unsigned char high);
+			void Release(SIMPORT p, unsigned char bit);
+
+			////////////////////////////////////////////////////////////////////////
+			/// PullUp
+			///
+			/// Set the external pull-ups on a port. SDA and SCL have them from
+			/// the start.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: SIMPORT p - the port
+			/// @param: unsigned char mask - bit per pin pulled up
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void PullUp(SIMPORT p, unsigned char mask);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Pins
+			///
+			/// The levels on a port's pins
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: SIMPORT p - the port
+			/// @return: unsigned char - bit per pin, 1 high
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char Pins(SIMPORT p) { return Level(p); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Spend
+			///
+			/// Move time on, running anything that falls due
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: unsigned long cycles - CPU cycles
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Spend(unsigned long cycles);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Now
+			///
+			/// The time in CPU cycles
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned long long - cycles
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned long long Now(void) { Sync(); return Cycles; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// StickBus, ForceStatus
+			///
+			/// Faults. StickBus has a slave hold SDA low until SCL has been
+			/// clocked the given number of times, with the TWI off, so no TWI
+			/// operation finishes. ForceStatus makes the next TWI operation end
+			/// with the given status, 0x38 for lost arbitration or 0x00 for a
+			/// bus error, and lose the bus.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: the fault
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void StickBus(unsigned int clocks) { stuck=clocks; };
+			void ForceStatus(unsigned char status) { twfault=status; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Read, Write
+			///
+			/// Register access, for the register proxies in avr/io.h
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: HOSTREG reg - the register
+			/// @param: unsigned char value - to write
+			/// @return: unsigned char - value read
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char Read(HOSTREG reg);
+			void Write(HOSTREG reg, unsigned char value);
+	};
+
+	// The calling thread's simulator
+
+	extern thread_local SimClass Sim;
+}
+
+#endif
@@ -0,0 +1,464 @@
+///////////////////////////////////////////////////////////////////////////////
+/// simdevices.cpp
+///
+/// Models of the board's peripherals, for the host peripheral simulator
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "kernel.h"
+
+#ifdef KERNEL_HOST
+
+#include "simdevices.h"
+
+// MCP23017 registers, IOCON.BANK=0
+
+#define XP_IODIR		0x00
+#define XP_IPOL			0x02
+#define XP_GPINTEN		0x04
+#define XP_DEFVAL		0x06
+#define XP_INTCON		0x08
+#define XP_IOCON		0x0a
+#define XP_INTF			0x0e
+#define XP_INTCAP		0x10
+#define XP_GPIO			0x12
+#define XP_OLAT			0x14
+#define XP_NREGS		0x16
+
+#define XP_MIRROR		(1<<6)
+#define XP_SEQOP		(1<<5)
+#define XP_ODR			(1<<2)
+#define XP_INTPOL		(1<<1)
+
+// HD44780 on a PCF8574 backpack
+
+#define LCD_RS			(1<<0)
+#define LCD_E			(1<<2)
+
+#define LCD_CYCLES(us)	((unsigned long long)(us)*SIM_CYCLES_PER_US)
+
+namespace Host {
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimMCP23017
+	///
+	/// CONSTRUCTOR
+	///
+	/// Power-on state: all pins inputs, everything else zero
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	SimMCP23017::SimMCP23017(unsigned char address) : I2CDevice(address)
+	{
+		memset(regs,0,sizeof(regs));
+		memset(sw,0,sizeof(sw));
+		regs[XP_IODIR]=regs[XP_IODIR+1]=0xff;
+		ptr=0;
+		setptr=false;
+		last=0xffff;
+		intbit[0]=intbit[1]=-1;
+		intport[0]=intport[1]=SIM_PORTD;
+		RegReads=RegWrites=0;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Levels
+	///
+	/// Pin levels: outputs from OLAT, inputs high unless switched to an
+	/// output driven low
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: unsigned short - bit per pin, GPA0 first
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned short SimMCP23017::Levels(void)
+	{
+		unsigned short in=regs[XP_IODIR]|(regs[XP_IODIR+1]<<8);
+		unsigned short lat=regs[XP_OLAT]|(regs[XP_OLAT+1]<<8);
+		unsigned short lows=~in&~lat;				// outputs driven low
+		unsigned short v=~in&lat;
+
+		for(int pin=0;pin<16;pin++) {
+			if((in&(1<<pin)) && !(sw[pin]&lows)) {
+				v|=(1<<pin);
+			}
+		}
+		return v;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Changed
+	///
+	/// After anything that may change the pins: raise interrupts on change
+	/// for each port with none pending, and update the INT outputs
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimMCP23017::Changed(void)
+	{
+		unsigned short now=Levels();
+
+		for(int p=0;p<2;p++) {
+			unsigned char pins=now>>(8*p);
+			unsigned char was=last>>(8*p);
+			unsigned char intcon=regs[XP_INTCON+p];
+			unsigned char cause=((pins^was)&~intcon)|((pins^regs[XP_DEFVAL+p])&intcon);
+
+			cause&=regs[XP_GPINTEN+p]&regs[XP_IODIR+p];
+			if(cause && !regs[XP_INTF+p]) {
+				regs[XP_INTF+p]=cause;
+				regs[XP_INTCAP+p]=pins^(regs[XP_IPOL+p]&regs[XP_IODIR+p]);
+			}
+		}
+		last=now;
+		Outputs();
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Clear
+	///
+	/// A port's GPIO or INTCAP has been read: clear its interrupt. With
+	/// DEFVAL compare, a pin still differing raises it again at once.
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: unsigned char port - 0 A, 1 B
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimMCP23017::Clear(unsigned char port)
+	{
+		regs[XP_INTF+port]=0;
+		Changed();
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Outputs
+	///
+	/// Drive INTA and INTB: active with a flag set on their port, or on
+	/// either port with IOCON.MIRROR. Open drain outputs are released when
+	/// inactive.
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimMCP23017::Outputs(void)
+	{
+		unsigned char iocon=regs[XP_IOCON];
+
+		for(int p=0;p<2;p++) {
+			if(intbit[p]<0) {
+				continue;
+			}
+			bool active=(iocon&XP_MIRROR)?(regs[XP_INTF]||regs[XP_INTF+1]):(regs[XP_INTF+p]!=0);
+			if(iocon&XP_ODR) {
+				if(active) {
+					Sim.Drive(intport[p],intbit[p],0);
+				} else {
+					Sim.Release(intport[p],intbit[p]);
+				}
+			} else {
+				Sim.Drive(intport[p],intbit[p],active==((iocon&XP_INTPOL)!=0));
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Next
+	///
+	/// Move the register pointer on after a byte: to the next register, or
+	/// in byte mode (IOCON.SEQOP) to the other register of the A/B pair
+	///
+	/// @context: ANY
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimMCP23017::Next(void)
+	{
+		ptr=(regs[XP_IOCON]&XP_SEQOP)?(ptr^1):(ptr+1)%XP_NREGS;
+	}
+
+	void SimMCP23017::ConnectInterrupt(unsigned char port, SIMPORT p, unsigned char bit)
+	{
+		intport[port&1]=p;
+		intbit[port&1]=bit;
+		Outputs();
+	}
+
+	void SimMCP23017::Press(unsigned char a, unsigned char b, bool closed)
+	{
+		if(closed) {
+			sw[a]|=(1<<b);
+			sw[b]|=(1<<a);
+		} else {
+			sw[a]&=~(1<<b);
+			sw[b]&=~(1<<a);
+		}
+		Changed();
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Address, Write, Read, Stop
+	///
+	/// The bus side. The first byte of a write sets the register pointer.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	bool SimMCP23017::Address(bool read)
+	{
+		setptr=!read;
+		return true;
+	}
+
+	bool SimMCP23017::Write(unsigned char data)
+	{
+		if(setptr) {
+			ptr=data%XP_NREGS;
+			setptr=false;
+			return true;
+		}
+
+		unsigned char reg=ptr;
+		RegWrites++;
+		if(reg==XP_IOCON+1) {
+			reg=XP_IOCON;							// one register, two addresses
+		} else if(reg==XP_GPIO || reg==XP_GPIO+1) {
+			reg+=XP_OLAT-XP_GPIO;
+		}
+		if(reg<XP_INTF || reg>=XP_GPIO) {
+			regs[reg]=data;
+		}
+		regs[XP_IOCON+1]=regs[XP_IOCON];
+		Next();
+		Changed();
+		return true;
+	}
+
+	unsigned char SimMCP23017::Read(bool)
+	{
+		unsigned char reg=ptr;
+		unsigned char value;
+
+		RegReads++;
+		if(reg==XP_GPIO || reg==XP_GPIO+1) {
+			unsigned char p=reg-XP_GPIO;
+			value=(Levels()>>(8*p))^(regs[XP_IPOL+p]&regs[XP_IODIR+p]);
+			Clear(p);
+		} else {
+			value=regs[reg];
+			if(reg==XP_INTCAP || reg==XP_INTCAP+1) {
+				Clear(reg-XP_INTCAP);
+			}
+		}
+		Next();
+		return value;
+	}
+
+	void SimMCP23017::Stop(void)
+	{
+		setptr=false;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimPCF8574::Write
+	///
+	/// Latch a byte
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	bool SimPCF8574::Write(unsigned char data)
+	{
+		unsigned char was=Latch;
+
+		Latch=data;
+		Writes++;
+		Latched(was,data);
+		return true;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimLCD
+	///
+	/// CONSTRUCTOR
+	///
+	/// Power-on state: 8 bit mode, display blank
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	SimLCD::SimLCD(unsigned char address) : SimPCF8574(address)
+	{
+		memset(ddram,' ',sizeof(ddram));
+		ac=0;
+		cgram=false;
+		nibbles=false;
+		half=false;
+		high=0;
+		entry=0x02;
+		busy=0;
+		Control=0;
+		Commands=Characters=Overruns=0;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Latched
+	///
+	/// The backpack's latch has changed: on E falling, take D4-D7
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimLCD::Latched(unsigned char was, unsigned char now)
+	{
+		if(!(was&LCD_E) || (now&LCD_E)) {
+			return;
+		}
+
+		unsigned char nibble=now>>4;
+		bool rs=(now&LCD_RS)!=0;
+
+		if(!nibbles) {
+			Execute(rs,nibble<<4);					// 8 bit mode: low bits not wired
+		} else if(!half) {
+			high=nibble;
+			half=true;
+		} else {
+			half=false;
+			Execute(rs,(high<<4)|nibble);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Execute
+	///
+	/// Carry out a command, or store a character
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimLCD::Execute(bool rs, unsigned char value)
+	{
+		unsigned long long now=Sim.Cycles;
+		unsigned long us=37;
+
+		if(now<busy) {
+			Overruns++;
+		}
+
+		if(rs) {
+			Characters++;
+			if(!cgram) {
+				ddram[ac&0x7f]=value;
+			}
+			ac=(entry&0x02)?ac+1:ac-1;
+		} else {
+			Commands++;
+			if(value&0x80) {
+				ac=value&0x7f;
+				cgram=false;
+			} else if(value&0x40) {
+				ac=value&0x3f;
+				cgram=true;
+			} else if(value&0x20) {
+				nibbles=!(value&0x10);				// function set: DL
+				half=false;
+			} else if(value&0x08) {
+				Control=value;
+			} else if(value&0x04) {
+				entry=value;
+			} else if(value&0x02) {
+				ac=0;
+				us=1520;
+			} else if(value&0x01) {
+				memset(ddram,' ',sizeof(ddram));
+				ac=0;
+				entry|=0x02;
+				us=1520;
+			}
+		}
+		busy=now+LCD_CYCLES(us);
+	}
+
+	const char * SimLCD::Text(unsigned char row)
+	{
+		memcpy(text,&ddram[row?0x40:0],16);
+		text[16]=0;
+		return text;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimHC595
+	///
+	/// CONSTRUCTOR
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	SimHC595::SimHC595(SIMPORT ser, unsigned char sbit, SIMPORT srclk, unsigned char cbit, SIMPORT rclk, unsigned char lbit)
+	{
+		serport=ser;
+		serbit=sbit;
+		clkport=srclk;
+		clkbit=cbit;
+		latport=rclk;
+		latbit=lbit;
+		lastclk=SIM_NEVER;
+		Shift=Outputs=0;
+		Clocks=Latches=0;
+		MinClock=~0UL;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// PinsChanged
+	///
+	/// Shift on SRCLK rising, latch on RCLK rising
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimHC595::PinsChanged(SIMPORT port, unsigned char was, unsigned char now)
+	{
+		unsigned char rose=~was&now;
+
+		if(port==clkport && (rose&(1<<clkbit))) {
+			unsigned long long t=Sim.Cycles;
+			if(lastclk!=SIM_NEVER && t-lastclk<MinClock) {
+				MinClock=t-lastclk;
+			}
+			lastclk=t;
+			Shift=(Shift<<1)|((Sim.Pins(serport)>>serbit)&1);
+			Clocks++;
+		}
+		if(port==latport && (rose&(1<<latbit))) {
+			Outputs=Shift;
+			Latches++;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimEncoder::Step
+	///
+	/// Phases 0-3 are A,B = 00, 10, 11, 01
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void SimEncoder::Step(int dir)
+	{
+		phase=(phase+((dir>0)?1:3))&3;
+		Sim.Drive(port,abit,phase==1 || phase==2);
+		Sim.Drive(port,bbit,phase>=2);
+	}
+}
+
+#endif
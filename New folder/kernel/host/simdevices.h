@@ -0,0 +1,274 @@
+///////////////////////////////////////////////////////////////////////////////
+/// simdevices.h
+///
+/// Models of the board's peripherals, for the host peripheral simulator
+///
+///	- SimMCP23017: the keypad's port expander, with a switch matrix across
+///	  its pins and interrupt on change driving INTA/INTB onto an AVR pin
+///	- SimPCF8574, SimLCD: the LCD backpack's latch, and the HD44780 behind it
+///	- SimHC595: the seven segment display's shift register, bit-banged
+///	- SimEncoder: a quadrature encoder on two AVR pins
+///
+/// Devices are declared by the harness and attached to the thread's
+/// simulator:
+///
+///	static Host::SimMCP23017 Keypad(0x40);
+///	static Host::SimHC595 Sseg(Host::SIM_PORTD,4,Host::SIM_PORTB,0,Host::SIM_PORTD,7);
+///
+///	Host::Sim.Attach(Keypad);
+///	Host::Sim.Attach(Sseg);
+///	Keypad.Press(MCP_GPA0,MCP_GPA3,true);		// column 0 to row 0
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SIMDEVICES_H_
+#define _SIMDEVICES_H_
+
+#include "sim.h"
+
+namespace Host {
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimMCP23017
+	///
+	/// 16 bit port expander, in its IOCON.BANK=0 layout. The register
+	/// pointer is set by the first byte of a write and moves on with each
+	/// byte, or with IOCON.SEQOP set toggles within its A/B pair. Writes to
+	/// GPIO go to OLAT; reads of GPIO give the pin levels, inverted by IPOL
+	/// on inputs.
+	///
+	/// Inputs read high unless a closed switch joins them to an output
+	/// driven low, as with the keypad's pull-ups. Interrupt on change sets
+	/// INTF and captures the port in INTCAP; reading GPIO or INTCAP clears
+	/// it. BANK=1 is not modelled.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	class SimMCP23017 : public I2CDevice {
+
+		private:
+
+			unsigned char	regs[0x16];
+			unsigned char	ptr;					// register pointer
+			bool			setptr;					// next byte written sets it
+			unsigned short	sw[16];					// pins each pin is switched to
+			unsigned short	last;					// pin levels, as last seen
+			SIMPORT			intport[2];				// where INTA, INTB go
+			signed char		intbit[2];				// -1 not connected
+
+			unsigned short Levels(void);
+			void Changed(void);
+			void Clear(unsigned char port);
+			void Outputs(void);
+			void Next(void);
+
+		public:
+
+			unsigned long	RegReads;				// register bytes read
+			unsigned long	RegWrites;				// register bytes written
+
+			SimMCP23017(unsigned char address);
+
+			// bus
+			bool Address(bool read);
+			bool Write(unsigned char data);
+			unsigned char Read(bool ack);
+			void Stop(void);
+
+			////////////////////////////////////////////////////////////////
+			/// Press
+			///
+			/// Close or open a switch between two pins
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char a, b - the pins, 0-7 GPA, 8-15 GPB
+			/// @param: bool closed - true to close it
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////
+
+			void Press(unsigned char a, unsigned char b, bool closed);
+
+			////////////////////////////////////////////////////////////////
+			/// ConnectInterrupt
+			///
+			/// Wire INTA (port 0) or INTB (port 1) to an AVR pin
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char port - 0 for INTA, 1 for INTB
+			/// @param: SIMPORT p - the AVR port
+			/// @param: unsigned char bit - the AVR pin
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////
+
+			void ConnectInterrupt(unsigned char port, SIMPORT p, unsigned char bit);
+
+			////////////////////////////////////////////////////////////////
+			/// Register
+			///
+			/// A register as the expander holds it, without a bus access
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: unsigned char reg - register address
+			/// @return: unsigned char - its value
+			///
+			////////////////////////////////////////////////////////////////
+
+			unsigned char Register(unsigned char reg) { return regs[reg]; };
+	};
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimPCF8574
+	///
+	/// 8 bit quasi-bidirectional latch. A pin reads low if the latch or the
+	/// outside pulls it low.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	class SimPCF8574 : public I2CDevice {
+
+		protected:
+
+			// The latch has changed
+			virtual void Latched(unsigned char, unsigned char) {};
+
+		public:
+
+			unsigned char	Latch;					// power-on 0xff
+			unsigned char	Inputs;					// levels from outside
+			unsigned long	Writes;					// bytes latched
+
+			SimPCF8574(unsigned char address) : I2CDevice(address), Latch(0xff), Inputs(0xff), Writes(0) {};
+
+			bool Write(unsigned char data);
+			unsigned char Read(bool) { return Latch&Inputs; };
+	};
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimLCD
+	///
+	/// HD44780 16x2 display on a PCF8574 backpack: P0 RS, P1 RW, P2 E, P3
+	/// backlight, P4-P7 D4-D7. A nibble is taken as E falls; the controller
+	/// is in 8 bit mode until a function set selects 4 bit. A command or
+	/// character that arrives while the last is still being carried out
+	/// (37us, or 1.52ms for clear and home) counts as an overrun.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	class SimLCD : public SimPCF8574 {
+
+		private:
+
+			char			ddram[0x80];
+			unsigned char	ac;						// address counter
+			bool			cgram;					// writes go to CGRAM
+			bool			nibbles;				// 4 bit mode
+			bool			half;					// high nibble held
+			unsigned char	high;
+			unsigned char	entry;					// entry mode
+			unsigned long long busy;				// busy until, in cycles
+			char			text[17];
+
+			void Execute(bool rs, unsigned char value);
+
+		protected:
+
+			void Latched(unsigned char was, unsigned char now);
+
+		public:
+
+			unsigned char	Control;				// last display control command
+			unsigned long	Commands;
+			unsigned long	Characters;
+			unsigned long	Overruns;
+
+			SimLCD(unsigned char address);
+
+			////////////////////////////////////////////////////////////////
+			/// Text
+			///
+			/// A line of the display, as it shows
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char row - 0 or 1
+			/// @return: const char * - 16 characters, until the next call
+			///
+			////////////////////////////////////////////////////////////////
+
+			const char * Text(unsigned char row);
+
+			bool Backlight(void) { return Latch&(1<<3); };
+	};
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimHC595
+	///
+	/// 8 bit shift register with output latch, on three AVR pins. SER is
+	/// shifted in as SRCLK rises; the outputs take the register as RCLK
+	/// rises. MinClock is the shortest SRCLK period seen, in CPU cycles.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	class SimHC595 : public PinDevice {
+
+		private:
+
+			SIMPORT			serport, clkport, latport;
+			unsigned char	serbit, clkbit, latbit;
+			unsigned long long lastclk;
+
+		public:
+
+			unsigned char	Shift;
+			unsigned char	Outputs;
+			unsigned long	Clocks;
+			unsigned long	Latches;
+			unsigned long	MinClock;
+
+			SimHC595(SIMPORT ser, unsigned char sbit, SIMPORT srclk, unsigned char cbit, SIMPORT rclk, unsigned char lbit);
+
+			void PinsChanged(SIMPORT port, unsigned char was, unsigned char now);
+	};
+
+	////////////////////////////////////////////////////////////////////////
+	/// SimEncoder
+	///
+	/// Quadrature encoder driving two AVR pins. A step forward has A
+	/// leading B.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	class SimEncoder {
+
+		private:
+
+			SIMPORT			port;
+			unsigned char	abit, bbit;
+			unsigned char	phase;					// 0-3, Gray coded onto A, B
+
+		public:
+
+			SimEncoder(SIMPORT p, unsigned char a, unsigned char b) : port(p), abit(a), bbit(b), phase(0) {};
+
+			////////////////////////////////////////////////////////////////
+			/// Step
+			///
+			/// Move one quadrature step. Both pins are driven from the first.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: int dir - positive forward, else back
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////
+
+			void Step(int dir);
+	};
+}
+
+#endif
@@ -8,6 +8,9 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "interrupts.h"
+#ifdef KERNEL_HOST
+#include <avr/interrupt.h>
+#endif
 
 ///////////////////////////////////////////////////////////////////////////////
 /// INTDisableMasterInterrupts
@@ -23,7 +26,11 @@
 
 void INTDisableMasterInterrupts(void)
 {
+#ifdef KERNEL_HOST
+	cli();
+#else
 	asm("cli");
+#endif
 }
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -40,5 +47,9 @@ void INTDisableMasterInterrupts(void)
 
 void INTEnableMasterInterrupts(void)
 {
+#ifdef KERNEL_HOST
+	sei();
+#else
 	asm("sei");
+#endif
 }
@@ -2,17 +2,94 @@
 #include "mq.h"
 
 namespace Kernel {
+#ifdef KERNEL_HOST
+	thread_local Kernel::KernelClass OS;
+#else
 	Kernel::KernelClass OS;
+#endif
+#ifdef KERNEL_PASS_COUNTER
+	unsigned long Passes=0;
+#endif
+	KERNEL_INSTANCE unsigned long PassTime=0;
 }
 
 void setup()
 {
+	Kernel::PassTime=millis();		// timers set in UserInit start from here
+#ifdef KERNEL_TIMEBASE
+	Kernel::OS.Timebase.Start();
+#endif
 	UserInit();
+#ifdef KERNEL_MODE_PREEMPTIVE
+	Kernel::OS.Preempt.Start();
+#endif
 }
 
 
 void loop(void)
 {
+	Kernel::PassTime=millis();		// the one millis() read of the pass
+	Kernel::OS.Timers.Run();
+#ifdef KERNEL_MODE_CYCLIC
+	Kernel::OS.Cyclic.Run();
+#else
 	Kernel::OS.MessageQueue.Loop(2);
 	Kernel::OS.TaskManager.Loop();
+#endif
+	Kernel::OS.Watchdog.Supervise();
+#ifdef KERNEL_PASS_COUNTER
+	Kernel::Passes++;
+#endif
 }
+
+#ifdef KERNEL_OWNS_MAIN
+
+// The core defines this hook, weak and empty, in its main.cpp, which is no
+// longer linked. A board variant may override it.
+
+void initVariant(void) __attribute__((weak));
+void initVariant(void) {}
+
+///////////////////////////////////////////////////////////////////////////////
+/// main
+///
+/// Replaces the Arduino core's main(), and starts up as it does. The core's
+/// version calls loop() and then serialEventRun() on every pass; here the
+/// kernel loop runs back to back and serial events are polled only every
+/// KERNEL_SERIALEVENT_PASSES passes. host/rigs/passes.cpp measures the
+/// difference. Serial transmit and receive are interrupt driven and do not
+/// depend on serialEventRun, so only serialEvent() callbacks see the delay.
+///
+/// The core's main() lives in its own object in the core library, so the
+/// linker does not pull it in once main() is defined here.
+///
+/// @context: TASK
+/// @scope: EXPORTED
+/// @param: none
+/// @return: does not return
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int main(void)
+{
+	init();						// Arduino core: millis() timer, ADC, PWM
+	initVariant();
+#if defined(USBCON)
+	USBDevice.attach();
+#endif
+	setup();
+
+	unsigned char passes=KERNEL_SERIALEVENT_PASSES;
+	for(;;) {
+		loop();
+		if(--passes==0) {
+			passes=KERNEL_SERIALEVENT_PASSES;
+			if(serialEventRun) {
+				serialEventRun();
+			}
+		}
+	}
+	return 0;
+}
+
+#endif
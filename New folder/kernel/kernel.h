@@ -14,8 +14,18 @@ extern void UserInit(void);
 
 #include "KernelClass.h"
 #include "ostimer.h"
+#include "kerneltime.h"
+#include "compacttimer.h"
+#include "seqlock.h"
 
 namespace Kernel {
+#ifdef KERNEL_HOST
+	extern thread_local KernelClass OS;
+#else
 	extern KernelClass OS;
+#endif
+#ifdef KERNEL_PASS_COUNTER
+	extern unsigned long Passes;		// scheduling passes since startup
+#endif
 }
 #endif
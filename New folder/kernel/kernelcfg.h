@@ -0,0 +1,67 @@
+///////////////////////////////////////////////////////////////////////////////
+// KERNELCFG.H
+//
+// Kernel build configuration. Arduino libraries can not see definitions made
+// in the sketch, so kernel options are selected by editing this file.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _KERNELCFG_H_
+#define _KERNELCFG_H_
+
+// Scheduling mode. The default is the cooperative task ring, called from the
+// Arduino loop(). Define KERNEL_MODE_CYCLIC to run a time-triggered static
+// schedule instead (see cyclic.h). This claims Timer2, so tone() and PWM on
+// pins 3 and 11 are not available.
+
+//#define KERNEL_MODE_CYCLIC
+
+// Define KERNEL_MODE_PREEMPTIVE to add preemptive priority tasks, each with
+// its own stack, alongside the task ring (see preempt.h). The task ring and
+// message queue run as the lowest priority task. This also claims Timer2, so
+// it can not be combined with KERNEL_MODE_CYCLIC.
+
+//#define KERNEL_MODE_PREEMPTIVE
+
+// With KERNEL_MODE_PREEMPTIVE, define KERNEL_PREEMPT_PROFILE to time every
+// context switch on Timer1, for PreemptClass::GetStats. Timer1 runs at the
+// CPU clock unless KERNEL_TIMEBASE has it, when the timing is to 8 cycles.
+// Either way the Servo library and PWM on pins 9 and 10 are not available.
+
+//#define KERNEL_PREEMPT_PROFILE
+
+// Define KERNEL_OWNS_MAIN for the kernel to provide main() in place of the
+// Arduino core's. The scheduler then runs in a tight loop instead of
+// returning to the core after every pass. millis(), delay() and Serial work
+// as before; serialEvent() handlers, if any, are called once every
+// KERNEL_SERIALEVENT_PASSES (1-255) passes rather than after every one.
+
+//#define KERNEL_OWNS_MAIN
+#define KERNEL_SERIALEVENT_PASSES	64
+
+// Define KERNEL_PASS_COUNTER to count scheduling passes in Kernel::Passes,
+// for measuring how many passes per second the kernel achieves.
+
+//#define KERNEL_PASS_COUNTER
+
+// Define KERNEL_TIMEBASE for a 0.5us resolution timebase and the OSTimerUs
+// microsecond timer (see timebase.h). This claims Timer1, so the Servo library
+// and PWM on pins 9 and 10 are not available.
+
+//#define KERNEL_TIMEBASE
+
+// KERNEL_HOST is not set here: it is defined on the compiler command line
+// when building the kernel for a PC, with kernel/host first on the include
+// path (see host/Arduino.h). Each thread then gets its own kernel instance.
+// KERNEL_MODE_PREEMPTIVE may be defined for it too (see preempt.h).
+
+#ifdef KERNEL_HOST
+#if defined(KERNEL_MODE_CYCLIC) || defined(KERNEL_OWNS_MAIN)
+#error "KERNEL_HOST builds use the task ring, or preemptive tasks, and the harness's own main()"
+#endif
+#ifdef KERNEL_PREEMPT_PROFILE
+#error "KERNEL_PREEMPT_PROFILE times the AVR's context switch code, which KERNEL_HOST builds replace"
+#endif
+#endif
+
+#endif
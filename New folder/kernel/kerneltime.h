@@ -0,0 +1,58 @@
+///////////////////////////////////////////////////////////////////////////////
+/// kerneltime.h
+///
+/// Kernel pass time
+///
+/// millis() turns interrupts off to copy its 32-bit count, and costs a call.
+/// The task timers used to call it on every Set and every poll, so a pass
+/// over several tasks with a few timers each made many such calls. Instead
+/// the kernel samples millis() once at the start of each pass, and the task
+/// timers (OSTimer, the tasktimers.h macros, coroutine timer waits and the
+/// timer service) all read that sample through Kernel::Now(). That read is
+/// a plain load: no call and no critical section.
+///
+/// Every task in a pass therefore sees the same time, and time does not move
+/// on within a task. A task must not busy-wait on a timer, which it should not
+/// do anyway. Code that needs the time right now, such as timestamps taken
+/// in an ISR, should still call millis().
+///
+/// In KERNEL_MODE_PREEMPTIVE, priority tasks run outside the pass, so there
+/// Now() is millis().
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _KERNELTIME_H_
+#define _KERNELTIME_H_
+
+#include "sysincs.h"
+
+namespace Kernel {
+
+	// millis() at the start of the current pass. Written only by the kernel,
+	// at task level, so task-level reads need no protection.
+
+	extern KERNEL_INSTANCE unsigned long PassTime;
+
+	////////////////////////////////////////////////////////////////////////
+	/// Now
+	///
+	/// The kernel time: millis() as sampled at the start of this pass
+	///
+	/// @context: TASK
+	/// @scope: EXPORTED
+	/// @param: none
+	/// @return: unsigned long - time in ms
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	inline unsigned long Now(void)
+	{
+#ifdef KERNEL_MODE_PREEMPTIVE
+		return millis();
+#else
+		return PassTime;
+#endif
+	}
+}
+
+#endif
@@ -10,8 +10,12 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "mq.h"
+#include "coroutine.h"
 #include "interrupts.h"
 #include <stdlib.h>
+#ifdef KERNEL_HOST
+#include "kernel.h"
+#endif
 
 namespace Kernel {
 
@@ -40,6 +44,7 @@ namespace Kernel {
 			PMESSAGEHANDLER		QueueBlock[MSG_MAX_MSG_IDS];
 			PMESSAGE			MsgQueueFirst;
 			PMESSAGE			MsgQueueLast;
+			Coroutine *			Waiters;		// coroutines suspended in CO_AWAIT_MESSAGE
 	};
 
 	//////////////////////////////////////////////////////////////////////////////
@@ -63,6 +68,7 @@ namespace Kernel {
 		}
 		pInternals->MsgQueueFirst=(PMESSAGE)NULL;
 		pInternals->MsgQueueLast=(PMESSAGE)NULL;
+		pInternals->Waiters=(Coroutine *)NULL;
 		internals=(void *)pInternals;
 	}
 
@@ -80,10 +86,51 @@ namespace Kernel {
 
 	static MQClass& MQClass::Get(void)
 	{
+#ifdef KERNEL_HOST
+		return OS.MessageQueue;		// each host kernel instance owns its own
+#else
 		static MQClass mq;
 		return mq;
+#endif
 	}
 
+#ifdef KERNEL_HOST
+
+	//////////////////////////////////////////////////////////////////////////////
+	/// ~MQClass
+	///
+	/// DESTRUCTOR
+	///
+	/// Host builds only. Free any messages still queued, and the subscriber
+	/// lists. On the target the queue lives for ever and this is not built.
+	///
+	//////////////////////////////////////////////////////////////////////////////
+
+	MQClass::~MQClass()
+	{
+		MQInternals * pInternals=(MQInternals *)internals;
+		PMESSAGE msg=pInternals->MsgQueueFirst;
+		while(msg) {
+			PMESSAGE pNext=msg->pNextMsg;
+			if(msg->CallerOwns!=MQ_OWNER_CALLER && msg->context!=NULL) {
+				delete msg->context;
+			}
+			delete msg;
+			msg=pNext;
+		}
+		for(int idx=0;idx<MSG_MAX_MSG_IDS;idx++) {
+			PMESSAGEHANDLER handler=pInternals->QueueBlock[idx];
+			while(handler) {
+				PMESSAGEHANDLER pNext=handler->pNextHandler;
+				delete handler;
+				handler=pNext;
+			}
+		}
+		delete pInternals;
+	}
+
+#endif
+
 	//////////////////////////////////////////////////////////////////////////////
 	/// Subscribe
 	///
@@ -114,7 +161,14 @@ namespace Kernel {
 				pHead=pHead->pNextHandler;
 			}
 			if(!pHead) {
+				// see Loop: the heap is shared with preemptive posters
+#ifdef KERNEL_MODE_PREEMPTIVE
+				INTDisableMasterInterrupts();
+#endif
 				pHead=new MESSAGEHANDLER(handler,pInternals->QueueBlock[msgid]);
+#ifdef KERNEL_MODE_PREEMPTIVE
+				INTEnableMasterInterrupts();
+#endif
 				if(pHead) {
 					pInternals->QueueBlock[msgid]=pHead;
 					rc=0;
@@ -156,7 +210,13 @@ namespace Kernel {
 					} else {
 						pPrev->pNextHandler=pHead->pNextHandler;
 					}
+#ifdef KERNEL_MODE_PREEMPTIVE
+					INTDisableMasterInterrupts();
+#endif
 					delete pHead;
+#ifdef KERNEL_MODE_PREEMPTIVE
+					INTEnableMasterInterrupts();
+#endif
 					rc=0;
 					break;
 				}
@@ -212,6 +272,58 @@ namespace Kernel {
 		return rc;
 	}
 
+	//////////////////////////////////////////////////////////////////////////////
+	/// AddWaiter
+	///
+	/// Attach a coroutine to the list of coroutines waiting for a message. The
+	/// coroutine has already recorded which message ID it is waiting for.
+	///
+	/// @context:	TASK
+	/// @scope:     PRIVATE
+	/// @param:     Coroutine * co - the waiting coroutine
+	/// @return:	zero if successfully attached, nonzero if error occurred
+	///
+	//////////////////////////////////////////////////////////////////////////////
+
+	int MQClass::AddWaiter(Coroutine * co)
+	{
+		MQInternals * pInternals = (MQInternals *)internals;
+		int rc=-1;
+		if(co) {
+			co->pNextWaiter=pInternals->Waiters;
+			pInternals->Waiters=co;
+			rc=0;
+		}
+		return rc;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	/// RemoveWaiter
+	///
+	/// Take a coroutine off the list of coroutines waiting for a message, if
+	/// it is on it
+	///
+	/// @context:	TASK
+	/// @scope:     PRIVATE
+	/// @param:     Coroutine * co - the coroutine
+	/// @return:	none
+	///
+	//////////////////////////////////////////////////////////////////////////////
+
+	void MQClass::RemoveWaiter(Coroutine * co)
+	{
+		MQInternals * pInternals = (MQInternals *)internals;
+		Coroutine ** ppWaiter=&pInternals->Waiters;
+		while(*ppWaiter) {
+			if(*ppWaiter==co) {
+				*ppWaiter=co->pNextWaiter;
+				co->pNextWaiter=NULL;
+				return;
+			}
+			ppWaiter=&((*ppWaiter)->pNextWaiter);
+		}
+	}
+
 	//////////////////////////////////////////////////////////////////////////////
 	/// MQLoop
 	///
@@ -250,14 +362,42 @@ namespace Kernel {
 					curHandler=curHandler->pNextHandler;
 				}
 
-				// free the message
+				// release any coroutines waiting for this message
+
+				Coroutine * pPrev=NULL;
+				Coroutine * co=pInternals->Waiters;
+				while(co) {
+					Coroutine * pNext=co->pNextWaiter;
+					if(co->msgid==msg->msgid) {
+						if(!pPrev) {
+							pInternals->Waiters=pNext;
+						} else {
+							pPrev->pNextWaiter=pNext;
+						}
+						co->pNextWaiter=NULL;
+						co->message=msg->context;
+						co->wait=CO_WAIT_NONE;
+					} else {
+						pPrev=co;
+					}
+					co=pNext;
+				}
+
+				// free the message. Preemptive tasks may post (and so allocate)
+				// at any time, so the heap must not be entered from both at once.
 
+#ifdef KERNEL_MODE_PREEMPTIVE
+				INTDisableMasterInterrupts();
+#endif
 				if(msg->CallerOwns!=MQ_OWNER_CALLER) {
 					if(msg->context != NULL) {
 						delete msg->context;
 					}
 				}
 				delete msg;
+#ifdef KERNEL_MODE_PREEMPTIVE
+				INTEnableMasterInterrupts();
+#endif
 			}
 			MaxMessages--;
 		}
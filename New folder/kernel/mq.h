@@ -41,6 +41,8 @@ namespace Kernel {
 	//
 	// Prototype of virtual base class for class-based task handlers
 
+	class Coroutine;
+
 	class MessageHandler {
 		public:
 			MessageHandler();
@@ -56,6 +58,11 @@ namespace Kernel {
 		private:
 
 			friend void ::loop();		// the kernel needs to access the Loop function
+#ifdef KERNEL_HOST
+			friend class KernelClass;	// host builds: each kernel instance owns one
+#endif
+			friend class Coroutine;		// coroutines register to wait for messages
+			friend void CyclicMessagePump(void * context);	// cyclic mode pumps messages from a slot
 
 			/// our internals.
 
@@ -91,6 +98,36 @@ namespace Kernel {
 
 			void Loop(int MaxMessages);
 
+			//////////////////////////////////////////////////////////////////////////////
+			/// AddWaiter
+			///
+			/// Attach a coroutine to the list of coroutines waiting for a message. The
+			/// coroutine has already recorded which message ID it is waiting for.
+			///
+			/// @context:	TASK
+			/// @scope:     PRIVATE
+			/// @param:     Coroutine * co - the waiting coroutine
+			/// @return:	zero if successfully attached, nonzero if error occurred
+			///
+			//////////////////////////////////////////////////////////////////////////////
+
+			int AddWaiter(Coroutine * co);
+
+			//////////////////////////////////////////////////////////////////////////////
+			/// RemoveWaiter
+			///
+			/// Take a coroutine off the list of coroutines waiting for a message, if
+			/// it is on it. Its task is being removed or suspended.
+			///
+			/// @context:	TASK
+			/// @scope:     PRIVATE
+			/// @param:     Coroutine * co - the coroutine
+			/// @return:	none
+			///
+			//////////////////////////////////////////////////////////////////////////////
+
+			void RemoveWaiter(Coroutine * co);
+
 		public:
 
 			//////////////////////////////////////////////////////////////////////////////
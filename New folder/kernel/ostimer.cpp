@@ -9,7 +9,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "ostimer.h"
-#include "Arduino.h"
+#include "kerneltime.h"
 
 namespace Kernel {
 
@@ -25,9 +25,9 @@ namespace Kernel {
 	///
 	////////////////////////////////////////////////////////////////////////
 
-	OSTimer::OSTimer(unsigned long timeout=0) : time(timeout), freeze(0), frozen(0)
+	OSTimer::OSTimer(unsigned long timeout=0) : time(timeout), freeze(0), missed(0), frozen(0), policy(OST_ONESHOT)
 	{
-		time=millis();
+		tmr=Now();
 	}
 
 	////////////////////////////////////////////////////////////////////////
@@ -58,8 +58,31 @@ namespace Kernel {
 
 	void OSTimer::Set(unsigned long timeout)
 	{
-		tmr=millis();
+		tmr=Now();
 		time=timeout;
+		policy=OST_ONESHOT;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// SetPeriodic
+	///
+	/// Start the timer as a periodic timer. A period of zero is taken as
+	/// 1ms: isExpired divides by the period.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned long period - ms
+	/// @param: OST_POLICY policy - OST_CATCHUP or OST_SKIP
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void OSTimer::SetPeriodic(unsigned long period, OST_POLICY pol)
+	{
+		tmr=Now();
+		time=period?period:1;
+		missed=0;
+		policy=pol;
 	}
 
 	////////////////////////////////////////////////////////////////////////
@@ -68,7 +91,7 @@ namespace Kernel {
 	/// Check if the timer has expired. It may have done some time ago -
 	/// this is not interrupt driven
 	///
-	/// @context: ANY
+	/// @context: TASK
 	/// @scope: PUBLIC
 	/// @param: none
 	/// @return: int. Nonzero if timer has expired
@@ -77,7 +100,32 @@ namespace Kernel {
 
 	int OSTimer::isExpired(void)
 	{
-		return ((millis()-tmr)> time);
+		unsigned long elapsed=Now()-tmr;
+
+		if(policy==OST_ONESHOT) {
+			return (elapsed>time);
+		}
+
+		// Periodic: tmr is the start of the current period, and advances by
+		// whole periods only, so the deadlines never drift
+
+		if(elapsed<time) {
+			return 0;
+		}
+		tmr+=time;
+		elapsed-=time;
+		if(elapsed>=time) {
+
+			// at least one more period has also gone by
+
+			unsigned long late=1;
+			if(policy==OST_SKIP) {
+				late=elapsed/time;		// only reached when late, so the divide is rare
+				tmr+=late*time;
+			}
+			missed=((unsigned long)missed+late>0xffff)?0xffff:missed+late;
+		}
+		return 1;
 	}
 
 	////////////////////////////////////////////////////////////////////////
@@ -85,7 +133,7 @@ namespace Kernel {
 	///
 	/// Stop a timer from counting
 	///
-	/// @context: ANY
+	/// @context: TASK
 	/// @scope: PUBLIC
 	/// @param: NONE
 	/// @return: NONE
@@ -94,7 +142,7 @@ namespace Kernel {
 
 	void OSTimer::Freeze(void)
 	{
-		freeze=millis();
+		freeze=Now();
 		frozen=1;
 	}
 
@@ -103,7 +151,7 @@ namespace Kernel {
 	///
 	/// Resume a frozen timer
 	///
-	/// @context: ANY
+	/// @context: TASK
 	/// @scope: PUBLIC
 	/// @param: NONE
 	/// @return: NONE
@@ -112,7 +160,8 @@ namespace Kernel {
 
 	void OSTimer::Thaw(void)
 	{
-		tmr+=(frozen)?(millis()-freeze):0;
+		tmr+=(frozen)?(Now()-freeze):0;
+		frozen=0;
 	}
 
 }
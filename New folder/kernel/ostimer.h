@@ -3,6 +3,7 @@
 ///
 /// Class for kernel-based non-blocking timers
 ///
+/// Timers read the kernel pass time (see kerneltime.h), not millis()
 ///
 /// Dr J A Gow 2022
 ///
@@ -11,8 +12,20 @@
 #ifndef OSTIMER_H_
 #define OSTIMER_H_
 
+#include "timebase.h"
+
 namespace Kernel {
 
+	//
+	// Periodic timer policies: what a periodic timer does when it is polled
+	// more than a period late
+
+	enum OST_POLICY {
+		OST_ONESHOT=0,			// not periodic: expires once until Set again
+		OST_CATCHUP,			// report every period, late ones back to back
+		OST_SKIP				// report once, drop the periods that were missed
+	};
+
 	//
 	// NBT class
 
@@ -21,7 +34,9 @@ namespace Kernel {
 		private:
 
 			unsigned long tmr,time,freeze;
+			unsigned int missed;
 			unsigned char frozen;
+			unsigned char policy;
 
 		public:
 
@@ -62,13 +77,61 @@ namespace Kernel {
 
 			void Set(unsigned long timeout);
 
+			////////////////////////////////////////////////////////////////////////
+			/// SetPeriodic
+			///
+			/// Start the timer as a periodic timer. Each time isExpired reports
+			/// expiry, the deadline moves on by exactly one period from the
+			/// previous deadline, not from when the task got round to polling,
+			/// so polling latency does not accumulate:
+			///
+			///	RPSTimer.SetPeriodic(1000);
+			///	...
+			///	if(RPSTimer.isExpired()) {
+			///		...									// no re-arm needed
+			///	}
+			///
+			/// If a whole period goes by unpolled, OST_CATCHUP reports expiry
+			/// on each of the following polls until the timer is back on
+			/// schedule, and OST_SKIP reports it once and drops the periods in
+			/// between. Either way the deadlines stay on the original grid, and
+			/// the periods that were late (CATCHUP) or dropped (SKIP) are
+			/// counted in Missed.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned long period - ms, 0 is taken as 1
+			/// @param: OST_POLICY policy - OST_CATCHUP or OST_SKIP
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void SetPeriodic(unsigned long period, OST_POLICY policy=OST_SKIP);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Missed
+			///
+			/// Number of periods a periodic timer has reported late or dropped
+			/// since SetPeriodic. Saturates at 65535.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned int
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned int Missed(void) { return missed; };
+
 			////////////////////////////////////////////////////////////////////////
 			/// isExpired
 			///
 			/// Check if the timer has expired. It may have done some time ago -
-			/// this is not interrupt driven
+			/// this is not interrupt driven. A periodic timer is re-armed by
+			/// the call that reports its expiry. Reads the kernel time, so
+			/// an ISR should compare millis() itself instead.
 			///
-			/// @context: ANY
+			/// @context: TASK
 			/// @scope: PUBLIC
 			/// @param: none
 			/// @return: int. Nonzero if timer has expired
@@ -82,7 +145,7 @@ namespace Kernel {
 			///
 			/// Stop a timer from counting
 			///
-			/// @context: ANY
+			/// @context: TASK
 			/// @scope: PUBLIC
 			/// @param: NONE
 			/// @return: NONE
@@ -96,7 +159,7 @@ namespace Kernel {
 			///
 			/// Resume a frozen timer
 			///
-			/// @context: ANY
+			/// @context: TASK
 			/// @scope: PUBLIC
 			/// @param: NONE
 			/// @return: NONE
@@ -106,6 +169,81 @@ namespace Kernel {
 			void Thaw(void);
 
 	};
+
+#ifdef KERNEL_TIMEBASE
+
+	//
+	// Microsecond NBT class, counting 0.5us timebase ticks. The tick
+	// arithmetic is unsigned, so it stays correct across the timebase wrap
+	// provided the timer is checked within 35 minutes of being set.
+
+	class OSTimerUs {
+
+		private:
+
+			unsigned long tmr,time;		// timebase ticks
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// OSTimerUs
+			///
+			/// CONSTRUCTOR
+			///
+			/// Initializes a nonblocking microsecond timer. It starts counting
+			/// when Set is called.
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			OSTimerUs(unsigned long timeout=0) : tmr(0), time(TB_US_TO_TICKS(timeout)) {};
+
+			////////////////////////////////////////////////////////////////////////
+			/// Set, SetFromISR
+			///
+			/// Start the timer with the given timeout
+			///
+			/// @context: TASK, INTERRUPT respectively
+			/// @scope: PUBLIC
+			/// @param: unsigned long timeout - microseconds, below 2^31
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Set(unsigned long timeout) { tmr=TimebaseClass::Get().Now(); time=TB_US_TO_TICKS(timeout); };
+			void SetFromISR(unsigned long timeout) { tmr=TimebaseClass::Get().NowFromISR(); time=TB_US_TO_TICKS(timeout); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// isExpired, isExpiredFromISR
+			///
+			/// Check if the timer has expired
+			///
+			/// @context: TASK, INTERRUPT respectively
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: int. Nonzero if timer has expired
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int isExpired(void) { return (TimebaseClass::Get().Now()-tmr)>time; };
+			int isExpiredFromISR(void) { return (TimebaseClass::Get().NowFromISR()-tmr)>time; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Elapsed
+			///
+			/// Time since the timer was set. Handy for measuring periods: Set,
+			/// then read Elapsed at the next event.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned long - microseconds
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned long Elapsed(void) { return TB_TICKS_TO_US(TimebaseClass::Get().Now()-tmr); };
+	};
+
+#endif
 }
 
 
@@ -0,0 +1,788 @@
+///////////////////////////////////////////////////////////////////////////////
+/// preempt.cpp
+///
+/// Optional preemptive priority scheduling
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "preempt.h"
+
+#ifdef KERNEL_MODE_PREEMPTIVE
+
+#include <string.h>
+#ifdef KERNEL_HOST
+#include <ucontext.h>
+#include "kernel.h"
+#endif
+
+//
+// Task states
+
+#define PRE_STATE_FREE			0
+#define PRE_STATE_READY			1
+#define PRE_STATE_SLEEPING		2
+#define PRE_STATE_WAITING		3			// for a signal
+#define PRE_STATE_BLOCKED		4			// on a mutex
+
+//
+// Task control block. The saved stack pointer must be the first field: the
+// context switch code finds it through PRECurrentTCB.
+
+class PRETCB {
+	public:
+		volatile unsigned int	sp;
+		PFNTASKHANDLER			fn;
+		void *					context;
+		unsigned char *			stack;
+		unsigned int			stacksize;
+		unsigned char			priority;		// current, possibly inherited
+		unsigned char			basepriority;
+		volatile unsigned char	state;
+		volatile unsigned char	signalled;
+		unsigned int			wake;			// tick at which a sleep ends
+		Kernel::PREMutex *		mutex;			// mutex the task is blocked on
+#ifdef KERNEL_HOST
+		ucontext_t				host;			// host builds: the saved context
+		void *					hoststack;		// and the stack it runs on
+#endif
+};
+
+// Scheduler internals. Kept in plain globals rather than behind an internals
+// pointer, as the context switch code addresses them directly.
+
+static KERNEL_INSTANCE PRETCB PRETasks[PRE_MAX_TASKS+1];	// [0] is the idle task
+static KERNEL_INSTANCE unsigned char PRECurrentID=PRE_IDLE;
+static KERNEL_INSTANCE volatile unsigned int PRETicks=0;	// wraps; used for sleeps
+static KERNEL_INSTANCE unsigned char PREYielding=0;		// PREYield wants a round-robin pick
+static KERNEL_INSTANCE Kernel::PRESTATS PREStats;
+#ifdef KERNEL_HOST
+static KERNEL_INSTANCE unsigned long PREHostTicked;		// clock, in ms, of the last tick taken
+static KERNEL_INSTANCE unsigned char PREHostStarted=0;
+#endif
+
+extern "C" {
+	KERNEL_INSTANCE PRETCB * volatile PRECurrentTCB=&PRETasks[PRE_IDLE];
+#ifndef KERNEL_HOST
+	void PRETickSwitch(void) __attribute__((naked,used));
+#endif
+#ifdef KERNEL_PREEMPT_PROFILE
+	// Timer1 stamps, written by the context switch code
+	volatile unsigned int PRESwitchStart __attribute__((used));		// as this switch began
+	volatile unsigned int PRESwitchPrev __attribute__((used));		// as the last one began
+	volatile unsigned int PRESwitchEnd __attribute__((used));		// as the last one ended
+#endif
+}
+
+#ifdef KERNEL_PREEMPT_PROFILE
+static unsigned char PREProfiled=0;				// a whole switch has been stamped
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// PREProfile
+///
+/// Work out how long the last switch took from its stamps. Called in each
+/// switch, once the start stamp has been taken, so the last switch is
+/// complete and its start has moved to PRESwitchPrev.
+///
+/// @context: INTERRUPTS OFF
+/// @scope: INTERNAL
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static inline void PREProfile(void)
+{
+#ifdef KERNEL_PREEMPT_PROFILE
+	if(PREProfiled) {
+		unsigned int cycles=(PRESwitchEnd-PRESwitchPrev)*PRE_PROFILE_SCALE-PRE_PROFILE_PROBE;
+		PREStats.switchcycles=cycles;
+		if(cycles>PREStats.maxswitchcycles) {
+			PREStats.maxswitchcycles=cycles;
+		}
+	}
+	PREProfiled=1;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PREPick
+///
+/// Make the highest priority ready task current. Ties are resolved in favour
+/// of the current task, or, if 'rotate' is set, the next one after it so that
+/// tasks of equal priority take turns. The idle task is always ready.
+///
+/// @context: INTERRUPTS OFF
+/// @scope: INTERNAL
+/// @param: unsigned char rotate - share the processor among equal priorities
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PREPick(unsigned char rotate)
+{
+	PREProfile();
+
+	unsigned char best=PRE_IDLE;
+	unsigned char idx=PRECurrentID;
+	if(rotate) {
+		idx=(idx+1)%(PRE_MAX_TASKS+1);
+	}
+	for(unsigned char count=0;count<=PRE_MAX_TASKS;count++) {
+		PRETCB * t=&PRETasks[idx];
+		if(t->state==PRE_STATE_READY && t->priority>PRETasks[best].priority) {
+			best=idx;
+		}
+		idx=(idx+1)%(PRE_MAX_TASKS+1);
+	}
+	if(best!=PRECurrentID) {
+		PREStats.switches++;
+		PRECurrentID=best;
+		PRECurrentTCB=&PRETasks[best];
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRESchedule, PREScheduleFromISR
+///
+/// Choose the task to run after a voluntary switch or an interrupt. Called
+/// from the context switch code with the outgoing context saved.
+///
+/// @context: INTERRUPTS OFF
+/// @scope: EXPORTED
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+extern "C" void PRESchedule(void)
+{
+	PREPick(PREYielding);
+	PREYielding=0;
+}
+
+extern "C" void PREScheduleFromISR(void)
+{
+	PREPick(0);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRETick
+///
+/// Called every millisecond with the outgoing context saved. Wakes sleeping
+/// tasks whose time has come, then time-slices among equal priorities.
+///
+/// @context: INTERRUPT
+/// @scope: INTERNAL
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+extern "C" void PRETick(void) __attribute__((used));
+
+extern "C" void PRETick(void)
+{
+	unsigned int now=++PRETicks;
+	PREStats.ticks++;
+	for(unsigned char idx=1;idx<=PRE_MAX_TASKS;idx++) {
+		PRETCB * t=&PRETasks[idx];
+		if(t->state==PRE_STATE_SLEEPING && (int)(now-t->wake)>=0) {
+			t->state=PRE_STATE_READY;
+		}
+	}
+	PREPick(1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PREContextSwitch
+///
+/// Save the running context, pick the next task and resume it. Called with
+/// a 'call' from task code or from an interrupt; it returns on the new task's
+/// stack to wherever that task was switched out.
+///
+/// @context: ANY
+/// @scope: EXPORTED
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef KERNEL_HOST
+
+extern "C" void PREContextSwitch(void)
+{
+	PRE_SAVE_CONTEXT();
+	asm volatile("call PRESchedule");
+	PRE_RESTORE_CONTEXT();
+	asm volatile("ret");
+}
+
+extern "C" void PRETickSwitch(void)
+{
+	PRE_SAVE_CONTEXT();
+	asm volatile("call PRETick");
+	PRE_RESTORE_CONTEXT();
+	asm volatile("ret");
+}
+
+#else
+
+///////////////////////////////////////////////////////////////////////////////
+/// PREHostSwitch
+///
+/// Host builds: run a scheduler entry point and, if it picks another task,
+/// swap to that task's context. Returns when this task is picked again. SREG
+/// is not part of a host context, so each task puts back its own after the
+/// switch, as the callers here all do.
+///
+/// @context: INTERRUPTS OFF
+/// @scope: INTERNAL
+/// @param: void (* schedule)(void) - PRESchedule or PRETick
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PREHostSwitch(void (* schedule)(void))
+{
+	PRETCB * from=PRECurrentTCB;
+	schedule();
+	if(PRECurrentTCB!=from) {
+		swapcontext(&from->host,&PRECurrentTCB->host);
+	}
+}
+
+extern "C" void PREContextSwitch(void)
+{
+	PREHostSwitch(PRESchedule);
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRETaskEntry
+///
+/// Every task starts here. If the task function returns, the task is removed
+/// and never scheduled again.
+///
+/// @context: TASK
+/// @scope: INTERNAL
+/// @param: none
+/// @return: does not return
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void PRETaskEntry(void)
+{
+#ifdef KERNEL_HOST
+	sei();									// as the AVR's initial SREG has it
+#endif
+	PRETCB * t=PRECurrentTCB;
+	t->fn(t->context);
+	cli();
+	t->state=PRE_STATE_FREE;
+	PREContextSwitch();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PREYield
+///
+/// Give the processor to another ready task of the same or higher priority
+///
+/// @context: TASK
+/// @scope: EXPORTED
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PREYield(void)
+{
+	unsigned char sreg=SREG;
+	cli();
+	PREYielding=1;
+	PREContextSwitch();
+	SREG=sreg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRESleep
+///
+/// Block the calling task for at least 'ms' milliseconds. From the idle
+/// task this is a busy wait, as the idle task must always be runnable.
+///
+/// @context: TASK
+/// @scope: EXPORTED
+/// @param: unsigned int ms - time to sleep
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PRESleep(unsigned int ms)
+{
+	if(PRECurrentID==PRE_IDLE) {
+		delay(ms);
+		return;
+	}
+	unsigned char sreg=SREG;
+	cli();
+	PRECurrentTCB->wake=PRETicks+ms+1;		// +1: the current tick is part-gone
+	PRECurrentTCB->state=PRE_STATE_SLEEPING;
+	PREContextSwitch();
+	SREG=sreg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// PREWait
+///
+/// Block the calling task until it is signalled. Returns at once if a
+/// signal arrived since the last wait. The idle task can not wait.
+///
+/// @context: TASK
+/// @scope: EXPORTED
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void PREWait(void)
+{
+	if(PRECurrentID==PRE_IDLE) {
+		return;
+	}
+	unsigned char sreg=SREG;
+	cli();
+	if(PRECurrentTCB->signalled) {
+		PRECurrentTCB->signalled=0;
+	} else {
+		PRECurrentTCB->state=PRE_STATE_WAITING;
+		PREContextSwitch();
+	}
+	SREG=sreg;
+}
+
+namespace Kernel {
+
+	////////////////////////////////////////////////////////////////////////
+	/// PREMutex::Lock
+	///
+	/// Take the mutex, waiting if another task owns it. While we wait the
+	/// owner inherits our priority, so a middle priority task can not keep
+	/// it - and so us - from running.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: zero if the mutex was taken, nonzero if not
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int PREMutex::Lock(void)
+	{
+		int rc=0;
+		unsigned char sreg=SREG;
+		cli();
+		if(owner<0) {
+			owner=PRECurrentID;
+		} else if(owner==PRECurrentID || PRECurrentID==PRE_IDLE) {
+			rc=-1;
+		} else {
+			PRETCB * pOwner=&PRETasks[owner];
+			if(pOwner->priority<PRECurrentTCB->priority) {
+				pOwner->priority=PRECurrentTCB->priority;
+			}
+			PRECurrentTCB->mutex=this;
+			PRECurrentTCB->state=PRE_STATE_BLOCKED;
+			PREContextSwitch();
+
+			// Unlock handed us the mutex before waking us
+		}
+		SREG=sreg;
+		return rc;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// PREMutex::Unlock
+	///
+	/// Release the mutex. The owner drops back to its base priority, and
+	/// the mutex passes straight to the highest priority waiter, which runs
+	/// now if it outranks us.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: zero for success, nonzero if the caller is not the owner
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int PREMutex::Unlock(void)
+	{
+		unsigned char sreg=SREG;
+		cli();
+		if(owner!=PRECurrentID) {
+			SREG=sreg;
+			return -1;
+		}
+		PRECurrentTCB->priority=PRECurrentTCB->basepriority;
+
+		signed char next=-1;
+		for(unsigned char idx=1;idx<=PRE_MAX_TASKS;idx++) {
+			PRETCB * t=&PRETasks[idx];
+			if(t->state==PRE_STATE_BLOCKED && t->mutex==this &&
+			   (next<0 || t->priority>PRETasks[next].priority)) {
+				next=idx;
+			}
+		}
+		owner=next;
+		if(next>=0) {
+			PRETasks[next].mutex=NULL;
+			PRETasks[next].state=PRE_STATE_READY;
+		}
+		PREContextSwitch();
+		SREG=sreg;
+		return 0;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// PreemptClass
+	///
+	/// CONSTRUCTOR, PRIVATE
+	///
+	/// Initialize the scheduler with only the idle task, which runs on the
+	/// main stack and so needs no stack of its own
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	PreemptClass::PreemptClass(void)
+	{
+		memset(PRETasks,0,sizeof(PRETasks));
+		PRETasks[PRE_IDLE].state=PRE_STATE_READY;
+		memset(&PREStats,0,sizeof(PREStats));
+	}
+
+#ifdef KERNEL_HOST
+
+	////////////////////////////////////////////////////////////////////////
+	/// ~PreemptClass
+	///
+	/// DESTRUCTOR, PRIVATE
+	///
+	/// Host builds only: frees the task stacks when the thread ends
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	PreemptClass::~PreemptClass()
+	{
+		for(unsigned char idx=1;idx<=PRE_MAX_TASKS;idx++) {
+			free(PRETasks[idx].hoststack);
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Tick
+	///
+	/// Host builds only: take a tick for each millisecond of virtual time
+	/// since the last, as long as interrupts are on. A tick may switch to
+	/// another task; the rest are taken when this one runs again, or by
+	/// whichever task moves the clock on next.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void PreemptClass::Tick(void)
+	{
+		while(PREHostStarted && (SREG&_BV(SREG_I)) && (long)(OS.Clock/1000-PREHostTicked)>0) {
+			cli();
+			PREHostTicked++;
+			PREHostSwitch(PRETick);
+			sei();
+		}
+	}
+
+#endif
+
+	////////////////////////////////////////////////////////////////////////
+	/// Get
+	///
+	/// Returns a reference to the singleton class, or in host builds the
+	/// calling thread's kernel instance's.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC, STATIC
+	/// @param: none
+	/// @return: PreemptClass&
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	PreemptClass& PreemptClass::Get(void)
+	{
+#ifdef KERNEL_HOST
+		return OS.Preempt;
+#else
+		static PreemptClass pre;
+		return pre;
+#endif
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// CreateTask
+	///
+	/// Create a preemptive task. The stack is painted for the high-water
+	/// mark, then an initial context is built at its top, so the first
+	/// switch to the task 'returns' into PRETaskEntry with interrupts on.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: PFNTASKHANDLER fn - task function
+	/// @param: void * context - passed to the task function
+	/// @param: unsigned char priority - 1 (lowest) to 255
+	/// @param: unsigned char * stack - stack, declared with PRE_STACK
+	/// @param: unsigned int size - size of the stack in bytes
+	/// @return: int. Task ID, or -1 on error
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int PreemptClass::CreateTask(PFNTASKHANDLER fn, void * context, unsigned char priority, unsigned char * stack, unsigned int size)
+	{
+		if(!fn || !stack || !priority || size<PRE_CONTEXT_SIZE+16) {
+			return -1;
+		}
+		unsigned char sreg=SREG;
+		cli();
+		for(unsigned char idx=1;idx<=PRE_MAX_TASKS;idx++) {
+			PRETCB * t=&PRETasks[idx];
+			if(t->state==PRE_STATE_FREE) {
+				memset(stack,PRE_STACK_FILL,size);
+
+#ifdef KERNEL_HOST
+				// Host code needs far more stack than the AVR's: the task
+				// runs on one of its own, and the AVR stack keeps its paint
+
+				if(!t->hoststack) {
+					t->hoststack=malloc(PRE_HOST_STACK);
+				}
+				getcontext(&t->host);
+				t->host.uc_stack.ss_sp=t->hoststack;
+				t->host.uc_stack.ss_size=PRE_HOST_STACK;
+				t->host.uc_link=NULL;
+				makecontext(&t->host,PRETaskEntry,0);
+#else
+				unsigned char * p=stack+size-1;
+				unsigned int entry=(unsigned int)PRETaskEntry;	// word address
+				*p--=entry&0xff;						// return address, as 'call' leaves it
+				*p--=entry>>8;
+				*p--=0;									// r0
+				*p--=0x80;								// SREG: interrupts on
+				for(unsigned char reg=1;reg<=31;reg++) {
+					*p--=0;								// r1 must be zero; r2-r31
+				}
+
+				t->sp=(unsigned int)p;
+#endif
+				t->fn=fn;
+				t->context=context;
+				t->stack=stack;
+				t->stacksize=size;
+				t->priority=priority;
+				t->basepriority=priority;
+				t->signalled=0;
+				t->mutex=NULL;
+				t->state=PRE_STATE_READY;
+				SREG=sreg;
+				return idx;
+			}
+		}
+		SREG=sreg;
+		return -1;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Start
+	///
+	/// Start the tick. Timer2 runs in CTC mode at clk/64, so OCR2A=249
+	/// gives 1ms at 16MHz. Tasks created in UserInit first run at the first
+	/// tick. To time switches, Timer1 free runs at clk/1 unless the
+	/// timebase already has it running. Host builds count ticks from the
+	/// virtual clock instead.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void PreemptClass::Start(void)
+	{
+		unsigned char sreg=SREG;
+		cli();
+#ifdef KERNEL_HOST
+		PREHostTicked=OS.Clock/1000;
+		PREHostStarted=1;
+#else
+		TCCR2A=(1<<WGM21);					// CTC
+		TCCR2B=(1<<CS22);					// clk/64
+		OCR2A=(F_CPU/64/1000)-1;
+		TCNT2=0;
+		TIFR2=(1<<OCF2A);
+		TIMSK2=(1<<OCIE2A);
+#ifdef KERNEL_PREEMPT_PROFILE
+#ifndef KERNEL_TIMEBASE
+		TCCR1A=0;							// normal mode, no interrupts
+		TCCR1B=(1<<CS10);					// clk/1
+#endif
+		PREProfiled=0;						// stamps taken before now are not timed
+#endif
+#endif
+		SREG=sreg;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Signal
+	///
+	/// Wake a task blocked in PREWait, and switch to it now if it outranks
+	/// the caller
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: int id - task ID
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void PreemptClass::Signal(int id)
+	{
+		unsigned char sreg=SREG;
+		cli();
+		SignalFromISR(id);
+		PREContextSwitch();
+		SREG=sreg;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// SignalFromISR
+	///
+	/// Wake a task blocked in PREWait, or remember the signal for its next
+	/// wait. Does not switch; PRE_ISR or the next tick will.
+	///
+	/// @context: INTERRUPT
+	/// @scope: PUBLIC
+	/// @param: int id - task ID
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void PreemptClass::SignalFromISR(int id)
+	{
+		if(id<1 || id>PRE_MAX_TASKS) {
+			return;
+		}
+		PRETCB * t=&PRETasks[id];
+		if(t->state==PRE_STATE_WAITING) {
+			t->state=PRE_STATE_READY;
+		} else if(t->state!=PRE_STATE_FREE) {
+			t->signalled=1;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Current
+	///
+	/// Return the ID of the running task
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: int. Task ID, PRE_IDLE for loop() context
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int PreemptClass::Current(void)
+	{
+		return PRECurrentID;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// StackHighWater
+	///
+	/// Count the paint bytes left at the bottom of a task's stack. The
+	/// stack grows down, so everything above the first overwritten byte has
+	/// been used at some time.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC
+	/// @param: int id - task ID
+	/// @return: unsigned int. Bytes used, or 0 for the idle task or an
+	///          invalid ID
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned int PreemptClass::StackHighWater(int id)
+	{
+		if(id<1 || id>PRE_MAX_TASKS || PRETasks[id].stack==NULL) {
+			return 0;
+		}
+		PRETCB * t=&PRETasks[id];
+		unsigned int unused=0;
+		while(unused<t->stacksize && t->stack[unused]==PRE_STACK_FILL) {
+			unused++;
+		}
+		return t->stacksize-unused;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// GetStats
+	///
+	/// Return the scheduler statistics. The counters are copied with
+	/// interrupts off; the stacks are then scanned with them on.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: PRESTATS * stats - filled in
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void PreemptClass::GetStats(PRESTATS * stats)
+	{
+		if(stats) {
+			unsigned char sreg=SREG;
+			cli();
+			*stats=PREStats;
+			SREG=sreg;
+			for(unsigned char idx=0;idx<=PRE_MAX_TASKS;idx++) {
+				stats->stackused[idx]=StackHighWater(idx);
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR(TIMER2_COMPA_vect)
+///
+/// Interrupt Service Routine: 1ms scheduler tick. Naked, so the whole
+/// context is saved by PRETickSwitch on the interrupted task's stack; the
+/// reti runs on whichever task's stack PRETickSwitch returns to.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef KERNEL_HOST
+
+ISR(TIMER2_COMPA_vect, ISR_NAKED)
+{
+	asm volatile("call PRETickSwitch");
+	asm volatile("reti");
+}
+
+#endif
+
+#endif
@@ -0,0 +1,527 @@
+///////////////////////////////////////////////////////////////////////////////
+/// preempt.h
+///
+/// Optional preemptive priority scheduling
+///
+/// A handful of tasks, each with its own small stack, are scheduled by
+/// priority. The highest priority ready task always runs; tasks of equal
+/// priority share the processor round-robin on each 1ms Timer2 tick. The
+/// Arduino loop() - and so the cooperative task ring and message queue - runs
+/// as the idle task at priority 0, on the main stack, whenever no preemptive
+/// task is ready.
+///
+/// Context switches happen on the tick, when a task sleeps, waits or yields,
+/// when a task signals a higher priority one, and at the end of any interrupt
+/// declared with PRE_ISR that wakes a task.
+///
+/// Enabled by defining KERNEL_MODE_PREEMPTIVE in kernelcfg.h.
+///
+/// Rules for preemptive tasks:
+///  - do not allocate or free memory. MQClass::Post is safe: it allocates with
+///    interrupts off. In this mode the kernel's own heap use from the idle
+///    task - freeing messages, registering tasks and subscribing - is done
+///    with interrupts off too, so the idle task may still call those at any
+///    time.
+///  - do not call the task ring registration functions.
+///  - share data with other tasks through PREMutex, or with interrupts off.
+///
+/// Cost: by instruction count, saving a context is 79 cycles and restoring
+/// one is 77, plus the call/return and the scheduler's scan (about 15 cycles
+/// per task). KERNEL_PREEMPT_PROFILE (kernelcfg.h) times each switch on
+/// Timer1 for GetStats, to measure it on the part or under simavr. Each task
+/// needs 35 bytes of stack for its saved context on top of its own use.
+/// Stacks are painted at creation so StackHighWater can report real usage.
+///
+///	PRE_STACK(SpeedStack,128);
+///
+///	void SpeedTask(void * context)
+///	{
+///		for(;;) {
+///			PREWait();						// woken by the tacho ISR
+///			...
+///		}
+///	}
+///
+///	SpeedTaskID=Kernel::OS.Preempt.CreateTask(SpeedTask,NULL,3,SpeedStack,sizeof(SpeedStack));
+///
+/// KERNEL_HOST builds switch tasks with ucontext, each on a host stack of
+/// PRE_HOST_STACK bytes, so StackHighWater reports nothing there. The tick is
+/// taken when the harness or the code under test moves the clock on with
+/// Kernel::OS.Advance() or delay(), for every millisecond passed; tasks
+/// woken by a PRE_ISR interrupt run at the next tick.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _PREEMPT_H_
+#define _PREEMPT_H_
+
+#include "sysincs.h"
+#include "taskring.h"
+
+#ifdef KERNEL_MODE_PREEMPTIVE
+
+#ifdef KERNEL_MODE_CYCLIC
+#error "KERNEL_MODE_PREEMPTIVE and KERNEL_MODE_CYCLIC both use Timer2 and can not be combined"
+#endif
+
+#define PRE_MAX_TASKS			4			// preemptive tasks, not counting idle
+#define PRE_IDLE				0			// task ID of the idle (loop) task
+#define PRE_STACK_FILL			0xa5		// stack paint for high-water marks
+#define PRE_CONTEXT_SIZE		35			// bytes of stack per saved context
+#ifdef KERNEL_HOST
+#define PRE_HOST_STACK			65536		// host builds: the stack each task really runs on
+#endif
+
+//
+// Context switch timing. Timer1 is read as the outgoing SREG has been saved,
+// and again just before it is restored (TCNT1L first: reading it latches
+// TCNT1H). The reads are by data space address, 0x84 and 0x85 on the
+// ATmega328p. The scheduler works out the last switch's time from the stamps.
+
+#ifdef KERNEL_PREEMPT_PROFILE
+
+#define PRE_PROFILE_PROBE		6			// cycles of the probe counted in a switch
+#ifdef KERNEL_TIMEBASE
+#define PRE_PROFILE_SCALE		8			// Timer1 at clk/8
+#else
+#define PRE_PROFILE_SCALE		1
+#endif
+
+#define PRE_PROFILE_ENTRY \
+		"lds r0,PRESwitchStart	\n\t" \
+		"sts PRESwitchPrev,r0	\n\t" \
+		"lds r0,PRESwitchStart+1	\n\t" \
+		"sts PRESwitchPrev+1,r0	\n\t" \
+		"lds r0,0x84			\n\t" \
+		"sts PRESwitchStart,r0	\n\t" \
+		"lds r0,0x85			\n\t" \
+		"sts PRESwitchStart+1,r0	\n\t"
+
+#define PRE_PROFILE_EXIT \
+		"lds r0,0x84			\n\t" \
+		"sts PRESwitchEnd,r0		\n\t" \
+		"lds r0,0x85			\n\t" \
+		"sts PRESwitchEnd+1,r0	\n\t"
+
+#else
+
+#define PRE_PROFILE_ENTRY
+#define PRE_PROFILE_EXIT
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRE_STACK
+///
+/// Declare a task stack
+///
+/// @param: name - name of the stack
+/// @param: size - size in bytes. Allow PRE_CONTEXT_SIZE plus the task's own
+///         use, plus the use of any interrupt that can occur while it runs
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define PRE_STACK(name,size) \
+	static unsigned char name[size]
+
+#ifndef KERNEL_HOST
+
+///////////////////////////////////////////////////////////////////////////////
+/// PRE_ISR
+///
+/// Declare an interrupt service routine that may wake a preemptive task. The
+/// interrupted context is saved first, so if the body wakes a task of higher
+/// priority that task runs as soon as the interrupt returns. Use in place of
+/// ISR(vect).
+///
+/// @param: vect - interrupt vector
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define PRE_ISR(vect) \
+	extern "C" void vect##_PREBody(void) __attribute__((used)); \
+	extern "C" void vect##_PRESwitch(void) __attribute__((naked,used)); \
+	void vect##_PRESwitch(void) \
+	{ \
+		PRE_SAVE_CONTEXT(); \
+		vect##_PREBody(); \
+		PREScheduleFromISR(); \
+		PRE_RESTORE_CONTEXT(); \
+		asm volatile("ret"); \
+	} \
+	ISR(vect, ISR_NAKED) \
+	{ \
+		asm volatile("call " #vect "_PRESwitch"); \
+		asm volatile("reti"); \
+	} \
+	void vect##_PREBody(void)
+
+//
+// Save and restore a complete task context on the current stack. The stack
+// pointer is kept in the first field of the current task's control block.
+
+#define PRE_SAVE_CONTEXT() \
+	asm volatile( \
+		"push r0				\n\t" \
+		"in r0,__SREG__			\n\t" \
+		"cli					\n\t" \
+		"push r0				\n\t" \
+		PRE_PROFILE_ENTRY \
+		"push r1				\n\t" \
+		"clr r1					\n\t" \
+		"push r2				\n\t" \
+		"push r3				\n\t" \
+		"push r4				\n\t" \
+		"push r5				\n\t" \
+		"push r6				\n\t" \
+		"push r7				\n\t" \
+		"push r8				\n\t" \
+		"push r9				\n\t" \
+		"push r10				\n\t" \
+		"push r11				\n\t" \
+		"push r12				\n\t" \
+		"push r13				\n\t" \
+		"push r14				\n\t" \
+		"push r15				\n\t" \
+		"push r16				\n\t" \
+		"push r17				\n\t" \
+		"push r18				\n\t" \
+		"push r19				\n\t" \
+		"push r20				\n\t" \
+		"push r21				\n\t" \
+		"push r22				\n\t" \
+		"push r23				\n\t" \
+		"push r24				\n\t" \
+		"push r25				\n\t" \
+		"push r26				\n\t" \
+		"push r27				\n\t" \
+		"push r28				\n\t" \
+		"push r29				\n\t" \
+		"push r30				\n\t" \
+		"push r31				\n\t" \
+		"lds r26,PRECurrentTCB	\n\t" \
+		"lds r27,PRECurrentTCB+1	\n\t" \
+		"in r0,__SP_L__			\n\t" \
+		"st x+,r0				\n\t" \
+		"in r0,__SP_H__			\n\t" \
+		"st x+,r0				\n\t" \
+	)
+
+#define PRE_RESTORE_CONTEXT() \
+	asm volatile( \
+		"lds r26,PRECurrentTCB	\n\t" \
+		"lds r27,PRECurrentTCB+1	\n\t" \
+		"ld r28,x+				\n\t" \
+		"out __SP_L__,r28		\n\t" \
+		"ld r29,x+				\n\t" \
+		"out __SP_H__,r29		\n\t" \
+		"pop r31				\n\t" \
+		"pop r30				\n\t" \
+		"pop r29				\n\t" \
+		"pop r28				\n\t" \
+		"pop r27				\n\t" \
+		"pop r26				\n\t" \
+		"pop r25				\n\t" \
+		"pop r24				\n\t" \
+		"pop r23				\n\t" \
+		"pop r22				\n\t" \
+		"pop r21				\n\t" \
+		"pop r20				\n\t" \
+		"pop r19				\n\t" \
+		"pop r18				\n\t" \
+		"pop r17				\n\t" \
+		"pop r16				\n\t" \
+		"pop r15				\n\t" \
+		"pop r14				\n\t" \
+		"pop r13				\n\t" \
+		"pop r12				\n\t" \
+		"pop r11				\n\t" \
+		"pop r10				\n\t" \
+		"pop r9					\n\t" \
+		"pop r8					\n\t" \
+		"pop r7					\n\t" \
+		"pop r6					\n\t" \
+		"pop r5					\n\t" \
+		"pop r4					\n\t" \
+		"pop r3					\n\t" \
+		"pop r2					\n\t" \
+		"pop r1					\n\t" \
+		PRE_PROFILE_EXIT \
+		"pop r0					\n\t" \
+		"out __SREG__,r0		\n\t" \
+		"pop r0					\n\t" \
+	)
+
+#else
+
+// Host builds: the simulator runs ISRs to completion, so the switch waits
+// for the next tick
+
+#define PRE_ISR(vect) \
+	ISR(vect)
+
+#endif
+
+//
+// Scheduler entry points used by the context switch code
+
+extern "C" void PRESchedule(void);
+extern "C" void PREScheduleFromISR(void);
+#ifdef KERNEL_HOST
+extern "C" void PREContextSwitch(void);
+#else
+extern "C" void PREContextSwitch(void) __attribute__((naked));
+#endif
+
+//
+// Calls available to preemptive tasks
+
+void PREYield(void);
+void PRESleep(unsigned int ms);
+void PREWait(void);
+
+namespace Kernel {
+
+	//
+	// Scheduler statistics
+
+	typedef struct _PRESTATS {
+		unsigned long		switches;		// context switches
+		unsigned long		ticks;			// 1ms ticks since Start
+		unsigned int		stackused[PRE_MAX_TASKS+1];	// StackHighWater of each task
+		unsigned int		switchcycles;	// last pass through the switch code, cycles
+		unsigned int		maxswitchcycles;// longest, since Start
+	} PRESTATS;
+
+	//
+	// Mutex with priority inheritance. While a higher priority task waits
+	// for the mutex, the owner runs at the waiter's priority. The owner drops
+	// back to its base priority on unlock, so a task should not hold more
+	// than one mutex that higher priority tasks contend for at a time.
+
+	class PREMutex {
+
+		private:
+
+			signed char		owner;			// task ID, or -1 if free
+
+		public:
+
+			PREMutex(void) : owner(-1) {};
+
+			////////////////////////////////////////////////////////////////////////
+			/// Lock
+			///
+			/// Take the mutex, waiting if another task owns it. The idle task
+			/// can not wait, so Lock fails from loop() context if the mutex is
+			/// owned.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: zero if the mutex was taken, nonzero if not
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int Lock(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Unlock
+			///
+			/// Release the mutex, handing it to the highest priority waiter
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: zero for success, nonzero if the caller is not the owner
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int Unlock(void);
+	};
+
+	class PreemptClass {
+
+		private:
+
+			friend void ::setup();		// the kernel starts the scheduler
+#ifdef KERNEL_HOST
+			friend class KernelClass;	// host builds: each kernel instance owns one
+#endif
+
+			////////////////////////////////////////////////////////////////////////
+			/// PreemptClass
+			///
+			/// CONSTRUCTOR, PRIVATE
+			///
+			/// Initialize the scheduler with only the idle task
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			PreemptClass(void);
+
+#ifdef KERNEL_HOST
+			////////////////////////////////////////////////////////////////////////
+			/// ~PreemptClass
+			///
+			/// DESTRUCTOR, PRIVATE
+			///
+			/// Host builds only: frees the task stacks when the thread ends
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			~PreemptClass();
+
+			////////////////////////////////////////////////////////////////////////
+			/// Tick
+			///
+			/// Host builds only: take the ticks due by the virtual clock, each
+			/// as the Timer2 interrupt would. Called as the clock is moved on.
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Tick(void);
+#endif
+
+			////////////////////////////////////////////////////////////////////////
+			/// Start
+			///
+			/// Start the Timer2 tick. Called by the kernel after UserInit.
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Start(void);
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// Get
+			///
+			/// Returns a reference to the singleton class.
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC, STATIC
+			/// @param: none
+			/// @return: PreemptClass&
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			static PreemptClass& Get(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// CreateTask
+			///
+			/// Create a preemptive task. Call from UserInit. If the task
+			/// function returns, the task is removed.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: PFNTASKHANDLER fn - task function
+			/// @param: void * context - passed to the task function
+			/// @param: unsigned char priority - 1 (lowest) to 255
+			/// @param: unsigned char * stack - stack, declared with PRE_STACK
+			/// @param: unsigned int size - size of the stack in bytes
+			/// @return: int. Task ID, or -1 on error
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int CreateTask(PFNTASKHANDLER fn, void * context, unsigned char priority, unsigned char * stack, unsigned int size);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Signal
+			///
+			/// Wake a task blocked in PREWait. If the task is not waiting, the
+			/// signal is remembered and its next PREWait returns at once. Use
+			/// SignalFromISR in interrupt context.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: int id - task ID
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Signal(int id);
+
+			////////////////////////////////////////////////////////////////////////
+			/// SignalFromISR
+			///
+			/// As Signal, from an interrupt. The woken task runs when the
+			/// interrupt returns if the ISR was declared with PRE_ISR, otherwise
+			/// at the next tick.
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: int id - task ID
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void SignalFromISR(int id);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Current
+			///
+			/// Return the ID of the running task
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: int. Task ID, PRE_IDLE for loop() context
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int Current(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// StackHighWater
+			///
+			/// Return the most stack a task has ever used, found from the paint
+			/// left untouched at the bottom of its stack
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: int id - task ID
+			/// @return: unsigned int. Bytes used, or 0 for the idle task or an
+			///          invalid ID
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned int StackHighWater(int id);
+
+			////////////////////////////////////////////////////////////////////////
+			/// GetStats
+			///
+			/// Return the scheduler statistics, with each task's stack
+			/// high-water mark. With KERNEL_PREEMPT_PROFILE, also the time in
+			/// CPU cycles of the last and the longest pass through the context
+			/// switch code - save, scheduler and restore, whether or not the
+			/// task changed - from the outgoing SREG being saved to the incoming
+			/// one being restored. The call or interrupt into it, its return and
+			/// four instructions at either end are not counted. Without it both
+			/// are zero.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: PRESTATS * stats - filled in
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void GetStats(PRESTATS * stats);
+	};
+}
+
+#endif
+
+#endif
@@ -0,0 +1,251 @@
+///////////////////////////////////////////////////////////////////////////////
+/// seqlock.h
+///
+/// Lock-free sharing of multi-byte values between ISRs and tasks
+///
+/// The AVR reads and writes memory a byte at a time, so a task that reads a
+/// 32-bit period while the tacho ISR is updating it can get half of the old
+/// value and half of the new. Turning interrupts off around every read works,
+/// but it delays the interrupts. These two templates avoid that:
+///
+/// SeqLock<T>: an ISR publishes a value; tasks read it. The ISR bumps a
+/// sequence count, stores the value and bumps the count again. A reader
+/// copies the value and retries if the count moved while it was copying.
+/// Publishing costs the store plus two byte increments. Reading costs one
+/// extra byte compare and, rarely, a second copy.
+///
+///	Kernel::SeqLock<unsigned long> TachoPeriod;
+///
+///	ISR(INT0_vect) { TachoPeriod.WriteFromISR(period); }
+///
+///	unsigned long period=TachoPeriod.Read();			// in a task
+///
+/// DoubleBuffer<T>: two copies of the value and an index byte saying which
+/// one is current. The writer fills in the copy not in use and then flips the
+/// index, which is a single-byte store. Either side may be the ISR:
+///
+///	- task writer, ISR reader: the ISR always sees a complete copy, as the
+///	  task can not run while the ISR is reading. No retry needed, so use this
+///	  way round for settings an ISR consumes.
+///	- ISR writer, task reader: the task's copy is only overwritten if the
+///	  ISR publishes twice during the read, which a publish counter detects.
+///	  One publish during a read does not force a retry, so this suits values
+///	  that are large or published often.
+///
+/// One writer per object. Readers never block the writer and the writer never
+/// waits. ISRs do not nest on the AVR, so an ISR can read a value published by
+/// another ISR directly with ReadFromISR.
+///
+/// SeqLock needs a writer that the reader can not interrupt: an ISR, when the
+/// readers are tasks. A task writer with ISR readers must use DoubleBuffer.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include "sysincs.h"
+
+// Compiler barrier: stops the compiler moving memory accesses across it. The
+// AVR needs nothing more, and neither does a host build, where the "ISR" is a
+// signal handler on the same thread.
+
+#define KERNEL_BARRIER()	__asm__ __volatile__("" ::: "memory")
+
+namespace Kernel {
+
+	//
+	// Sequence lock
+
+	template<typename T>
+	class SeqLock {
+
+		private:
+
+			volatile unsigned char	seq;		// odd while a write is in progress
+			T						value;
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// SeqLock
+			///
+			/// CONSTRUCTOR
+			///
+			/// Initializes the shared value
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			SeqLock(const T& init=T()) : seq(0), value(init) {};
+
+			////////////////////////////////////////////////////////////////////////
+			/// WriteFromISR
+			///
+			/// Publish a new value
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: const T& v - the new value
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void WriteFromISR(const T& v)
+			{
+				seq=seq+1;
+				KERNEL_BARRIER();
+				value=v;
+				KERNEL_BARRIER();
+				seq=seq+1;
+			};
+
+			////////////////////////////////////////////////////////////////////////
+			/// Read
+			///
+			/// Take a consistent copy of the value, retrying if a write got in
+			/// the way
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: T - the value
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			T Read(void)
+			{
+				unsigned char s;
+				T v;
+				do {
+					s=seq;
+					KERNEL_BARRIER();
+					v=value;
+					KERNEL_BARRIER();
+				} while((s&1) || s!=seq);
+				return v;
+			};
+
+			////////////////////////////////////////////////////////////////////////
+			/// ReadFromISR
+			///
+			/// Read the value from an ISR, which no write can interrupt
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: T - the value
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			T ReadFromISR(void) { KERNEL_BARRIER(); return value; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Sequence
+			///
+			/// The write count, times two. Compare against an earlier value to
+			/// see whether anything has been published since.
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned char
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char Sequence(void) { return seq; };
+	};
+
+	//
+	// Double buffer
+
+	template<typename T>
+	class DoubleBuffer {
+
+		private:
+
+			T						buf[2];
+			volatile unsigned char	idx;		// the current copy
+			volatile unsigned char	count;		// publishes, modulo 256
+
+			void Publish(const T& v)
+			{
+				unsigned char next=idx^1;
+				buf[next]=v;
+				KERNEL_BARRIER();
+				idx=next;
+				count=count+1;
+			};
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// DoubleBuffer
+			///
+			/// CONSTRUCTOR
+			///
+			/// Initializes the shared value
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			DoubleBuffer(const T& init=T()) : idx(0), count(0) { buf[0]=init; };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Write, WriteFromISR
+			///
+			/// Publish a new value. Write is for a task writer with ISR readers,
+			/// WriteFromISR for an ISR writer with task readers.
+			///
+			/// @context: TASK, INTERRUPT respectively
+			/// @scope: PUBLIC
+			/// @param: const T& v - the new value
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Write(const T& v) { Publish(v); };
+			void WriteFromISR(const T& v) { Publish(v); };
+
+			////////////////////////////////////////////////////////////////////////
+			/// Read
+			///
+			/// Take a consistent copy of a value published from an ISR. Retries
+			/// only if two publishes land during the copy.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: T - the value
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			T Read(void)
+			{
+				unsigned char c;
+				T v;
+				do {
+					c=count;
+					KERNEL_BARRIER();
+					v=buf[idx];
+					KERNEL_BARRIER();
+				} while((unsigned char)(count-c)>1);
+				return v;
+			};
+
+			////////////////////////////////////////////////////////////////////////
+			/// ReadFromISR
+			///
+			/// Read the current value from an ISR. The writer can not run
+			/// during the read, so no check is needed.
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: T - the value
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			T ReadFromISR(void) { KERNEL_BARRIER(); return buf[idx]; };
+	};
+}
+
+#endif
@@ -12,12 +12,23 @@
 
 #include <stdio.h>
 #include <Arduino.h>
+#include "kernelcfg.h"
 
 // Boolean type
 
 //typedef	uint8_t	boolean;
 //enum { false, true };
 
+// Storage for kernel (and application) state that belongs to one kernel
+// instance. On the AVR there is a single instance and this is empty. Host
+// builds run one instance per thread, so it makes the state thread-local.
+
+#ifdef KERNEL_HOST
+#define KERNEL_INSTANCE	thread_local
+#else
+#define KERNEL_INSTANCE
+#endif
+
 #define IMIN(a,b) (((a)<(b))?(a):(b))
 #define IMAX(a,b) (((a)>(b))?(a):(b))
 
@@ -8,6 +8,11 @@
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "taskring.h"
+#include "coroutine.h"
+#include "interrupts.h"
+#ifdef KERNEL_HOST
+#include "kernel.h"
+#endif
 #include <stdlib.h>
 
 //
@@ -17,13 +22,16 @@ namespace Kernel {
 
 	// Task state structure
 
-	typedef class TASKSTATE * 	PTASKSTATE;
 	class TASKSTATE {
 		public:
-			PFNTASKHANDLER		handler;
+			union {
+				PFNTASKHANDLER	handler;
+				PFNCOROUTINE	cohandler;	// if co is set
+			};
 			void *				context;
+			Coroutine *			co;			// NULL unless this is a coroutine task
 			PTASKSTATE			pNext;
-			TASKSTATE(PFNTASKHANDLER handler, void * context) : handler(handler),context(context),pNext(NULL) {};
+			TASKSTATE(PFNTASKHANDLER handler, void * context) : handler(handler),context(context),co(NULL),pNext(NULL) {};
 	};
 
 	// Task internal structure
@@ -31,9 +39,14 @@ namespace Kernel {
 	typedef class TASKINTERNALS *	PTASKINTERNALS;
 	class TASKINTERNALS {
 		public:
-			PTASKSTATE	pHead;
+			PTASKSTATE	pHead;			// tasks that are run
+			PTASKSTATE	pSuspended;		// tasks that are not run until resumed
 			PTASKSTATE	pCur;
-			TASKINTERNALS() : pHead(NULL),pCur(NULL) {};
+			PFNTASKHANDLER	pRunning;	// handler currently being called, if any
+			const TASKTABLEENTRY *	pTable;		// static task table, in flash
+			unsigned char			TableSize;
+			unsigned char			TableNext;	// next static task to run
+			TASKINTERNALS() : pHead(NULL),pSuspended(NULL),pCur(NULL),pRunning(NULL),pTable(NULL),TableSize(0),TableNext(0) {};
 	};
 
 	///////////////////////////////////////////////////////////////////////////////
@@ -56,10 +69,39 @@ namespace Kernel {
 		this->internals=new TASKINTERNALS;
 	}
 
+#ifdef KERNEL_HOST
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// ~TaskRing
+	///
+	/// DESTRUCTOR
+	///
+	/// Host builds only. Free the state of every registered task.
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	TaskRing::~TaskRing()
+	{
+		TASKINTERNALS * internal=(TASKINTERNALS *)internals;
+		PTASKSTATE lists[2]={internal->pHead,internal->pSuspended};
+		for(int idx=0;idx<2;idx++) {
+			PTASKSTATE task=lists[idx];
+			while(task) {
+				PTASKSTATE pNext=task->pNext;
+				delete task;
+				task=pNext;
+			}
+		}
+		delete internal;
+	}
+
+#endif
+
 	///////////////////////////////////////////////////////////////////////////////
 	/// Get
 	///
-	/// Obtain the singleton class instance
+	/// Obtain the singleton class instance. Host builds have one instance per
+	/// kernel, and return the calling thread's.
 	///
 	/// @scope: PUBLIC
 	/// @context: ANY
@@ -70,14 +112,51 @@ namespace Kernel {
 
 	static TaskRing& TaskRing::Get(void)
 	{
+#ifdef KERNEL_HOST
+		return OS.TaskManager;		// each host kernel instance owns its own
+#else
 		static TaskRing tr;
 		return tr;
+#endif
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// TaskUnlink
+	///
+	/// Remove a task from one of the task lists. If it is the task the ring
+	/// would run next, the ring moves on past it.
+	///
+	/// @scope:   INTERNAL
+	/// @context: TASK
+	/// @param:   PTASKINTERNALS internal
+	/// @param:   PTASKSTATE * ppList - list to search
+	/// @param:   PTASKSTATE pTask - task to remove
+	/// @return:  int. Nonzero if the task was found and removed
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	static int TaskUnlink(PTASKINTERNALS internal, PTASKSTATE * ppList, PTASKSTATE pTask)
+	{
+		while(*ppList) {
+			if(*ppList==pTask) {
+				*ppList=pTask->pNext;
+				if(internal->pCur==pTask) {
+					internal->pCur=pTask->pNext;
+				}
+				pTask->pNext=NULL;
+				return 1;
+			}
+			ppList=&((*ppList)->pNext);
+		}
+		return 0;
 	}
 
 	///////////////////////////////////////////////////////////////////////////////
 	/// Loop
 	///
 	/// Called by the kernel at task time to sequentially call the handlers.
+	/// Each round runs the static task table (if any) first, then the tasks
+	/// registered at run time. One handler is called per call to Loop.
 	///
 	/// @scope:	  EXPORTED
 	/// @context: TASK
@@ -89,14 +168,55 @@ namespace Kernel {
 	{
 		PTASKINTERNALS internal=(PTASKINTERNALS)(this->internals);
 
-		if(internal->pCur==NULL) {
+		if(internal->TableNext>=internal->TableSize && internal->pCur==NULL) {
+
+			// start of a new round
+
+			internal->TableNext=0;
 			internal->pCur=internal->pHead;
 		}
 
-		if(internal->pCur) {
-			internal->pCur->handler(internal->pCur->context);
-			internal->pCur=internal->pCur->pNext;
+		if(internal->TableNext<internal->TableSize) {
+			const TASKTABLEENTRY * pEntry=internal->pTable+internal->TableNext++;
+			PFNTASKHANDLER handler=(PFNTASKHANDLER)pgm_read_ptr(&pEntry->handler);
+			internal->pRunning=handler;
+			handler(pgm_read_ptr(&pEntry->context));
+		} else if(internal->pCur) {
+			PTASKSTATE pTask=internal->pCur;
+
+			// move on before calling the handler. The handler may suspend or
+			// unregister itself, after which pTask must not be touched.
+
+			internal->pCur=pTask->pNext;
+			internal->pRunning=pTask->handler;
+			if(!pTask->co) {
+				pTask->handler(pTask->context);
+			} else if(pTask->co->isReady()) {
+				// a coroutine is only resumed once whatever it awaits has happened
+				pTask->cohandler(*pTask->co,pTask->context);
+			}
 		}
+		internal->pRunning=NULL;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// Running
+	///
+	/// Return the handler the task ring is currently calling. Used by the
+	/// watchdog to find out which task has blocked. A coroutine's handler
+	/// comes back in the same form, to identify the task by: it is not to be
+	/// called through it.
+	///
+	/// @scope:   EXPORTED
+	/// @context: ANY
+	/// @param:   none
+	/// @return:  PFNTASKHANDLER - the running handler, NULL if none
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	PFNTASKHANDLER TaskRing::Running(void)
+	{
+		return ((PTASKINTERNALS)(this->internals))->pRunning;
 	}
 
 	///////////////////////////////////////////////////////////////////////////////
@@ -112,21 +232,191 @@ namespace Kernel {
 	/// @context: TASK
 	/// @param:   PFNHANDLER pfnHandler
 	/// @param:   (void *) context
+	/// @return:  TASKHANDLE - handle to the task, NULL if it could not be registered
 	///
 	///////////////////////////////////////////////////////////////////////////////
 
-	int TaskRing::RegisterTaskHandler(PFNTASKHANDLER handler, void * context)
+	TASKHANDLE TaskRing::RegisterTaskHandler(PFNTASKHANDLER handler, void * context)
 	{
-		int rc=-1;
+		PTASKSTATE pNew=NULL;
+		if(handler) {
+#ifdef KERNEL_MODE_PREEMPTIVE
+			INTDisableMasterInterrupts();
+#endif
+			pNew = new TASKSTATE(handler,context);
+#ifdef KERNEL_MODE_PREEMPTIVE
+			INTEnableMasterInterrupts();
+#endif
+			PTASKINTERNALS internal=(PTASKINTERNALS)(this->internals);
+			if(pNew) {
+				pNew->pNext=internal->pHead;
+				internal->pHead=pNew;
+			}
+		}
+		return pNew;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// RegisterCoroutine
+	///
+	/// As RegisterTaskHandler, but the handler is a coroutine (see coroutine.h).
+	/// The Coroutine state block is owned by the caller and must stay in place
+	/// for as long as the task is registered - normally it is declared static.
+	/// The kernel will not call the handler while the coroutine is waiting.
+	///
+	/// @scope:   EXPORTED
+	/// @context: TASK
+	/// @param:   PFNCOROUTINE handler
+	/// @param:   Coroutine& co - coroutine state block
+	/// @param:   (void *) context
+	/// @return:  TASKHANDLE - handle to the task, NULL if it could not be registered
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	TASKHANDLE TaskRing::RegisterCoroutine(PFNCOROUTINE handler, Coroutine& co, void * context)
+	{
+		PTASKSTATE pNew=NULL;
 		if(handler) {
-			PTASKSTATE pNew = new TASKSTATE(handler,context);
+#ifdef KERNEL_MODE_PREEMPTIVE
+			INTDisableMasterInterrupts();
+#endif
+			pNew = new TASKSTATE(NULL,context);
+#ifdef KERNEL_MODE_PREEMPTIVE
+			INTEnableMasterInterrupts();
+#endif
 			PTASKINTERNALS internal=(PTASKINTERNALS)(this->internals);
 			if(pNew) {
+				pNew->cohandler=handler;
+				pNew->co=&co;
 				pNew->pNext=internal->pHead;
 				internal->pHead=pNew;
+			}
+		}
+		return pNew;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// RegisterTaskTable
+	///
+	/// Install a static task table. The table is declared at compile time and
+	/// placed in flash (see KERNEL_TASK_TABLE in taskring.h), so it costs no heap
+	/// and no RAM per task. Only one table may be installed; a second call
+	/// replaces the first. Tasks registered with RegisterTaskHandler still run,
+	/// after the table tasks in each round.
+	///
+	/// @scope:   EXPORTED
+	/// @context: TASK
+	/// @param:   const TASKTABLEENTRY * table - table in flash
+	/// @param:   unsigned char size - number of entries
+	/// @return:  zero for success
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	int TaskRing::RegisterTaskTable(const TASKTABLEENTRY * table, unsigned char size)
+	{
+		int rc=-1;
+		if(table || !size) {
+			PTASKINTERNALS internal=(PTASKINTERNALS)(this->internals);
+			internal->pTable=table;
+			internal->TableSize=size;
+			internal->TableNext=size;		// picked up at the start of the next round
+			rc=0;
+		}
+		return rc;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// Unregister
+	///
+	/// Remove a task, running or suspended, and free its state. The handle is
+	/// invalid afterwards. May be called by the task itself from within its
+	/// handler. Tasks in the static task table can not be unregistered.
+	///
+	/// @scope:   EXPORTED
+	/// @context: TASK
+	/// @param:   TASKHANDLE task
+	/// @return:  zero for success, nonzero if the handle is not a registered task
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	int TaskRing::Unregister(TASKHANDLE task)
+	{
+		int rc=-1;
+		PTASKINTERNALS internal=(PTASKINTERNALS)(this->internals);
+		if(task) {
+			if(TaskUnlink(internal,&internal->pHead,task) ||
+			   TaskUnlink(internal,&internal->pSuspended,task)) {
+				if(task->co) {
+					task->co->Detach();		// no message may wake it now
+				}
+#ifdef KERNEL_MODE_PREEMPTIVE
+				INTDisableMasterInterrupts();
+#endif
+				delete task;
+#ifdef KERNEL_MODE_PREEMPTIVE
+				INTEnableMasterInterrupts();
+#endif
 				rc=0;
 			}
 		}
 		return rc;
 	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// Suspend
+	///
+	/// Stop a task from being run. The task is moved off the ring altogether so
+	/// it costs nothing in Loop until it is resumed. May be called by the task
+	/// itself from within its handler.
+	/// A coroutine waiting for a message misses any dispatched while it is
+	/// suspended, and goes on waiting once it is resumed.
+	///
+	/// @scope:   EXPORTED
+	/// @context: TASK
+	/// @param:   TASKHANDLE task
+	/// @return:  zero for success, nonzero if the task is not running
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	int TaskRing::Suspend(TASKHANDLE task)
+	{
+		int rc=-1;
+		PTASKINTERNALS internal=(PTASKINTERNALS)(this->internals);
+		if(task && TaskUnlink(internal,&internal->pHead,task)) {
+			if(task->co) {
+				task->co->Detach();
+			}
+			task->pNext=internal->pSuspended;
+			internal->pSuspended=task;
+			rc=0;
+		}
+		return rc;
+	}
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// Resume
+	///
+	/// Put a suspended task back on the ring. It will be run from the next round.
+	///
+	/// @scope:   EXPORTED
+	/// @context: TASK
+	/// @param:   TASKHANDLE task
+	/// @return:  zero for success, nonzero if the task is not suspended
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	int TaskRing::Resume(TASKHANDLE task)
+	{
+		int rc=-1;
+		PTASKINTERNALS internal=(PTASKINTERNALS)(this->internals);
+		if(task && TaskUnlink(internal,&internal->pSuspended,task)) {
+			if(task->co) {
+				task->co->Attach();			// back to waiting for its message
+			}
+			task->pNext=internal->pHead;
+			internal->pHead=task;
+			rc=0;
+		}
+		return rc;
+	}
 }
@@ -11,18 +11,112 @@
 #define _TASKRING_H_
 
 #include "sysincs.h"
+#include "coroutine.h"
 
 typedef void (*PFNTASKHANDLER)(void * context);
 
+//
+// Entry in a static task table. Tables live in flash, so entries are read back
+// with pgm_read_ptr by the scheduler.
+
+typedef struct _TASKTABLEENTRY {
+	PFNTASKHANDLER		handler;
+	void *				context;
+} TASKTABLEENTRY;
+
+///////////////////////////////////////////////////////////////////////////////
+/// KERNEL_TASK_TABLE
+///
+/// Declare a static task table in flash. For fixed builds this replaces
+/// RegisterTaskHandler calls in UserInit: the tasks cost 4 bytes of flash each
+/// and no RAM. Contexts must be addresses of static objects (or NULL) so the
+/// table is a constant expression.
+///
+///	KERNEL_TASK_TABLE(MyTasks) {
+///		KERNEL_TASK(ControlTask,&ControlState),
+///		KERNEL_TASK(KEYTaskHandler,NULL)
+///	};
+///
+///	Kernel::OS.TaskManager.RegisterTaskTable(MyTasks);
+///
+/// @param: name - name of the table
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define KERNEL_TASK_TABLE(name) \
+	static constexpr TASKTABLEENTRY name[] PROGMEM =
+
+#define KERNEL_TASK(handler,context) \
+	{ handler, context }
+
+///////////////////////////////////////////////////////////////////////////////
+/// KERNEL_TASK_OBJECT, KERNEL_TASK_MEMBER
+///
+/// Static task table entries that call a member function of a static object,
+/// as RegisterTask does at run time.
+///
+///	KERNEL_TASK_TABLE(MyTasks) {
+///		KERNEL_TASK_OBJECT(Control),				// calls Control.Run()
+///		KERNEL_TASK_MEMBER(Keypad,Scan)				// calls Keypad.Scan()
+///	};
+///
+/// @param: obj - a static object
+/// @param: member - name of a member function taking and returning nothing
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#define KERNEL_TASK_OBJECT(obj) \
+	KERNEL_TASK_MEMBER(obj,Run)
+
+#define KERNEL_TASK_MEMBER(obj,member) \
+	{ Kernel::TaskThunk<decltype(obj),&Kernel::TaskClass<decltype(obj)>::type::member>, &obj }
+
 // the Arduino 'loop' function is declared with 'C' linkage, not C++
 
 namespace Kernel {
 
+	//
+	// Handle to a task registered at run time. The task state itself is private
+	// to the task ring.
+
+	typedef class TASKSTATE *	PTASKSTATE;
+	typedef PTASKSTATE			TASKHANDLE;
+
+	///////////////////////////////////////////////////////////////////////////////
+	/// TaskThunk
+	///
+	/// Task handler that calls a member function of the object passed in the
+	/// context. The compiler generates one per class and member function, and
+	/// the member call is inlined into it, so typed tasks cost one extra jump
+	/// over a plain handler and need no casts in application code.
+	///
+	/// @scope:   EXPORTED
+	/// @context: TASK
+	/// @param:   (void *) context - the object
+	/// @return:  none
+	///
+	///////////////////////////////////////////////////////////////////////////////
+
+	template<class T, void (T::*M)(void)>
+	void TaskThunk(void * context)
+	{
+		(static_cast<T *>(context)->*M)();
+	}
+
+	// names the class of an object in KERNEL_TASK_MEMBER
+
+	template<class T>
+	struct TaskClass { typedef T type; };
+
 	class TaskRing {
 
 		private:
 
 			friend void ::loop();		// the kernel needs to access the Loop function
+#ifdef KERNEL_HOST
+			friend class KernelClass;	// host builds: each kernel instance owns one
+#endif
+			friend void CyclicTaskRing(void * context);	// cyclic mode runs the ring from a slot
 
 			// internals
 
@@ -45,6 +139,19 @@ namespace Kernel {
 
 			TaskRing(void);
 
+#ifdef KERNEL_HOST
+			///////////////////////////////////////////////////////////////////////////////
+			/// ~TaskRing
+			///
+			/// DESTRUCTOR, PRIVATE
+			///
+			/// Host builds only: frees the instance's state when its thread ends
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			~TaskRing();
+#endif
+
 			///////////////////////////////////////////////////////////////////////////////
 			/// Loop
 			///
@@ -74,6 +181,23 @@ namespace Kernel {
 
 			static TaskRing& Get(void);
 
+			///////////////////////////////////////////////////////////////////////////////
+			/// Running
+			///
+			/// Return the handler the task ring is currently calling. Used by the
+			/// watchdog to find out which task has blocked. A coroutine's handler
+			/// comes back in the same form, to identify the task by: it is not to be
+			/// called through it.
+			///
+			/// @scope:   EXPORTED
+			/// @context: ANY
+			/// @param:   none
+			/// @return:  PFNTASKHANDLER - the running handler, NULL if none
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			PFNTASKHANDLER Running(void);
+
 
 			///////////////////////////////////////////////////////////////////////////////
 			/// RegisterTaskHandler
@@ -88,10 +212,125 @@ namespace Kernel {
 			/// @context: TASK
 			/// @param:   PFNHANDLER pfnHandler
 			/// @param:   (void *) context
+			/// @return:  TASKHANDLE - handle to the task, NULL if it could not be registered
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			TASKHANDLE RegisterTaskHandler(PFNTASKHANDLER handler, void * context);
+
+			///////////////////////////////////////////////////////////////////////////////
+			/// RegisterTask
+			///
+			/// Register an object as a task. The first form calls obj.Run() at task
+			/// time; the second calls the given member function, so one object can
+			/// provide several tasks. Task state can then live in the object, in static
+			/// storage, rather than in a heap-allocated context structure.
+			///
+			///	static ControlState Control;
+			///	Kernel::OS.TaskManager.RegisterTask(Control);
+			///	Kernel::OS.TaskManager.RegisterTask<ControlState,&ControlState::Fast>(Control);
+			///
+			/// @scope:   EXPORTED
+			/// @context: TASK
+			/// @param:   T& obj - the object. Must stay in place while registered.
+			/// @return:  TASKHANDLE - handle to the task, NULL if it could not be registered
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			template<class T>
+			TASKHANDLE RegisterTask(T& obj) { return RegisterTaskHandler(TaskThunk<T,&T::Run>,&obj); };
+
+			template<class T, void (T::*M)(void)>
+			TASKHANDLE RegisterTask(T& obj) { return RegisterTaskHandler(TaskThunk<T,M>,&obj); };
+
+			///////////////////////////////////////////////////////////////////////////////
+			/// RegisterCoroutine
+			///
+			/// As RegisterTaskHandler, but the handler is a coroutine (see coroutine.h).
+			/// The Coroutine state block is owned by the caller and must stay in place
+			/// for as long as the task is registered - normally it is declared static.
+			/// The kernel will not call the handler while the coroutine is waiting.
+			///
+			/// @scope:   EXPORTED
+			/// @context: TASK
+			/// @param:   PFNCOROUTINE handler
+			/// @param:   Coroutine& co - coroutine state block
+			/// @param:   (void *) context
+			/// @return:  TASKHANDLE - handle to the task, NULL if it could not be registered
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			TASKHANDLE RegisterCoroutine(PFNCOROUTINE handler, Coroutine& co, void * context);
+
+			///////////////////////////////////////////////////////////////////////////////
+			/// RegisterTaskTable
+			///
+			/// Install a static task table. The table is declared at compile time and
+			/// placed in flash (see KERNEL_TASK_TABLE), so it costs no heap and no RAM
+			/// per task. Only one table may be installed; a second call replaces the
+			/// first. Tasks registered with RegisterTaskHandler still run, after the
+			/// table tasks in each round.
+			///
+			/// @scope:   EXPORTED
+			/// @context: TASK
+			/// @param:   const TASKTABLEENTRY * table - table in flash
+			/// @param:   unsigned char size - number of entries
+			/// @return:  zero for success
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			int RegisterTaskTable(const TASKTABLEENTRY * table, unsigned char size);
+
+			template<unsigned char N>
+			int RegisterTaskTable(const TASKTABLEENTRY (&table)[N]) { return RegisterTaskTable(table,N); };
+
+			///////////////////////////////////////////////////////////////////////////////
+			/// Unregister
+			///
+			/// Remove a task, running or suspended, and free its state. The handle is
+			/// invalid afterwards. May be called by the task itself from within its
+			/// handler. Tasks in the static task table can not be unregistered.
+			///
+			/// @scope:   EXPORTED
+			/// @context: TASK
+			/// @param:   TASKHANDLE task
+			/// @return:  zero for success, nonzero if the handle is not a registered task
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			int Unregister(TASKHANDLE task);
+
+			///////////////////////////////////////////////////////////////////////////////
+			/// Suspend
+			///
+			/// Stop a task from being run. The task is moved off the ring altogether so
+			/// it costs nothing in Loop until it is resumed. May be called by the task
+			/// itself from within its handler.
+			/// A coroutine waiting for a message misses any dispatched while it is
+			/// suspended, and goes on waiting once it is resumed.
+			///
+			/// @scope:   EXPORTED
+			/// @context: TASK
+			/// @param:   TASKHANDLE task
+			/// @return:  zero for success, nonzero if the task is not running
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			int Suspend(TASKHANDLE task);
+
+			///////////////////////////////////////////////////////////////////////////////
+			/// Resume
+			///
+			/// Put a suspended task back on the ring. It will be run from the next round.
+			///
+			/// @scope:   EXPORTED
+			/// @context: TASK
+			/// @param:   TASKHANDLE task
+			/// @return:  zero for success, nonzero if the task is not suspended
 			///
 			///////////////////////////////////////////////////////////////////////////////
 
-			int RegisterTaskHandler(PFNTASKHANDLER handler, void * context);
+			int Resume(TASKHANDLE task);
 
 	};
 }
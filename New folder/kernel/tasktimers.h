@@ -1,7 +1,8 @@
 ///////////////////////////////////////////////////////////////////////////////
 /// TASKTIMERS.H
 ///
-/// Convenient task-time (non-interrupt) timer blocks
+/// Convenient task-time (non-interrupt) timer blocks. They read the kernel
+/// pass time (see kerneltime.h).
 ///
 /// Dr J A Gow 2022
 ///
@@ -10,6 +11,8 @@
 #ifndef TASKTIMERS_H_
 #define TASKTIMERS_H_
 
+#include "kerneltime.h"
+
 namespace Kernel {
 
 	//
@@ -39,7 +42,7 @@ namespace Kernel {
 	///
 	/// Resets the timeout value of the timer with the supplied ID
 	///
-	/// @context: ANY
+	/// @context: TASK
 	/// @scope: ANY
 	/// @param: t - unique ID for timer
 	/// @param: tm - timeout value in ms
@@ -48,7 +51,7 @@ namespace Kernel {
 
 	#define SETTIMER(t,tm) \
 	{                      \
-		tmr##t=millis();   \
+		tmr##t=Kernel::Now();   \
 		time##t=tm;        \
 	}
 
@@ -57,21 +60,21 @@ namespace Kernel {
 	///
 	/// Returns true if the specified timer ID has an expired timeout
 	///
-	/// @context: ANY
+	/// @context: TASK
 	/// @scope: ANY
 	/// @param: t- unique ID of timer
 	///
 	///////////////////////////////////////////////////////////////////////////////
 
 	#define ISEXPIRED(t) \
-		((millis()-tmr##t)> time##t)
+		((Kernel::Now()-tmr##t)> time##t)
 
 	///////////////////////////////////////////////////////////////////////////////
 	/// FREEZETIMER
 	///
 	/// 'Freeze' a timer - i.e. stop it counting down at a specific point
 	///
-	/// @context: ANY
+	/// @context: TASK
 	/// @scope: ANY
 	/// @param: t - unique ID of timer
 	///
@@ -79,16 +82,17 @@ namespace Kernel {
 
 	#define FREEZETIMER(t) \
 	{   	                   \
-		freeze##t=millis();\
-		frozen##t=TRUE;    \
+		freeze##t=Kernel::Now();\
+		frozen##t=1;       \
 	}
 
 	//////////////////////////////////////////////////////////////////////////////
 	/// THAWTIMER
 	///
-	/// 'Thaw' a previously frozen timer - i.e. let it resume
+	/// 'Thaw' a previously frozen timer - i.e. let it resume. As
+	/// OSTimer::Thaw, a second thaw does nothing.
 	///
-	/// @context: ANY
+	/// @context: TASK
 	/// @scope: ANY
 	/// @param: t - unique ID of timer to thaw
 	///
@@ -96,7 +100,8 @@ namespace Kernel {
 
 	#define THAWTIMER(t)  \
 	{                     \
-		tmr##t+=(frozen##t)?(millis()-freeze##t):0; \
+		tmr##t+=(frozen##t)?(Kernel::Now()-freeze##t):0; \
+		frozen##t=0;      \
 	}
 
 }
@@ -0,0 +1,120 @@
+///////////////////////////////////////////////////////////////////////////////
+/// timebase.cpp
+///
+/// High-resolution timebase
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "timebase.h"
+
+#ifdef KERNEL_TIMEBASE
+
+#ifdef KERNEL_HOST
+#include "kernel.h"
+#endif
+
+namespace Kernel {
+
+	volatile unsigned long TBOverflows=0;
+
+	////////////////////////////////////////////////////////////////////////
+	/// Get
+	///
+	/// Returns a reference to the singleton class. The class holds no state
+	/// of its own, so host builds share it between kernel instances.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC, STATIC
+	/// @param: none
+	/// @return: TimebaseClass&
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	TimebaseClass& TimebaseClass::Get(void)
+	{
+		static TimebaseClass tb;
+		return tb;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Start
+	///
+	/// Start Timer1 free running (normal mode, WGM=0) at clk/8 with the
+	/// overflow interrupt enabled
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void TimebaseClass::Start(void)
+	{
+#ifndef KERNEL_HOST
+		unsigned char sreg=SREG;
+		cli();
+		TCCR1A=0;
+		TCCR1B=(1<<CS11);					// clk/8
+		TCNT1=0;
+		TBOverflows=0;
+		TIFR1=(1<<TOV1);
+		TIMSK1=(1<<TOIE1);
+		SREG=sreg;
+#endif
+	}
+
+#ifdef KERNEL_HOST
+
+	////////////////////////////////////////////////////////////////////////
+	/// NowFromISR, Now, Now64
+	///
+	/// Host builds: ticks derived from the calling thread's virtual clock
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: ticks of 0.5us
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned long TimebaseClass::NowFromISR(void)
+	{
+		return (unsigned long)Now64();
+	}
+
+	unsigned long TimebaseClass::Now(void)
+	{
+		return (unsigned long)Now64();
+	}
+
+	unsigned long long TimebaseClass::Now64(void)
+	{
+		return (unsigned long long)OS.Clock*TB_TICKS_PER_US;
+	}
+
+#endif
+}
+
+#ifndef KERNEL_HOST
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR(TIMER1_OVF_vect)
+///
+/// Interrupt Service Routine: extend the Timer1 count
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(TIMER1_OVF_vect)
+{
+	Kernel::TBOverflows++;
+}
+
+#endif
+
+#endif
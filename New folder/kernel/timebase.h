@@ -0,0 +1,180 @@
+///////////////////////////////////////////////////////////////////////////////
+/// timebase.h
+///
+/// High-resolution timebase
+///
+/// Timer1 runs free at clk/8, giving 0.5us ticks at 16MHz. The hardware count
+/// is extended in software by counting Timer1 overflows (one every 32.768ms),
+/// giving a 32-bit tick count that wraps every 35.8 minutes and a 48-bit one
+/// that in practice never does. The figures here are for 16MHz; F_CPU may be
+/// any multiple of 8MHz, so that a microsecond is a whole number of ticks.
+///
+/// Reads are short and inline. From an ISR, where interrupts are already off,
+/// NowFromISR is a 16-bit register read, a 16-bit load and an overflow-flag
+/// check. From task context Now does the same with interrupts briefly off.
+///
+/// Enabled by defining KERNEL_TIMEBASE in kernelcfg.h. The kernel starts the
+/// timebase before UserInit. This claims Timer1, so the Servo library and PWM
+/// on pins 9 and 10 are not available.
+///
+/// Intervals are measured with unsigned subtraction, which is wrap-safe for
+/// intervals up to the 35.8 minute wrap:
+///
+///	unsigned long start=Kernel::OS.Timebase.Now();
+///	...
+///	unsigned long us=TB_TICKS_TO_US(Kernel::OS.Timebase.Now()-start);
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TIMEBASE_H_
+#define _TIMEBASE_H_
+
+#include "sysincs.h"
+
+#ifdef KERNEL_TIMEBASE
+
+#if F_CPU<8000000UL || F_CPU%8000000UL
+#error "KERNEL_TIMEBASE counts whole ticks per us at clk/8: F_CPU must be a multiple of 8MHz"
+#endif
+
+#define TB_TICKS_PER_US			(F_CPU/8000000UL)	// clk/8: 2 at 16MHz
+#define TB_US_TO_TICKS(us)		((unsigned long)(us)*TB_TICKS_PER_US)
+#define TB_TICKS_TO_US(t)		((t)/TB_TICKS_PER_US)
+
+namespace Kernel {
+
+	// Timer1 overflow count: the upper bits of the timebase. Maintained by
+	// the overflow interrupt; use the TimebaseClass functions to read it.
+
+	extern volatile unsigned long TBOverflows;
+
+	class TimebaseClass {
+
+		private:
+
+			friend void ::setup();		// the kernel starts the timebase
+
+			////////////////////////////////////////////////////////////////////////
+			/// TimebaseClass
+			///
+			/// CONSTRUCTOR, PRIVATE
+			///
+			/// Nothing counts until Start is called
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			TimebaseClass(void) {};
+
+			////////////////////////////////////////////////////////////////////////
+			/// Start
+			///
+			/// Start Timer1 free running at clk/8 with the overflow interrupt
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Start(void);
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// Get
+			///
+			/// Returns a reference to the singleton class.
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC, STATIC
+			/// @param: none
+			/// @return: TimebaseClass&
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			static TimebaseClass& Get(void);
+
+#ifdef KERNEL_HOST
+			unsigned long NowFromISR(void);
+			unsigned long Now(void);
+			unsigned long long Now64(void);
+#else
+			////////////////////////////////////////////////////////////////////////
+			/// NowFromISR
+			///
+			/// Return the 32-bit tick count with interrupts already off. If the
+			/// counter has overflowed but the overflow interrupt has not yet run,
+			/// the pending overflow is counted here. A low count read alongside a
+			/// pending overflow must have been read after the overflow.
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned long - ticks of 0.5us
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned long NowFromISR(void)
+			{
+				unsigned int count=TCNT1;
+				unsigned int high=(unsigned int)TBOverflows;
+				if((TIFR1&(1<<TOV1)) && count<0x8000) {
+					high++;
+				}
+				return ((unsigned long)high<<16)|count;
+			};
+
+			////////////////////////////////////////////////////////////////////////
+			/// Now
+			///
+			/// Return the 32-bit tick count from task context
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned long - ticks of 0.5us
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned long Now(void)
+			{
+				unsigned char sreg=SREG;
+				cli();
+				unsigned long now=NowFromISR();
+				SREG=sreg;
+				return now;
+			};
+
+			////////////////////////////////////////////////////////////////////////
+			/// Now64
+			///
+			/// Return the full 48-bit tick count, for timestamps that must not
+			/// wrap
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned long long - ticks of 0.5us
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned long long Now64(void)
+			{
+				unsigned char sreg=SREG;
+				cli();
+				unsigned int count=TCNT1;
+				unsigned long high=TBOverflows;
+				if((TIFR1&(1<<TOV1)) && count<0x8000) {
+					high++;
+				}
+				SREG=sreg;
+				return ((unsigned long long)high<<16)|count;
+			};
+#endif
+	};
+}
+
+#endif
+
+#endif
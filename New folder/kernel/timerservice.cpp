@@ -0,0 +1,284 @@
+///////////////////////////////////////////////////////////////////////////////
+/// timerservice.cpp
+///
+/// Central timer service
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "timerservice.h"
+#include "mq.h"
+#include "kerneltime.h"
+#ifdef KERNEL_HOST
+#include "kernel.h"
+#endif
+
+namespace Kernel {
+
+	#define TMR_WHEEL_MASK		(TMR_WHEEL_SLOTS-1)
+
+	// Timer service internals
+
+	class TIMERINTERNALS {
+		public:
+			EventTimer *	wheel[TMR_WHEEL_SLOTS];
+			unsigned long	last;			// last tick processed
+			TIMERINTERNALS() : last(millis()) {
+				for(int idx=0;idx<TMR_WHEEL_SLOTS;idx++) {
+					wheel[idx]=NULL;
+				}
+			};
+	};
+
+	////////////////////////////////////////////////////////////////////////
+	/// EventTimer
+	///
+	/// CONSTRUCTORS
+	///
+	/// A timer that calls a function, or posts a message, on expiry. The
+	/// timer is not armed.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	EventTimer::EventTimer(PFNTIMERCALLBACK callback, void * context) :
+		pNext(NULL),ppPrev(NULL),expires(0),period(0),callback(callback),context(context),msgid(MSG_ID_NOMESSAGE)
+	{
+	}
+
+	EventTimer::EventTimer(int msgid, void * context) :
+		pNext(NULL),ppPrev(NULL),expires(0),period(0),callback(NULL),context(context),msgid(msgid)
+	{
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Start
+	///
+	/// Arm as a one-shot timer. If already armed, it is re-armed.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned long ms - time to expiry
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void EventTimer::Start(unsigned long ms)
+	{
+		TimerService& svc=TimerService::Get();
+		svc.Disarm(this);
+		period=0;
+		expires=Now()+ms;
+		svc.Arm(this);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// StartPeriodic
+	///
+	/// Arm as a periodic timer. The first expiry is one period from now.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned long period - interval in ms. Must be nonzero.
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void EventTimer::StartPeriodic(unsigned long interval)
+	{
+		TimerService& svc=TimerService::Get();
+		svc.Disarm(this);
+		period=interval;
+		expires=Now()+interval;
+		svc.Arm(this);
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Cancel
+	///
+	/// Disarm the timer
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void EventTimer::Cancel(void)
+	{
+		TimerService::Get().Disarm(this);
+		period=0;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// TimerService
+	///
+	/// CONSTRUCTOR, PRIVATE
+	///
+	/// Initialize an empty wheel
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	TimerService::TimerService(void)
+	{
+		internals=new TIMERINTERNALS;
+	}
+
+#ifdef KERNEL_HOST
+
+	////////////////////////////////////////////////////////////////////////
+	/// ~TimerService
+	///
+	/// DESTRUCTOR
+	///
+	/// Host builds only. The timers belong to their owners; only the wheel
+	/// is freed.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	TimerService::~TimerService()
+	{
+		delete (TIMERINTERNALS *)internals;
+	}
+
+#endif
+
+	////////////////////////////////////////////////////////////////////////
+	/// Get
+	///
+	/// Returns a reference to the singleton class. Host builds have one
+	/// instance per kernel, and return the calling thread's.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC, STATIC
+	/// @param: none
+	/// @return: TimerService&
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	TimerService& TimerService::Get(void)
+	{
+#ifdef KERNEL_HOST
+		return OS.Timers;		// each host kernel instance owns its own
+#else
+		static TimerService svc;
+		return svc;
+#endif
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Arm
+	///
+	/// Insert a timer into the slot for its expiry time, keeping the slot
+	/// sorted so that only its head ever needs to be checked. A timer due
+	/// at or before a tick that has already been processed goes in at the
+	/// next tick, so it is not held over for a whole turn of the wheel.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: EventTimer * timer
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void TimerService::Arm(EventTimer * timer)
+	{
+		TIMERINTERNALS * internal=(TIMERINTERNALS *)internals;
+
+		if((long)(timer->expires-internal->last)<=0) {
+			timer->expires=internal->last+1;
+		}
+
+		EventTimer ** ppLink=&internal->wheel[timer->expires&TMR_WHEEL_MASK];
+		while(*ppLink && (long)((*ppLink)->expires-timer->expires)<=0) {
+			ppLink=&(*ppLink)->pNext;
+		}
+		timer->pNext=*ppLink;
+		timer->ppPrev=ppLink;
+		if(*ppLink) {
+			(*ppLink)->ppPrev=&timer->pNext;
+		}
+		*ppLink=timer;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Disarm
+	///
+	/// Remove a timer from the wheel, if it is armed
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: EventTimer * timer
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void TimerService::Disarm(EventTimer * timer)
+	{
+		if(timer->ppPrev) {
+			*timer->ppPrev=timer->pNext;
+			if(timer->pNext) {
+				timer->pNext->ppPrev=timer->ppPrev;
+			}
+			timer->pNext=NULL;
+			timer->ppPrev=NULL;
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Run
+	///
+	/// Process each tick since the last pass in turn. For each, fire the
+	/// timers at the head of its slot that are due; the rest of the slot
+	/// is sorted, so the first one not yet due ends the check. Periodic
+	/// timers are re-armed before their callback runs, so the callback may
+	/// cancel or restart them.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void TimerService::Run(void)
+	{
+		TIMERINTERNALS * internal=(TIMERINTERNALS *)internals;
+		unsigned long now=Kernel::Now();
+
+		while(internal->last!=now) {
+			unsigned long tick=++internal->last;
+			EventTimer ** ppSlot=&internal->wheel[tick&TMR_WHEEL_MASK];
+			EventTimer * timer;
+
+			while((timer=*ppSlot)!=NULL && (long)(timer->expires-tick)<=0) {
+				Disarm(timer);
+				if(timer->period) {
+					timer->expires+=timer->period;
+					Arm(timer);
+				}
+				if(timer->callback) {
+					timer->callback(timer->context);
+				} else {
+					MQClass::Get().Post(timer->msgid,timer->context,MQ_OWNER_CALLER,MQ_CONTEXT_TASK);
+				}
+			}
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Now
+	///
+	/// The time the service has reached
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: unsigned long - time in ms
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned long TimerService::Now(void)
+	{
+		return ((TIMERINTERNALS *)internals)->last;
+	}
+}
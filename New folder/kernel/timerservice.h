@@ -0,0 +1,247 @@
+///////////////////////////////////////////////////////////////////////////////
+/// timerservice.h
+///
+/// Central timer service
+///
+/// Armed timers are kept in a hashed timing wheel: TMR_WHEEL_SLOTS lists,
+/// one per millisecond modulo the wheel size, each sorted by expiry time. The
+/// kernel samples millis() once per pass (see kerneltime.h) and, for each millisecond that has
+/// gone by, looks only at the head of that millisecond's list, so checking
+/// for due timers costs the same however many timers are armed. Arming a
+/// timer walks one list, which holds on average 1/TMR_WHEEL_SLOTS of them.
+///
+/// On expiry a timer either calls a function or posts a message. Timers can
+/// be one-shot or periodic, and can be cancelled at any time. A periodic
+/// timer is re-armed from its previous expiry, not from when it was serviced,
+/// so it does not drift.
+///
+/// Timers are owned by the caller, normally as static objects, so arming one
+/// allocates nothing. Use them from task context only.
+///
+///	static Kernel::EventTimer Blink(BlinkLED,NULL);				// calls BlinkLED(NULL)
+///	static Kernel::EventTimer Sample(MSG_ID_SAMPLE,NULL);		// posts MSG_ID_SAMPLE
+///
+///	Blink.StartPeriodic(500);
+///	Sample.Start(20);
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _TIMERSERVICE_H_
+#define _TIMERSERVICE_H_
+
+#include "sysincs.h"
+
+namespace Kernel {
+
+	#define TMR_WHEEL_SLOTS		16		// must be a power of two
+
+	//
+	// Prototype of a timer expiry callback
+
+	typedef void (* PFNTIMERCALLBACK)(void * context);
+
+	//
+	// A timer. 17 bytes.
+
+	class EventTimer {
+
+		private:
+
+			friend class TimerService;
+
+			EventTimer *		pNext;		// next in the wheel slot
+			EventTimer **		ppPrev;		// link that points at us, NULL if not armed
+			unsigned long		expires;	// kernel time at expiry
+			unsigned long		period;		// re-arm interval, 0 for one-shot
+			PFNTIMERCALLBACK	callback;	// NULL to post a message instead
+			void *				context;
+			signed char			msgid;
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// EventTimer
+			///
+			/// CONSTRUCTOR
+			///
+			/// A timer that calls a function on expiry
+			///
+			/// @param: PFNTIMERCALLBACK callback - called at task time
+			/// @param: void * context - passed to the callback
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			EventTimer(PFNTIMERCALLBACK callback, void * context);
+
+			////////////////////////////////////////////////////////////////////////
+			/// EventTimer
+			///
+			/// CONSTRUCTOR
+			///
+			/// A timer that posts a message on expiry, with MQ_OWNER_CALLER
+			///
+			/// @param: int msgid - message to post
+			/// @param: void * context - message context
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			EventTimer(int msgid, void * context);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Start
+			///
+			/// Arm as a one-shot timer. If already armed, it is re-armed.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned long ms - time to expiry
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Start(unsigned long ms);
+
+			////////////////////////////////////////////////////////////////////////
+			/// StartPeriodic
+			///
+			/// Arm as a periodic timer. The first expiry is one period from now.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned long period - interval in ms. Must be nonzero.
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void StartPeriodic(unsigned long period);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Cancel
+			///
+			/// Disarm the timer. Does nothing if it is not armed. May be called
+			/// from the timer's own callback to stop a periodic timer.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Cancel(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// isArmed
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: int. Nonzero if the timer will fire
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int isArmed(void) { return ppPrev!=NULL; };
+	};
+
+	class TimerService {
+
+		private:
+
+			friend void ::loop();		// the kernel needs to access the Run function
+			friend class EventTimer;	// timers arm and disarm themselves
+#ifdef KERNEL_HOST
+			friend class KernelClass;	// host builds: each kernel instance owns one
+#endif
+
+			// internals
+
+			void *	internals;
+
+			////////////////////////////////////////////////////////////////////////
+			/// TimerService
+			///
+			/// CONSTRUCTOR, PRIVATE
+			///
+			/// Initialize an empty wheel
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			TimerService(void);
+
+#ifdef KERNEL_HOST
+			////////////////////////////////////////////////////////////////////////
+			/// ~TimerService
+			///
+			/// DESTRUCTOR, PRIVATE
+			///
+			/// Host builds only: frees the wheel when the instance's thread ends
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			~TimerService();
+#endif
+
+			////////////////////////////////////////////////////////////////////////
+			/// Run
+			///
+			/// Called by the kernel once per pass. Fires every timer that has
+			/// become due since the last pass.
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Run(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Arm, Disarm
+			///
+			/// Insert a timer into, or remove it from, the wheel
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: EventTimer * timer
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Arm(EventTimer * timer);
+			void Disarm(EventTimer * timer);
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// Get
+			///
+			/// Returns a reference to the singleton class.
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC, STATIC
+			/// @param: none
+			/// @return: TimerService&
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			static TimerService& Get(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Now
+			///
+			/// The time the service has reached: the millis() value of the last
+			/// tick it processed
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned long - time in ms
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned long Now(void);
+	};
+}
+
+#endif
@@ -0,0 +1,356 @@
+///////////////////////////////////////////////////////////////////////////////
+/// watchdog.cpp
+///
+/// Per-task software watchdog backed by the AVR hardware watchdog
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "watchdog.h"
+#ifdef KERNEL_HOST
+#include "kernel.h"
+#endif
+
+namespace Kernel {
+
+	#define WDT_FLAG_USED		0x01
+	#define WDT_FLAG_CRITICAL	0x02
+	#define WDT_MAGIC			0x5744
+
+	// One slot per supervised task
+
+	class WDTSLOT {
+		public:
+			unsigned long	checkin;		// millis() at last check-in
+			unsigned int	timeout;		// ms allowed between check-ins
+			unsigned char	flags;
+	};
+
+	// Supervisor internals
+
+	class WDTINTERNALS {
+		public:
+			WDTSLOT			slots[WDT_MAX_TASKS];
+			PFNFAILSAFE		failsafe;
+			signed char		overdue;		// overdue task seen by the supervisor
+			unsigned char	started;
+			volatile unsigned char expired;	// the watchdog interrupt has fired
+			WDTINTERNALS() : failsafe(NULL),overdue(WDT_NOTASK),started(0),expired(0) {
+				for(int idx=0;idx<WDT_MAX_TASKS;idx++) {
+					slots[idx].flags=0;
+				}
+			};
+	};
+
+	// The failure record lives in uninitialized RAM, so the C runtime does not
+	// clear it when the processor restarts after the watchdog reset.
+
+#ifdef KERNEL_HOST
+	static KERNEL_INSTANCE WDTFAILURE WDTLastFailure;
+#else
+	static WDTFAILURE WDTLastFailure __attribute__((section(".noinit")));
+#endif
+
+	// The reset cause flags, saved before startup clears MCUSR. Saved ahead of
+	// the C runtime clearing .bss, so this too lives in uninitialized RAM.
+
+#ifdef KERNEL_HOST
+	static KERNEL_INSTANCE unsigned char WDTResetFlags;
+#else
+	static unsigned char WDTResetFlags __attribute__((section(".noinit")));
+
+	////////////////////////////////////////////////////////////////////////
+	/// WDTEarlyInit
+	///
+	/// Run by the C runtime's startup code from .init3, before the
+	/// constructors and setup(). A watchdog reset leaves WDRF set and the
+	/// watchdog running at 15ms, and it can not be turned off while WDRF is
+	/// set: save MCUSR, clear it, and stop the watchdog.
+	///
+	/// @context: STARTUP
+	/// @scope: INTERNAL
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	static void WDTEarlyInit(void) __attribute__((naked,used,section(".init3")));
+
+	static void WDTEarlyInit(void)
+	{
+		WDTResetFlags=MCUSR;
+		MCUSR=0;
+		wdt_disable();
+	}
+#endif
+
+	// the instance's internals, needed by the interrupt
+
+	static KERNEL_INSTANCE WDTINTERNALS * pWDTInternals=NULL;
+
+	////////////////////////////////////////////////////////////////////////
+	/// WDTClass
+	///
+	/// CONSTRUCTOR, PRIVATE
+	///
+	/// Initialize the supervisor. The hardware watchdog is not enabled
+	/// until Start is called.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	WDTClass::WDTClass(void)
+	{
+#ifdef KERNEL_HOST
+		// no startup code here: each instance does it as it starts
+		WDTResetFlags=MCUSR;
+		MCUSR=0;
+		wdt_disable();
+#endif
+		pWDTInternals=new WDTINTERNALS;
+	}
+
+#ifdef KERNEL_HOST
+
+	////////////////////////////////////////////////////////////////////////
+	/// ~WDTClass
+	///
+	/// DESTRUCTOR
+	///
+	/// Host builds only. Free the supervisor state.
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	WDTClass::~WDTClass()
+	{
+		delete pWDTInternals;
+		pWDTInternals=NULL;
+	}
+
+#endif
+
+	////////////////////////////////////////////////////////////////////////
+	/// Get
+	///
+	/// Returns a reference to the singleton class.
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC, STATIC
+	/// @param: none
+	/// @return: WDTClass&
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	WDTClass& WDTClass::Get(void)
+	{
+#ifdef KERNEL_HOST
+		return OS.Watchdog;		// each host kernel instance owns its own
+#else
+		static WDTClass wdt;
+		return wdt;
+#endif
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Register
+	///
+	/// Register a task with the supervisor. The task must then call
+	/// CheckIn at least once every 'timeout' milliseconds.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned int timeout - maximum interval between check-ins, ms
+	/// @param: unsigned char critical - nonzero if the task is critical
+	/// @return: int. Watchdog ID for CheckIn, or -1 if no slots are free
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int WDTClass::Register(unsigned int timeout, unsigned char critical)
+	{
+		for(int idx=0;idx<WDT_MAX_TASKS;idx++) {
+			WDTSLOT * pSlot=&pWDTInternals->slots[idx];
+			if(!(pSlot->flags&WDT_FLAG_USED)) {
+				pSlot->checkin=millis();
+				pSlot->timeout=timeout;
+				pSlot->flags=WDT_FLAG_USED|(critical?WDT_FLAG_CRITICAL:0);
+				return idx;
+			}
+		}
+		return -1;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// CheckIn
+	///
+	/// Tell the supervisor that the task is healthy
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: int id - watchdog ID returned by Register
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void WDTClass::CheckIn(int id)
+	{
+		if(id>=0 && id<WDT_MAX_TASKS) {
+			pWDTInternals->slots[id].checkin=millis();
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Start
+	///
+	/// Enable the hardware watchdog in interrupt-then-reset mode. The
+	/// first timeout raises WDT_vect (which clears WDIE); the second
+	/// resets the processor.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: unsigned char period - WDTO_xx value from avr/wdt.h
+	/// @param: PFNFAILSAFE failsafe - called from the watchdog interrupt. May
+	///         be NULL.
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void WDTClass::Start(unsigned char period, PFNFAILSAFE failsafe)
+	{
+		pWDTInternals->failsafe=failsafe;
+
+		// WDP3 is not contiguous with WDP2..0
+
+		unsigned char prescale=(period&0x07)|((period&0x08)?(1<<WDP3):0);
+
+		unsigned char sreg=SREG;
+		cli();
+		wdt_reset();
+		WDTCSR=(1<<WDCE)|(1<<WDE);					// timed sequence: 4 cycles to change
+		WDTCSR=(1<<WDIE)|(1<<WDE)|prescale;
+		SREG=sreg;
+
+		pWDTInternals->started=1;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Supervise
+	///
+	/// Called by the kernel once per pass. Feeds the hardware watchdog if
+	/// every critical task has checked in within its timeout. Once a task
+	/// is found overdue, or the interrupt has fired, we never feed it again
+	/// and the reset goes ahead.
+	///
+	/// @context: TASK
+	/// @scope: PRIVATE
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void WDTClass::Supervise(void)
+	{
+		if(!pWDTInternals->started || pWDTInternals->expired || pWDTInternals->overdue!=WDT_NOTASK) {
+			return;
+		}
+		unsigned long now=millis();
+		for(int idx=0;idx<WDT_MAX_TASKS;idx++) {
+			WDTSLOT * pSlot=&pWDTInternals->slots[idx];
+			if((pSlot->flags&WDT_FLAG_CRITICAL) && (now-pSlot->checkin)>pSlot->timeout) {
+				pWDTInternals->overdue=idx;
+				return;
+			}
+		}
+		wdt_reset();
+		WDTCSR|=(1<<WDIE);			// re-arm the interrupt stage
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// Expire
+	///
+	/// Called from the watchdog interrupt to record the failure and call
+	/// the failsafe handler. If the supervisor did not see an overdue task
+	/// the kernel loop itself must have stopped, so we note which task was
+	/// running at the time.
+	///
+	/// @context: INTERRUPT
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: none
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	void WDTClass::Expire(void)
+	{
+		pWDTInternals->expired=1;
+
+		WDTLastFailure.task=pWDTInternals->overdue;
+		WDTLastFailure.reason=(pWDTInternals->overdue!=WDT_NOTASK)?WDT_REASON_OVERDUE:WDT_REASON_BLOCKED;
+		WDTLastFailure.running=TaskRing::Get().Running();
+		WDTLastFailure.when=millis();
+		WDTLastFailure.magic=WDT_MAGIC;
+
+		if(pWDTInternals->failsafe) {
+			pWDTInternals->failsafe();
+		}
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// ResetFlags
+	///
+	/// Return the reset cause flags as they were when the processor started
+	///
+	/// @context: ANY
+	/// @scope: PUBLIC
+	/// @param: none
+	/// @return: unsigned char. MCUSR
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	unsigned char WDTClass::ResetFlags(void)
+	{
+		return WDTResetFlags;
+	}
+
+	////////////////////////////////////////////////////////////////////////
+	/// GetLastFailure
+	///
+	/// Retrieve the record of the failure that caused the last watchdog
+	/// reset, and clear it.
+	///
+	/// @context: TASK
+	/// @scope: PUBLIC
+	/// @param: WDTFAILURE * failure - filled in if there is a record
+	/// @return: int. Zero if a failure was recorded, nonzero if not
+	///
+	////////////////////////////////////////////////////////////////////////
+
+	int WDTClass::GetLastFailure(WDTFAILURE * failure)
+	{
+		int rc=-1;
+		if(WDTLastFailure.magic==WDT_MAGIC) {
+			if(failure) {
+				*failure=WDTLastFailure;
+				failure->resetflags=WDTResetFlags;
+			}
+			WDTLastFailure.magic=0;
+			rc=0;
+		}
+		return rc;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR(WDT_vect)
+///
+/// Interrupt Service Routine: first stage of the hardware watchdog. The reset
+/// follows one watchdog period later.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(WDT_vect)
+{
+	Kernel::WDTClass::Get().Expire();
+}
@@ -0,0 +1,225 @@
+///////////////////////////////////////////////////////////////////////////////
+/// watchdog.h
+///
+/// Per-task software watchdog backed by the AVR hardware watchdog
+///
+/// Tasks that must keep running register with the supervisor and check in
+/// periodically. Once per pass of the kernel loop the supervisor checks that
+/// every critical task has checked in within its timeout, and only then feeds
+/// the hardware watchdog. If a task blocks (so the kernel loop stops) or a
+/// critical task stops checking in, the hardware watchdog first raises its
+/// interrupt - where the failure is recorded and the optional failsafe
+/// handler is called - and then resets the processor.
+///
+/// The failure record is kept in uninitialized RAM so it survives the reset,
+/// and can be read back with GetLastFailure in UserInit.
+///
+/// After a watchdog reset the hardware watchdog is still running, at its
+/// shortest period, until WDRF in MCUSR is cleared. Early in startup, before
+/// any constructor or setup() runs, MCUSR is saved for ResetFlags and the
+/// failure record, then cleared, and the watchdog turned off, so a board
+/// without a bootloader that does this does not reset again and again.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef _WATCHDOG_H_
+#define _WATCHDOG_H_
+
+#include "sysincs.h"
+#include "taskring.h"
+#include <avr/wdt.h>
+
+namespace Kernel {
+
+	#define WDT_MAX_TASKS			8		// number of tasks that may check in
+	#define WDT_NOTASK				-1		// no registered task was overdue
+
+	//
+	// Why the hardware watchdog was allowed to expire
+
+	typedef enum _WDTREASON {
+		WDT_REASON_NONE,
+		WDT_REASON_OVERDUE,			// a critical task stopped checking in
+		WDT_REASON_BLOCKED			// the kernel loop stopped running
+	} WDTREASON;
+
+	//
+	// Failure record. Survives the watchdog reset.
+
+	typedef struct _WDTFAILURE {
+		unsigned int		magic;		// internal: marks the record as valid
+		signed char			task;		// watchdog ID of the overdue task, or WDT_NOTASK
+		unsigned char		reason;		// WDTREASON
+		PFNTASKHANDLER		running;	// task handler running when the watchdog fired
+		unsigned long		when;		// millis() when the watchdog fired
+		unsigned char		resetflags;	// MCUSR at the restart that followed
+	} WDTFAILURE;
+
+	//
+	// Prototype of the failsafe handler, called from the watchdog interrupt
+
+	typedef void (* PFNFAILSAFE)(void);
+
+	class WDTClass {
+
+		private:
+
+			friend void ::loop();		// the kernel needs to access the Supervise function
+#ifdef KERNEL_HOST
+			friend class KernelClass;	// host builds: each kernel instance owns one
+#endif
+
+			////////////////////////////////////////////////////////////////////////
+			/// WDTClass
+			///
+			/// CONSTRUCTOR, PRIVATE
+			///
+			/// Initialize the supervisor. The hardware watchdog is not enabled
+			/// until Start is called.
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			WDTClass(void);
+
+#ifdef KERNEL_HOST
+			///////////////////////////////////////////////////////////////////////////////
+			/// ~WDTClass
+			///
+			/// DESTRUCTOR, PRIVATE
+			///
+			/// Host builds only: frees the instance's state when its thread ends
+			///
+			///////////////////////////////////////////////////////////////////////////////
+
+			~WDTClass();
+#endif
+
+			////////////////////////////////////////////////////////////////////////
+			/// Supervise
+			///
+			/// Called by the kernel once per pass. Feeds the hardware watchdog if
+			/// every critical task is healthy.
+			///
+			/// @context: TASK
+			/// @scope: PRIVATE
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Supervise(void);
+
+		public:
+
+			////////////////////////////////////////////////////////////////////////
+			/// Get
+			///
+			/// Returns a reference to the singleton class.
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC, STATIC
+			/// @param: none
+			/// @return: WDTClass&
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			static WDTClass& Get(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Register
+			///
+			/// Register a task with the supervisor. The task must then call
+			/// CheckIn at least once every 'timeout' milliseconds. Only critical
+			/// tasks stop the hardware watchdog being fed.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned int timeout - maximum interval between check-ins, ms
+			/// @param: unsigned char critical - nonzero if the task is critical
+			/// @return: int. Watchdog ID for CheckIn, or -1 if no slots are free
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int Register(unsigned int timeout, unsigned char critical);
+
+			////////////////////////////////////////////////////////////////////////
+			/// CheckIn
+			///
+			/// Tell the supervisor that the task is healthy
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: int id - watchdog ID returned by Register
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void CheckIn(int id);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Start
+			///
+			/// Enable the hardware watchdog in interrupt-then-reset mode. Once
+			/// started it can not be stopped. The processor is reset between one
+			/// and two periods after the supervisor last fed the watchdog.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: unsigned char period - WDTO_xx value from avr/wdt.h
+			/// @param: PFNFAILSAFE failsafe - called from the watchdog interrupt
+			///         to put the hardware in a safe state. May be NULL.
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Start(unsigned char period, PFNFAILSAFE failsafe);
+
+			////////////////////////////////////////////////////////////////////////
+			/// GetLastFailure
+			///
+			/// Retrieve the record of the failure that caused the last watchdog
+			/// reset, and clear it.
+			///
+			/// @context: TASK
+			/// @scope: PUBLIC
+			/// @param: WDTFAILURE * failure - filled in if there is a record
+			/// @return: int. Zero if a failure was recorded, nonzero if not
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			int GetLastFailure(WDTFAILURE * failure);
+
+			////////////////////////////////////////////////////////////////////////
+			/// ResetFlags
+			///
+			/// Return the reset cause flags (MCUSR) as they were when the
+			/// processor started. A bootloader that clears MCUSR itself, such
+			/// as optiboot, leaves them zero.
+			///
+			/// @context: ANY
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: unsigned char. MCUSR: WDRF, BORF, EXTRF, PORF
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			unsigned char ResetFlags(void);
+
+			////////////////////////////////////////////////////////////////////////
+			/// Expire
+			///
+			/// Called from the watchdog interrupt to record the failure and call
+			/// the failsafe handler. Not for application use.
+			///
+			/// @context: INTERRUPT
+			/// @scope: PUBLIC
+			/// @param: none
+			/// @return: none
+			///
+			////////////////////////////////////////////////////////////////////////
+
+			void Expire(void);
+	};
+}
+
+#endif
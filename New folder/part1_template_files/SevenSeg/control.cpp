@@ -10,19 +10,18 @@
 #include "kernel.h"
 #include "common.h" // we need the message ID.
 
-typedef struct _TIMERSTRUCT
-{
-	Kernel::OSTimer *	LEDTimer;
-	Kernel::OSTimer *	SevenSegTimer;
-} TIMERSTRUCT;
-
-typedef TIMERSTRUCT * PTIMERSTRUCT;
+// Task state. The timers live in a static object rather than on the heap,
+// and the task ring calls its Run function directly (see RegisterTask).
 
+class ControlState {
+	public:
+		Kernel::Timer<unsigned int>	LEDTimer;
+		Kernel::Timer<unsigned int>	SevenSegTimer;
+		void Run(void);			// the control task
+};
 
-// Prototype the control task function here as it does not need to be
-// seen outside this module
+static ControlState Control;
 
-void ControlTask(void * context);
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CONTROLInitialize
@@ -36,50 +35,33 @@ void ControlTask(void * context);
 
 void CONTROLInitialize(void)
 {
-	// 1) Each test code block needs its own timer. We thus create a structure
-	//    containing pointers to two timer objects. Then we create two new
-	//    non-blocking timer objects and assign them to the pointers in the structure
-	//    This allows us to pass a single pointer to the task handler.
-	//
-	//    This is not the only way of achieving this. We could use static
-	//    or module-global variables. The memory burden is the same.
-	//    We need the timer objects to enable the delay between messages sent
-	//    to the LED driver We declare this pointer as static
-	//    as we need it to stay in place once this function exits.
-	//
-	//    We only want to do this once.
-	//
-	//    We should really check the pointers to see if they were allocated
-	//    successfully by the OS.
+	// 1) Each test code block needs its own timer. The timers are members of the
+	//    static Control object, so they exist from startup and need no allocation
+	//    (and there are no pointers to check). We just start them here.
 
-	PTIMERSTRUCT taskcontext=new TIMERSTRUCT;
-	taskcontext->LEDTimer=new Kernel::OSTimer(750);	// times out in 750ms
-	taskcontext->SevenSegTimer=new Kernel::OSTimer(300); // times out in 300ms
+	Control.LEDTimer.Set(750);			// times out in 750ms
+	Control.SevenSegTimer.Set(300);		// times out in 300ms
 
 	//
-	// 2) Register our repetitive task. We pass the user parameter 'context' as a
-	//    pointer to our timer structure. Note that the task handler now takes 'ownership'
-	//    of the timer pointer structure. If it required to release the memory associated with it,
-	//    this would take place here. However, this task is running until someone turns the power
-	//    off, so we don't have to worry here about freeing memory. As the pointer is generic, we use
-	//    casting in our ControlTask function to recover the timer object.
+	// 2) Register our repetitive task. The task ring calls Control.Run() each time
+	//    round, so the task works on its own members directly: there is no context
+	//    pointer to cast, and nothing was allocated that would need to be freed.
 
-	Kernel::OS.TaskManager.RegisterTaskHandler(ControlTask,(void *)taskcontext);
+	Kernel::OS.TaskManager.RegisterTask(Control);
 
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// ControlTask
+/// ControlState::Run
 ///
 /// This is our main control task. It must not block, as the system as a whole
 /// is single-tasked.
 ///
-/// It is passed the timer in the context variable. We could use a module global
-/// here, but this is just to demonstrate one use of the context variable
+/// The timers it uses are members of the Control object it is called on.
 ///
 //////////////////////////////////////////////////////////////////////////////
 
-void ControlTask(void * context)
+void ControlState::Run(void)
 {
 	// Code in this task function CAN NOT BLOCK. If it blocks, it will grab the
 	// CPU and other tasks will not be able to run.
@@ -88,9 +70,7 @@ void ControlTask(void * context)
 
 	static int ledstate=0;	// declared static as we want to preserve its value across calls
 
-	PTIMERSTRUCT	timers = static_cast<PTIMERSTRUCT>(context);
-
-	if(timers->LEDTimer->isExpired()) {
+	if(LEDTimer.isExpired()) {
 
 		// CODE FOR TESTING THE SUBSYSTEMS. YOU MAY WELL NEED TO CHANGE THIS IN YOUR FINAL DESIGN
 		//-----------------------------------------------------------------------------------------
@@ -101,7 +81,7 @@ void ControlTask(void * context)
 		// timer at all.
 
 		// It simply flips the value of ledstate: if ledstate==0 it changes to 1, if 1 it is changed to 0
-		// Because ledstate is declared static, it's value is held over subsequent calls to ControlTask.
+		// Because ledstate is declared static, it's value is held over subsequent calls to Run.
 
 		ledstate=(ledstate==1)?0:1;
 
@@ -116,15 +96,15 @@ void ControlTask(void * context)
 		//----------------------------------------------------------------------------------------------
 
 		// The timer needs to be reset. If it isn't, it will always be expired and the code within
-		// the 'if' statement will run every time the ControlTask is called by the task manager
+		// the 'if' statement will run every time Run is called by the task manager
 
-		timers->LEDTimer->Set(750);
+		LEDTimer.Set(750);
 
 	}
 
 	// Now we can check the 7 seg timer
 
-	if(timers->SevenSegTimer->isExpired()) {
+	if(SevenSegTimer.isExpired()) {
 
 		//-----------------------------------------------------------------------------------------
 
@@ -172,8 +152,8 @@ void ControlTask(void * context)
 		//----------------------------------------------------------------------------------------------
 
 		// The timer needs to be reset. If it isn't, it will always be expired and the code within
-		// the 'if' statement will run every time the ControlTask is called by the task manager
+		// the 'if' statement will run every time Run is called by the task manager
 
-		timers->SevenSegTimer->Set(300);
+		SevenSegTimer.Set(300);
 	}
 }
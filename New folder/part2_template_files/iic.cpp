@@ -9,75 +9,1157 @@
 
 #include <Arduino.h>
 #include "iic.h"
+#include "kernel.h"
 
+// Bus lock: the owner and how many times it has taken the lock
+
+static unsigned char IICDepth=0;
+static PFNTASKHANDLER IICOwner;			// task ring handler, NULL outside the ring
+#ifdef KERNEL_MODE_PREEMPTIVE
+static signed char IICOwnerID;			// preemptive task, or PRE_IDLE for the ring
+static Kernel::PREMutex IICMutex;
+#endif
+
+// Bus pins, for recovery: SDA is PC4, SCL is PC5
+
+#define IIC_SDA			(1<<4)
+#define IIC_SCL			(1<<5)
+
+static IICSTATS IICStats;
+
+// Bit rate register and prescaler, kept for recovery
+
+static unsigned char IICTWBR;
+static unsigned char IICTWPS;
+
+#ifdef IIC_PROFILE
+
+// Per-device bus use, and when the transaction on the bus started
+
+static IICDEVSTATS IICProfile[IIC_PROFILE_DEVICES];
+static unsigned long IICProfileReset;
+static unsigned long IICProfileStart;
+
+#endif
+
+#ifndef IIC_ASYNC
+
+// The waits in a polled transaction share a budget of loop passes, so a
+// whole transaction, not each wait, is bounded by IIC_TIMEOUT_US. A pass of
+// a wait loop is about 12 cycles.
+
+#define IIC_WAIT_LOOPS	((unsigned int)((F_CPU/1000000UL)*IIC_TIMEOUT_US/12))
+
+static unsigned int IICBudget;
+
+#else
+
+// A transfer that makes no progress for this long is abandoned. One more
+// than the timeout, for the granularity of millis().
+
+#define IIC_TIMEOUT_MS	((IIC_TIMEOUT_US+999)/1000+1)
+
+#define IIC_TWCR_GO		((1<<TWINT)|(1<<TWEN)|(1<<TWIE))
+
+//
+// Driver state. The head of the queue is the transfer on the bus.
+
+static IICXFER * volatile IICQueue=NULL;
+static unsigned char IICIndex;			// bytes done in the current phase
+static unsigned char IICReading;		// nonzero in the read phase
+static IICSEG IICPart;					// the part of the transfer on the bus
+static unsigned char IICParts;			// further parts started so far
+
+// Supervision: the ISR counts bus events; a stalled count means a stuck bus
+
+static volatile unsigned char IICProgress;
+static unsigned char IICSeen;			// IICProgress when last supervised
+static unsigned long IICSince;			// millis() when it was seen to move
+static void IICWatchdog(void *);
+static Kernel::EventTimer IICWatch(IICWatchdog,NULL);
+
+// Posted write blocks, and their copies of the data
+
+static IICXFER IICPosted[IIC_POSTED_SLOTS];
+static unsigned char IICPostedData[IIC_POSTED_SLOTS][IIC_POSTED_MAX];
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICInitialize
+///
+/// Initialize the IIC subsystem
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICInitialize(void)
+{
+	IICSetBitRate(IIC_BITRATE);
+#ifdef IIC_ASYNC
+	IICWatch.StartPeriodic(IIC_TIMEOUT_MS);
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICSetBitRate
+///
+/// Set the bus rate. SCL runs at F_CPU/(16+2*TWBR*4^TWPS). The smallest
+/// prescaler that will do gives the finest steps; TWBR is rounded up, so the
+/// rate set is never faster than the one asked for, unless that is below the
+/// slowest the TWI can go.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: hz - unsigned long. Rate wanted, Hz
+/// @return: unsigned long. Rate set, Hz
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long IICSetBitRate(unsigned long hz)
+{
+	unsigned long div=(hz<F_CPU/16)?(F_CPU+hz-1)/(hz?hz:1):16;		// SCL period in clocks
+	unsigned char twps=0;
+	unsigned long twbr=(div-16+1)/2;
+
+	while(twbr>255 && twps<3) {
+		twps++;
+		twbr=(div-16+(2UL<<(2*twps))-1)/(2UL<<(2*twps));
+	}
+	IICTWBR=(twbr>255)?255:twbr;
+	IICTWPS=twps;
+	TWBR=IICTWBR;
+	TWSR=IICTWPS;			// the other bits are read-only status
+	return IICGetBitRate();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICGetBitRate
+///
+/// Get the bus rate
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: NONE
+/// @return: unsigned long. Rate, Hz
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long IICGetBitRate(void)
+{
+	return F_CPU/(16+((unsigned long)IICTWBR<<(2*IICTWPS+1)));
+}
+
+/////////////////////////////
+/// Failures and recovery
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICError
+///
+/// Turn an unexpected TWI status into an error code
+///
+/// @scope: INTERNAL
+/// @context: ANY
+/// @param: status - unsigned char. TWSR with the prescaler bits masked off
+/// @return: int. IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICError(unsigned char status)
+{
+	switch(status) {
+		case 0x20:				// SLA+W not acknowledged
+		case 0x48:				// SLA+R not acknowledged
+			return IIC_ERR_ADDR;
+		case 0x30:				// data byte not acknowledged
+			return IIC_ERR_NACK;
+		case 0x38:				// arbitration lost
+			return IIC_ERR_ARB;
+		default:				// 0x00 is a bus error; anything else is out of step
+			return IIC_ERR_BUS;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICCount
+///
+/// Count a failed transaction
+///
+/// @scope: INTERNAL
+/// @context: ANY, with interrupts off if the driver is interrupt driven
+/// @param: rc - int. The transaction result
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICCount(int rc)
+{
+	switch(rc) {
+		case IIC_ERR_ADDR:		IICStats.addrnacks++;	break;
+		case IIC_ERR_NACK:		IICStats.datanacks++;	break;
+		case IIC_ERR_ARB:		IICStats.arblost++;		break;
+		case IIC_ERR_START:
+		case IIC_ERR_BUS:		IICStats.buserrors++;	break;
+		case IIC_ERR_TIMEOUT:	IICStats.timeouts++;	break;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRecover
+///
+/// Free a stuck bus. The TWI lets go of the pins and SCL is pulsed nine
+/// times, by switching it between driven low and released. That is enough
+/// for a slave part way through sending a byte to finish it and let go of
+/// SDA. A stop condition then leaves the bus idle, and the TWI is set up
+/// again. Takes about 100us.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICRecover(void)
+{
+	unsigned char sreg=SREG;
+	cli();
+	unsigned char port=PORTC&(IIC_SDA|IIC_SCL);
+
+	TWCR=0;								// TWI off: the pins are plain IO again
+	DDRC&=~(IIC_SDA|IIC_SCL);			// both released
+	PORTC&=~(IIC_SDA|IIC_SCL);			// and low whenever driven
+
+	for(int clk=0;clk<9;clk++) {
+		DDRC|=IIC_SCL;					// SCL low
+		delayMicroseconds(5);
+		DDRC&=~IIC_SCL;					// SCL released
+		delayMicroseconds(5);
+	}
+
+	// stop: SDA rises while SCL is high
+
+	DDRC|=IIC_SCL;
+	DDRC|=IIC_SDA;
+	delayMicroseconds(5);
+	DDRC&=~IIC_SCL;
+	delayMicroseconds(5);
+	DDRC&=~IIC_SDA;
+	delayMicroseconds(5);
+
+	PORTC|=port;						// pull-ups as they were
+	TWBR=IICTWBR;
+	TWSR=IICTWPS;
+	TWCR=(1<<TWEN);
+	IICStats.recoveries++;
+	SREG=sreg;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICGetStats
+///
+/// Copy the failure counters
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: pStats - IICSTATS *. Where to put them
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICGetStats(IICSTATS * pStats)
+{
+	unsigned char sreg=SREG;
+	cli();
+	*pStats=IICStats;
+	SREG=sreg;
+}
+
+/////////////////////////////
+/// Profiling
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICProfileBegin
+///
+/// Note the start of a transaction
+///
+/// @scope: INTERNAL
+/// @context: ANY, with interrupts off if the driver is interrupt driven
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static inline void IICProfileBegin(void)
+{
+#ifdef IIC_PROFILE
+	IICProfileStart=micros();
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICProfileEnd
+///
+/// Charge a finished transaction to its device's entry, taking a free entry
+/// for a new address, or the last one if there are none
+///
+/// @scope: INTERNAL
+/// @context: ANY, with interrupts off if the driver is interrupt driven
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: nbytes - unsigned int. Bytes written and read
+/// @param: rc - int. The transaction result
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifdef IIC_PROFILE
+
+static inline void IICProfileEnd(unsigned char addr, unsigned int nbytes, int rc)
+{
+	unsigned long us=micros()-IICProfileStart;
+	IICDEVSTATS * dev=IICProfile;
+
+	addr&=0xfe;
+	while(dev->transactions && dev->addr!=addr && dev<&IICProfile[IIC_PROFILE_DEVICES-1]) {
+		dev++;
+	}
+	if(!dev->transactions) {
+		dev->addr=addr;
+	} else if(dev->addr!=addr) {
+		dev->addr=0xff;						// shared by the addresses that did not fit
+	}
+
+	dev->transactions++;
+	if(rc==IIC_OK) {
+		dev->bytes+=nbytes;
+	} else {
+		dev->errors++;
+		if(rc==IIC_ERR_ADDR || rc==IIC_ERR_NACK) {
+			dev->nacks++;
+		}
+	}
+	dev->busy+=us;
+	dev->last=(us>0xffff)?0xffff:(unsigned int)us;
+	if(dev->last>dev->worst) {
+		dev->worst=dev->last;
+	}
+}
+
+#else
+
+static inline void IICProfileEnd(unsigned char, unsigned int, int) {}
+
+#endif
+
+#ifdef IIC_PROFILE
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICGetProfile
+///
+/// Copy the per-device bus use
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: pTable - IICDEVSTATS *. Where to put the entries
+/// @param: nMax - int. Room in pTable, entries
+/// @param: pElapsed - unsigned long *. Where to put the time since the reset,
+///                    us, or NULL
+/// @return: int. Number of entries copied
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICGetProfile(IICDEVSTATS * pTable, int nMax, unsigned long * pElapsed)
+{
+	int n=0;
+	unsigned char sreg=SREG;
+	cli();
+	while(n<nMax && n<IIC_PROFILE_DEVICES && IICProfile[n].transactions) {
+		pTable[n]=IICProfile[n];
+		n++;
+	}
+	SREG=sreg;
+	if(pElapsed) {
+		*pElapsed=micros()-IICProfileReset;
+	}
+	return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICResetProfile
+///
+/// Clear the per-device bus use and restart the elapsed time
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICResetProfile(void)
+{
+	unsigned char sreg=SREG;
+	cli();
+	memset(IICProfile,0,sizeof(IICProfile));
+	IICProfileReset=micros();
+	SREG=sreg;
+}
+
+#endif
+
+/////////////////////////////
+/// Bus ownership
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICIsOwner
+///
+/// Check whether the caller holds the bus lock. The caller is identified by
+/// the task ring handler running. In KERNEL_MODE_PREEMPTIVE it is first
+/// identified by the preemptive task, and only the idle task, which runs the
+/// ring, by the handler too: a preemptive task may sleep holding the lock,
+/// and the ring moves on to other handlers meanwhile.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: int. Nonzero if the caller holds the lock
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICIsOwner(void)
+{
+	if(!IICDepth) {
+		return 0;
+	}
+#ifdef KERNEL_MODE_PREEMPTIVE
+	if(IICOwnerID!=Kernel::OS.Preempt.Current()) {
+		return 0;
+	}
+	if(IICOwnerID!=PRE_IDLE) {
+		return 1;
+	}
+#endif
+	return IICOwner==Kernel::OS.TaskManager.Running();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICLock
+///
+/// Take the bus lock
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: int. IIC_OK, or IIC_ERR_BUSY if another task holds the lock
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICLock(void)
+{
+	if(IICIsOwner()) {
+		IICDepth++;
+		return IIC_OK;
+	}
+#ifdef KERNEL_MODE_PREEMPTIVE
+	if(IICMutex.Lock()) {			// waits, unless we are the idle task
+		return IIC_ERR_BUSY;
+	}
+	IICOwnerID=Kernel::OS.Preempt.Current();
+	IICOwner=(IICOwnerID==PRE_IDLE)?Kernel::OS.TaskManager.Running():NULL;
+#else
+	if(IICDepth) {
+		return IIC_ERR_BUSY;
+	}
+	IICOwner=Kernel::OS.TaskManager.Running();
+#endif
+	IICDepth=1;
+	return IIC_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICUnlock
+///
+/// Release the bus lock. Does nothing if the caller does not hold it.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICUnlock(void)
+{
+	if(IICIsOwner() && --IICDepth==0) {
+#ifdef KERNEL_MODE_PREEMPTIVE
+		IICMutex.Unlock();
+#endif
+	}
+}
+
+
+#ifndef IIC_ASYNC
+
+/////////////////////////////
+/// Polled driver
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWaitInt
+///
+/// Wait for the TWI to finish the current bus event, within what is left of
+/// the transaction's budget
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: NONE
+/// @return: int. IIC_OK, or IIC_ERR_TIMEOUT
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICWaitInt(void)
+{
+	while(!(TWCR&(1<<TWINT))) {
+		if(!IICBudget) {
+			return IIC_ERR_TIMEOUT;
+		}
+		IICBudget--;
+	}
+	return IIC_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICStart
+///
+/// Send a start, or a repeated start, condition
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: status - unsigned char. 0x08 for a start, 0x10 for a repeated start
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICStart(unsigned char status)
+{
+	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTA);	// send start bit
+	int rc=IICWaitInt();					// wait for ack
+	if(rc==IIC_OK && (TWSR&0xf8)!=status) {
+		rc=((TWSR&0xf8)==0x38 || (TWSR&0xf8)==0x00)?IICError(TWSR&0xf8):IIC_ERR_START;
+	}
+	return rc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICEnd
+///
+/// End a transaction: send a stop condition and release the bus, or recover
+/// the bus if it has stuck. Counts any failure.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: rc - int. The result so far
+/// @return: int. The result of the transaction
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICEnd(int rc)
+{
+	if(rc!=IIC_ERR_TIMEOUT && rc!=IIC_ERR_BUS) {
+		TWCR=(1<<TWINT)|(1<<TWEN)|(1<<TWSTO);	// send stop bit
+		while(TWCR&(1<<TWSTO)) {			// wait for it to be cleared
+			if(!IICBudget) {
+				rc=IIC_ERR_TIMEOUT;
+				break;
+			}
+			IICBudget--;
+		}
+	}
+	if(rc==IIC_ERR_TIMEOUT || rc==IIC_ERR_BUS) {
+		IICRecover();
+	}
+	IICCount(rc);
+	return rc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICSend
+///
+/// After a start: address the device for writing and send the data
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbyte - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send.
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICSend(unsigned char addr,unsigned char * dbytes, unsigned int nToSend)
+{
+	// send the address, with W bit set to zero
+	TWDR=addr&0xfe;					// load address
+	TWCR = (1<<TWINT)|(1<<TWEN); 	// whang it in
+	if(IICWaitInt()) {				// wait for complete
+		return IIC_ERR_TIMEOUT;
+	}
+	if((TWSR&0xf8)!=0x18) {			// check addr ack received
+		return IICError(TWSR&0xf8);	// nobody at that address, usually
+	}
+	for(unsigned int idx=0;(idx<nToSend);idx++) {
+		TWDR=*(dbytes+idx);			// load byte
+		TWCR=(1<<TWINT)|(1<<TWEN);	// whang it in
+		if(IICWaitInt()) {			// wait for complete
+			return IIC_ERR_TIMEOUT;
+		}
+		if((TWSR&0xf8)!=0x28) {		// check for data ack received
+			return IICError(TWSR&0xf8);
+		}
+	}
+	return IIC_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRecv
+///
+/// After a start: address the device for reading and receive the data,
+/// acknowledging every byte but the last
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
+///                  data
+/// @param: nToRecv - number of bytes to receive
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICRecv(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv)
+{
+	// send the address, with W bit set to 1
+	TWDR=addr|0x01;					// load address
+	TWCR = (1<<TWINT)|(1<<TWEN); 	// whang it in
+	if(IICWaitInt()) {				// wait for complete
+		return IIC_ERR_TIMEOUT;
+	}
+	if((TWSR&0xf8)!=0x40) {			// check addr ack received
+		return IICError(TWSR&0xf8);	// nobody at that address, usually
+	}
+	for(unsigned int idx=0;(idx<nToRecv);idx++) {
+		// check if we need ack before receiving.
+		TWCR=(idx==(nToRecv-1))?(1<<TWINT)|(1<<TWEN):(1<<TWINT)|(1<<TWEN)|(1<<TWEA);
+		if(IICWaitInt()) {			// wait for ready
+			return IIC_ERR_TIMEOUT;
+		}
+		if(((TWSR&0xf8)==0x50)||((TWSR&0xf8)==0x58)) {		// check for data ack received
+			*(dbytes+idx)=TWDR;		// load byte
+		} else {
+			return IICError(TWSR&0xf8);
+		}
+	}
+	return IIC_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWrite
+///
+/// Write a string of data bytes to the IIC address
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbyte - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send.
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend)
+{
+	// This is out of the data sheet!
+	// Polled I2C write transfer
+
+	int rc=IICLock();
+	if(rc==IIC_OK) {
+		IICBudget=IIC_WAIT_LOOPS;
+		IICProfileBegin();
+		rc=IICStart(0x08);
+		if(rc==IIC_OK) {
+			rc=IICSend(addr,dbytes,nToSend);
+		}
+		rc=IICEnd(rc);
+		IICProfileEnd(addr,nToSend,rc);
+		IICUnlock();
+	}
+	return rc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRead
+///
+/// Read multiple bytes of data from the IIC address
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
+///                  data
+/// @param: nToRecv - number of bytes to receive
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
 ///////////////////////////////////////////////////////////////////////////////
-/// IICInitialize
+
+int IICRead(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv)
+{
+	// This is out of the data sheet!
+	// Polled I2C read transfer
+
+	int rc=IICLock();
+	if(rc==IIC_OK) {
+		IICBudget=IIC_WAIT_LOOPS;
+		IICProfileBegin();
+		rc=IICStart(0x08);
+		if(rc==IIC_OK) {
+			rc=IICRecv(addr,dbytes,nToRecv);
+		}
+		rc=IICEnd(rc);
+		IICProfileEnd(addr,nToRecv,rc);
+		IICUnlock();
+	}
+	return rc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWriteRead
 ///
-/// Initialize the IIC subsystem
+/// Write, then read after a repeated start, holding the bus throughout
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: wbytes - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send
+/// @param: rbytes - pointer to unsigned char. Buffer for the data read
+/// @param: nToRecv - number of bytes to receive
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWriteRead(unsigned char addr,unsigned char * wbytes, unsigned int nToSend,unsigned char * rbytes, unsigned int nToRecv)
+{
+	int rc=IICLock();
+	if(rc==IIC_OK) {
+		IICBudget=IIC_WAIT_LOOPS;
+		IICProfileBegin();
+		rc=IICStart(0x08);
+		if(rc==IIC_OK) {
+			rc=IICSend(addr,wbytes,nToSend);
+		}
+		if(rc==IIC_OK && nToRecv) {
+			rc=IICStart(0x10);
+			if(rc==IIC_OK) {
+				rc=IICRecv(addr,rbytes,nToRecv);
+			}
+		}
+		rc=IICEnd(rc);
+		IICProfileEnd(addr,nToSend+nToRecv,rc);
+		IICUnlock();
+	}
+	return rc;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICTransfer
+///
+/// Carry out several parts as one transaction, joined by repeated starts
 ///
 /// @scope: EXPORTED
 /// @context: TASK
+/// @param: segs - IICSEG *. The parts, in order
+/// @param: nsegs - unsigned char. How many
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICTransfer(IICSEG * segs, unsigned char nsegs)
+{
+	if(!nsegs) {
+		return IIC_OK;
+	}
+	int rc=IICLock();
+	if(rc==IIC_OK) {
+		unsigned int nbytes=0;
+		IICProfileBegin();
+		for(unsigned char idx=0;rc==IIC_OK && idx<nsegs;idx++) {
+			IICSEG * seg=&segs[idx];
+			IICBudget=IIC_WAIT_LOOPS;
+			rc=IICStart(idx?0x10:0x08);
+			if(rc==IIC_OK && (seg->nwrite || !seg->nread)) {
+				rc=IICSend(seg->addr,seg->wbuf,seg->nwrite);
+				if(rc==IIC_OK && seg->nread) {
+					rc=IICStart(0x10);
+				}
+			}
+			if(rc==IIC_OK && seg->nread) {
+				rc=IICRecv(seg->addr,seg->rbuf,seg->nread);
+			}
+			nbytes+=seg->nwrite+seg->nread;
+		}
+		rc=IICEnd(rc);
+		IICProfileEnd(segs->addr,nbytes,rc);
+		IICUnlock();
+	}
+	return rc;
+}
+
+#else
+
+/////////////////////////////
+/// Interrupt-driven driver
+/////////////////////////////
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICBegin
+///
+/// Make a transfer's own write and read the part to go on the bus first
+///
+/// @scope: INTERNAL
+/// @context: ANY, with interrupts off
+/// @param: xfer - IICXFER *. The transfer
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICBegin(IICXFER * xfer)
+{
+	IICPart.addr=xfer->addr;
+	IICPart.wbuf=xfer->wbuf;
+	IICPart.nwrite=xfer->nwrite;
+	IICPart.rbuf=xfer->rbuf;
+	IICPart.nread=xfer->nread;
+	IICParts=0;
+	IICIndex=0;
+	IICReading=(IICPart.nwrite==0 && IICPart.nread);	// an empty part is written: the address alone
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICBytes
+///
+/// Bytes a transfer moves, over all its parts
+///
+/// @scope: INTERNAL
+/// @context: ANY
+/// @param: xfer - IICXFER *. The transfer
+/// @return: unsigned int. Bytes written and read
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static inline unsigned int IICBytes(IICXFER * xfer)
+{
+	unsigned int n=xfer->nwrite+xfer->nread;
+
+	for(unsigned char idx=0;idx<xfer->nsegs;idx++) {
+		n+=xfer->segs[idx].nwrite+xfer->segs[idx].nread;
+	}
+	return n;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICStart
+///
+/// Put a start condition on the bus for the transfer at the head of the
+/// queue. A stop condition may still be going out; the start has to wait
+/// for it, which takes a few microseconds, unless the bus is stuck, in
+/// which case it is recovered.
+///
+/// @scope: INTERNAL
+/// @context: ANY, with interrupts off
 /// @param: NONE
 /// @return: NONE
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
-void IICInitialize(void)
+static void IICStart(void)
 {
-	TWBR=20;		// set bit rate and prescaler
-	TWSR=0x10;
+	IICBegin(IICQueue);
+	for(unsigned char wait=0;TWCR&(1<<TWSTO);) {
+		if(++wait==0) {				// 256 polls, ~100us at 16MHz
+			IICRecover();
+			break;
+		}
+	}
+	IICSince=millis();
+	IICProfileBegin();
+	TWCR=IIC_TWCR_GO|(1<<TWSTA);
 }
 
 ///////////////////////////////////////////////////////////////////////////////
-/// IICWrite
+/// IICComplete
 ///
-/// Write a string of data bytes to the IIC address
+/// Finish the transfer at the head of the queue: release the bus, or hand it
+/// straight to the next transfer with a stop-then-start, and report the
+/// result
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT, or TASK with interrupts off
+/// @param: status - signed char. IIC_OK or IIC_ERR_xx
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICComplete(signed char status)
+{
+	IICXFER * xfer=IICQueue;
+
+	IICCount(status);
+	IICProfileEnd(xfer->addr,IICBytes(xfer),status);
+	IICQueue=xfer->pNext;
+	if(IICQueue) {
+		IICSince=millis();
+		IICProfileBegin();
+		IICBegin(IICQueue);
+		TWCR=IIC_TWCR_GO|(1<<TWSTO)|(1<<TWSTA);
+	} else {
+		TWCR=(1<<TWINT)|(1<<TWEN)|(1<<TWSTO);
+	}
+
+	// the block is off the queue, so the callback may submit it again
+
+	xfer->status=status;
+	if(xfer->callback) {
+		xfer->callback(xfer);
+	} else if(xfer->msgid!=MSG_ID_NOMESSAGE) {
+		Kernel::OS.MessageQueue.Post(xfer->msgid,xfer->context,Kernel::MQ_OWNER_CALLER,Kernel::MQ_CONTEXT_INTERRUPT);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICNextPart
+///
+/// The part on the bus is done: go on to the transfer's next part with a
+/// repeated start, or complete the transfer
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: xfer - IICXFER *. The transfer on the bus
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void IICNextPart(IICXFER * xfer)
+{
+	if(IICParts<xfer->nsegs) {
+		IICPart=xfer->segs[IICParts++];
+		IICIndex=0;
+		IICReading=(IICPart.nwrite==0 && IICPart.nread);
+		TWCR=IIC_TWCR_GO|(1<<TWSTA);
+	} else {
+		IICComplete(IIC_OK);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICSupervise
+///
+/// Abandon the transfer on the bus if it has made no progress for
+/// IIC_TIMEOUT_MS: recover the bus, fail the transfer with IIC_ERR_TIMEOUT
+/// and start the next one
 ///
 /// @scope: INTERNAL
 /// @context: TASK
-/// @param: addr - unsigned char. Address. Top 7 bits used
-/// @param: dbyte - pointer to unsigned char. Data to send
-/// @param: nToSend - number of bytes to send.
+/// @param: NONE
+/// @return: NONE
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
-int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend)
+static void IICSupervise(void)
 {
-	int rc=0;
-	// This is out of the data sheet!
-	// Polled I2C write transfer
+	unsigned long now=millis();
+	unsigned char sreg=SREG;
+	cli();
+	if(!IICQueue || IICProgress!=IICSeen) {
+		IICSeen=IICProgress;
+		IICSince=now;
+	} else if(now-IICSince>=IIC_TIMEOUT_MS) {
+		IICRecover();
+		IICComplete(IIC_ERR_TIMEOUT);
+	}
+	SREG=sreg;
+}
 
-	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTA);	// send start bit
+///////////////////////////////////////////////////////////////////////////////
+/// IICWatchdog
+///
+/// Timer callback: supervise the bus while no task is waiting on it
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: void *. Unused
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
 
-	while(!(TWCR&(1<<TWINT)));			// wait for ack
-	if(TWSR&0x08) {	// start bit set
-		// send the address, with W bit set to zero
-		TWDR=addr&0xf7;					// load address
-		TWCR = (1<<TWINT)|(1<<TWEN); 	// whang it in
-		while(!(TWCR&(1<<TWINT)));		// wait for complete
-		if((TWSR&0xf8)==0x18) {			// check addr ack received
-			for(int idx=0;(idx<nToSend);idx++) {
-				TWDR=*(dbytes+idx);			// load byte
-				TWCR=(1<<TWINT)|(1<<TWEN);	// whang it in
-				while(!(TWCR&(1<<TWINT)));	// wait for complete
-				if((TWSR&0xf8)!=0x28) {		// check for data ack received
-					rc=-2;
-					break;
-				}
-			}
+static void IICWatchdog(void *)
+{
+	IICSupervise();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICSubmit
+///
+/// Queue a transfer, in priority order. The head of the queue may be on the
+/// bus already, so nothing is ever put in front of it.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: xfer - IICXFER *. The transfer. Must not already be queued.
+/// @return: int. 0, once queued
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICSubmit(IICXFER * xfer)
+{
+	xfer->status=IIC_PENDING;
+
+	unsigned char sreg=SREG;
+	cli();
+	IICXFER ** ppLink=(IICXFER **)&IICQueue;
+	if(*ppLink) {
+		ppLink=&(*ppLink)->pNext;
+		while(*ppLink && (*ppLink)->priority>=xfer->priority) {
+			ppLink=&(*ppLink)->pNext;
 		}
-		TWCR=(1<<TWINT)|(1<<TWEN)|(1<<TWSTO);	// send stop bit
-		while(TWCR&(1<<TWSTO)); // wait for it to be cleared
-	} else {
-		rc=-1;
+	}
+	xfer->pNext=*ppLink;
+	*ppLink=xfer;
+	if(IICQueue==xfer) {
+		IICStart();				// the bus was idle
+	}
+	SREG=sreg;
+	return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWait
+///
+/// Submit a transfer and wait for it to finish: the blocking wrapper behind
+/// IICRead, IICWriteRead, IICTransfer and long writes. Only the calling task
+/// waits, for at most the bus timeout; the bus is driven by the interrupt.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: xfer - IICXFER *. The transfer
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int IICWait(IICXFER * xfer)
+{
+	int rc=IICLock();
+	if(rc==IIC_OK) {
+		IICSubmit(xfer);
+		while(xfer->status==IIC_PENDING) {
+			IICSupervise();
+		}
+		rc=xfer->status;
+		IICUnlock();
 	}
 	return rc;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// IICPost
+///
+/// Posted write: copy the data into a free posted block and queue it, to
+/// call back when done. If every posted block is in use, return IIC_ERR_BUSY
+/// for the caller to try again later. A write too long to copy is sent from
+/// the caller's buffer, and waited for; its callback is not called.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbytes - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send.
+/// @param: callback - PFNIICDONE. Called on completion, or NULL
+/// @param: context - void *. For the callback
+/// @return: int. IIC_OK once queued, IIC_ERR_BUSY if no slot is free,
+///          IIC_ERR_LENGTH, or the result of an unposted write
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICPost(unsigned char addr,unsigned char * dbytes, unsigned int nToSend,PFNIICDONE callback,void * context)
+{
+	if(nToSend>255) {
+		return IIC_ERR_LENGTH;
+	}
+	if(nToSend>IIC_POSTED_MAX) {
+		IICXFER xfer={NULL,addr,IIC_PRIO_NORMAL,dbytes,(unsigned char)nToSend,NULL,0,IIC_OK,NULL,MSG_ID_NOMESSAGE,NULL,NULL,0};
+		return IICWait(&xfer);
+	}
+
+	if(IICDepth && !IICIsOwner()) {
+		return IIC_ERR_BUSY;
+	}
+	for(int slot=0;slot<IIC_POSTED_SLOTS;slot++) {
+		IICXFER * xfer=&IICPosted[slot];
+		if(xfer->status!=IIC_PENDING) {
+			memcpy(IICPostedData[slot],dbytes,nToSend);
+			xfer->addr=addr;
+			xfer->priority=IIC_PRIO_NORMAL;
+			xfer->wbuf=IICPostedData[slot];
+			xfer->nwrite=nToSend;
+			xfer->rbuf=NULL;
+			xfer->nread=0;
+			xfer->nsegs=0;
+			xfer->callback=callback;
+			xfer->msgid=MSG_ID_NOMESSAGE;
+			xfer->context=context;
+			IICSubmit(xfer);
+			return IIC_OK;
+		}
+	}
+
+	// All in use: the bus may be stuck, so check it before giving up
+
+	IICSupervise();
+	return IIC_ERR_BUSY;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICWrite
+///
+/// Posted write, with nothing to call back (see IICPost)
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbyte - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send.
+/// @return: int. IIC_OK once queued, IIC_ERR_BUSY if no slot is free,
+///          IIC_ERR_LENGTH, or the result of an unposted write
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend)
+{
+	return IICPost(addr,dbytes,nToSend,NULL,NULL);
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 /// IICRead
 ///
-/// Read multiple bytes of data from the IIC address
+/// Read multiple bytes of data from the IIC address, waiting for the data:
+/// a blocking wrapper (see IICWait). The read is queued behind any posted
+/// writes, so it sees their effect.
 ///
 /// @scope: EXPORTED
 /// @context: TASK
@@ -85,39 +1167,137 @@ int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend)
 /// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
 ///                  data
 /// @param: nToRecv - number of bytes to receive
+/// @return: int. IIC_OK, or IIC_ERR_xx
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
 int IICRead(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv)
 {
-	int rc=0;
-	// This is out of the data sheet!
-	// Polled I2C read transfer
+	if(nToRecv>255) {
+		return IIC_ERR_LENGTH;
+	}
+	IICXFER xfer={NULL,addr,IIC_PRIO_NORMAL,NULL,0,dbytes,(unsigned char)nToRecv,IIC_OK,NULL,MSG_ID_NOMESSAGE,NULL,NULL,0};
+	return IICWait(&xfer);
+}
 
-	TWCR = (1<<TWINT)|(1<<TWEN)|(1<<TWSTA);	// send start bit
-	while(!(TWCR&(1<<TWINT)));			// wait for ack
-	if(TWSR&0x08) {	// start bit set
-		// send the address, with W bit set to 1
-		TWDR=addr|0x01;					// load address
-		TWCR = (1<<TWINT)|(1<<TWEN); 	// whang it in
-		while(!(TWCR&(1<<TWINT)));		// wait for complete
-		if((TWSR&0xf8)==0x40) {			// check addr ack received
-			for(int idx=0;(idx<nToRecv);idx++) {
-				// check if we need ack before receiving.
-				TWCR=(idx==(nToRecv-1))?(1<<TWINT)|(1<<TWEN):(1<<TWINT)|(1<<TWEN)|(1<<TWEA);
-				while(!(TWCR&(1<<TWINT)));	// wait for ready
-				if(((TWSR&0xf8)==0x50)||((TWSR&0xf8)==0x58)) {		// check for data ack received
-					*(dbytes+idx)=TWDR;		// load byte
-				} else {
-					rc=-2;
-					break;
-				}
+///////////////////////////////////////////////////////////////////////////////
+/// IICWriteRead
+///
+/// Write, then read after a repeated start, waiting for the data: a
+/// blocking wrapper (see IICWait). The two go as one queued transfer, so
+/// nothing can come between them.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: wbytes - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send
+/// @param: rbytes - pointer to unsigned char. Buffer for the data read
+/// @param: nToRecv - number of bytes to receive
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWriteRead(unsigned char addr,unsigned char * wbytes, unsigned int nToSend,unsigned char * rbytes, unsigned int nToRecv)
+{
+	if(nToSend>255 || nToRecv>255) {
+		return IIC_ERR_LENGTH;
+	}
+	IICXFER xfer={NULL,addr,IIC_PRIO_NORMAL,wbytes,(unsigned char)nToSend,rbytes,(unsigned char)nToRecv,IIC_OK,NULL,MSG_ID_NOMESSAGE,NULL,NULL,0};
+	return IICWait(&xfer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICTransfer
+///
+/// Carry out several parts as one transaction, joined by repeated starts,
+/// waiting for the result: a blocking wrapper (see IICWait). They go as one
+/// queued transfer: the first part in the transfer itself, the rest as its
+/// further parts.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: segs - IICSEG *. The parts, in order
+/// @param: nsegs - unsigned char. How many
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICTransfer(IICSEG * segs, unsigned char nsegs)
+{
+	if(!nsegs) {
+		return IIC_OK;
+	}
+	IICXFER xfer={NULL,segs->addr,IIC_PRIO_NORMAL,segs->wbuf,segs->nwrite,segs->rbuf,segs->nread,IIC_OK,NULL,MSG_ID_NOMESSAGE,NULL,segs+1,(unsigned char)(nsegs-1)};
+	return IICWait(&xfer);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR(TWI_vect)
+///
+/// Interrupt Service Routine: TWI master state machine. Each interrupt moves
+/// the transfer at the head of the queue on by one bus event.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(TWI_vect)
+{
+	IICXFER * xfer=IICQueue;
+
+	IICProgress++;
+	switch(TWSR&0xf8) {
+
+		case 0x08:		// start sent
+		case 0x10:		// repeated start sent
+			TWDR=IICReading?(IICPart.addr|0x01):(IICPart.addr&0xfe);
+			TWCR=IIC_TWCR_GO;
+			break;
+
+		case 0x18:		// SLA+W acknowledged
+		case 0x28:		// data byte acknowledged
+			if(IICIndex<IICPart.nwrite) {
+				TWDR=IICPart.wbuf[IICIndex++];
+				TWCR=IIC_TWCR_GO;
+			} else if(IICPart.nread) {
+				IICReading=1;
+				IICIndex=0;
+				TWCR=IIC_TWCR_GO|(1<<TWSTA);	// repeated start for the read
+			} else {
+				IICNextPart(xfer);
 			}
-		}
-		TWCR=(1<<TWINT)|(1<<TWEN)|(1<<TWSTO);	// send stop bit
-		while(TWCR&(1<<TWSTO)); // wait for it to be cleared
-	} else {
-		rc=-1;
+			break;
+
+		case 0x40:		// SLA+R acknowledged: acknowledge all but the last byte
+			TWCR=(IICPart.nread>1)?IIC_TWCR_GO|(1<<TWEA):IIC_TWCR_GO;
+			break;
+
+		case 0x50:		// data byte received and acknowledged
+			IICPart.rbuf[IICIndex++]=TWDR;
+			TWCR=(IICIndex<IICPart.nread-1)?IIC_TWCR_GO|(1<<TWEA):IIC_TWCR_GO;
+			break;
+
+		case 0x58:		// last data byte received
+			IICPart.rbuf[IICIndex]=TWDR;
+			IICNextPart(xfer);
+			break;
+
+		case 0x20:		// SLA+W not acknowledged
+		case 0x30:		// data byte not acknowledged
+		case 0x48:		// SLA+R not acknowledged
+		case 0x38:		// arbitration lost: the other master has the bus
+			IICComplete(IICError(TWSR&0xf8));
+			break;
+
+		default:		// bus error
+			IICRecover();
+			IICComplete(IIC_ERR_BUS);
+			break;
 	}
-	return rc;
 }
+
+#endif
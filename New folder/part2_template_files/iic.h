@@ -10,13 +10,175 @@
 #ifndef _IIC_H_
 #define _IIC_H_
 
+// Every IIC function call is one bus transaction, from start to stop, that no
+// other module's traffic can break into: the polled driver runs it to
+// completion, and the interrupt-driven one queues it as a single transfer.
+// IICWriteRead uses this to set a register address and read from it with a
+// repeated start, instead of a stop and a new start.
+//
+// A module that needs several transactions in a row to go undisturbed, a
+// read-modify-write say, can hold the bus across them, even across passes
+// of its task, with IICLock and IICUnlock. While it does, the polled driver
+// and the waiting calls of the interrupt-driven one refuse other tasks with
+// IIC_ERR_BUSY. Transfers queued directly with IICSubmit are not checked.
+// The lock nests, and in KERNEL_MODE_PREEMPTIVE it is a priority-inheriting
+// mutex that preemptive tasks wait for.
+
+// Define IIC_ASYNC to run the bus from the TWI interrupt. Transfers are then
+// described by IICXFER blocks and queued with IICSubmit; the interrupt works
+// through the queue in priority order and reports each completion by a
+// callback or a message, so the caller need not wait on the bus. IICWrite
+// becomes a posted write that returns as soon as it is queued, or with
+// IIC_ERR_BUSY if the posted slots are all in use. IICRead, IICWriteRead,
+// IICTransfer and a write too long to post remain blocking wrappers: they
+// queue their transfer and wait for it, for up to the bus timeout. Tasks
+// that must not wait, such as the keypad's, use IICSubmit. A transfer
+// carries at most 255 bytes each way; longer ones are refused with
+// IIC_ERR_LENGTH.
+//
+// This defines the TWI interrupt, which the Wire library also defines, so
+// Wire-based libraries (LiquidCrystal_I2C among them) can not be linked with
+// it.
+
+//#define IIC_ASYNC
+
+// Define IIC_PROFILE to keep, for each device address, the transactions,
+// bytes, failures and time spent on the bus, for working out refresh rates.
+// Costs IIC_PROFILE_DEVICES*19 bytes of RAM and two micros() calls per
+// transaction. Only traffic through this driver is seen: the LCD library
+// goes through Wire.
+
+//#define IIC_PROFILE
+
+#define IIC_PROFILE_DEVICES	4		// addresses tracked; any more are merged into the last entry
+
+#define IIC_OK				0
+#define IIC_PENDING			1		// queued, or on the bus
+#define IIC_ERR_START		-1		// could not send a start condition
+#define IIC_ERR_NACK		-2		// data not acknowledged
+#define IIC_ERR_BUS			-3		// bus error
+#define IIC_ERR_BUSY		-4		// another task holds the bus lock
+#define IIC_ERR_ADDR		-5		// address not acknowledged: no such device
+#define IIC_ERR_ARB			-6		// arbitration lost
+#define IIC_ERR_TIMEOUT		-7		// the bus stopped responding
+#define IIC_ERR_LENGTH		-8		// IIC_ASYNC: more than 255 bytes in one transfer
+
+// Longest a transaction may take before it is abandoned, in microseconds.
+// A stuck bus is then recovered: SCL is clocked nine times to let a slave
+// that is holding SDA low finish its byte, a stop condition is sent, and the
+// TWI is set up again. A polled transaction, and so a keypad poll, therefore
+// never takes longer than this plus about 100us for the recovery. Allow for
+// slaves that stretch the clock, and for the bus rate: the longest
+// transaction the drivers make, an MCPFlush of every expander register, is
+// 23 bytes, which takes about 2.3ms at 100kHz. With IIC_ASYNC the bus is
+// supervised by the millisecond, so a stalled transfer is failed after the
+// timeout rounded up to whole milliseconds, plus one.
+
+#define IIC_TIMEOUT_US		3000
+
+// Bus rates, Hz. The TWI clock is F_CPU/(16+2*TWBR*prescaler), so at 16MHz
+// it can run from about 500Hz to 1MHz.
+
+#define IIC_RATE_STANDARD	100000UL
+#define IIC_RATE_FAST		400000UL
+
+// Rate set by IICInitialize: the fastest that every device on the bus
+// supports. The MCP23017 on the keypad is good for 1.7MHz and the TWI for
+// 400kHz, but the PCF8574 on the LCD backpack is rated for 100kHz only. The
+// LCD library drives it through Wire, and the two share the TWI, so a faster
+// rate set here would apply to the LCD's traffic too. Use IIC_RATE_FAST only
+// on a bus without the LCD.
+
+#define IIC_BITRATE			IIC_RATE_STANDARD
+
+//
+// Failure counters, since startup
+
+typedef struct _IICSTATS {
+	unsigned int	addrnacks;		// IIC_ERR_ADDR
+	unsigned int	datanacks;		// IIC_ERR_NACK
+	unsigned int	arblost;		// IIC_ERR_ARB
+	unsigned int	buserrors;		// IIC_ERR_BUS and IIC_ERR_START
+	unsigned int	timeouts;		// IIC_ERR_TIMEOUT
+	unsigned int	recoveries;		// bus recoveries
+} IICSTATS;
+
+//
+// Bus use by one device address, since the profile was last reset. Times are
+// from the start condition to the stop, so time queued is not included.
+
+typedef struct _IICDEVSTATS {
+	unsigned char	addr;			// address, top 7 bits; 0xff for the shared entry
+	unsigned int	transactions;
+	unsigned int	errors;			// transactions that failed
+	unsigned int	nacks;			// of which not acknowledged: IIC_ERR_ADDR, IIC_ERR_NACK
+	unsigned long	bytes;			// moved by transactions that succeeded
+	unsigned long	busy;			// time on the bus, us
+	unsigned int	worst;			// longest transaction, us
+	unsigned int	last;			// most recent transaction, us
+} IICDEVSTATS;
+
+//
+// One part of a combined transaction: an optional write, then an optional
+// read after a repeated start, to one address. IICTransfer joins parts with
+// repeated starts, so the bus is held from the first start to the last stop.
+
+typedef struct _IICSEG {
+	unsigned char		addr;		// address, top 7 bits used
+	unsigned char *		wbuf;		// bytes to write
+	unsigned char		nwrite;
+	unsigned char *		rbuf;		// where to put bytes read
+	unsigned char		nread;
+} IICSEG;
+
+#ifdef IIC_ASYNC
+
+#define IIC_PRIO_LOW		0
+#define IIC_PRIO_NORMAL		1
+#define IIC_PRIO_HIGH		2
+
+#define IIC_POSTED_SLOTS	4		// posted writes that can be queued at once
+#define IIC_POSTED_MAX		8		// longest posted write, bytes
+
+struct _IICXFER;
+
+//
+// Prototype of a completion callback. Called from the TWI interrupt, so it
+// must be short; it may submit another transfer.
+
+typedef void (* PFNIICDONE)(struct _IICXFER * xfer);
+
+//
+// A transfer: an optional write, then an optional read after a repeated
+// start, then any further parts in segs, each after a repeated start. The
+// block, its parts and its buffers belong to the caller and must stay put
+// until status is no longer IIC_PENDING.
+
+typedef struct _IICXFER {
+	struct _IICXFER *	pNext;		// queue link, used by the driver
+	unsigned char		addr;		// address, top 7 bits used
+	unsigned char		priority;	// IIC_PRIO_xx, higher goes first
+	unsigned char *		wbuf;		// bytes to write
+	unsigned char		nwrite;
+	unsigned char *		rbuf;		// where to put bytes read
+	unsigned char		nread;
+	volatile signed char status;	// IIC_PENDING, IIC_OK or IIC_ERR_xx
+	PFNIICDONE			callback;	// called on completion, or NULL
+	signed char			msgid;		// posted on completion, or MSG_ID_NOMESSAGE
+	void *				context;	// message context, for the caller's use
+	IICSEG *			segs;		// further parts, or NULL
+	unsigned char		nsegs;
+} IICXFER;
+
+#endif
+
 //
 // Exported functions
 
 ///////////////////////////////////////////////////////////////////////////////
 /// IICInitialize
 ///
-/// Initialize the IIC subsystem
+/// Initialize the IIC subsystem, at IIC_BITRATE
 ///
 /// @scope: EXPORTED
 /// @context: TASK
@@ -27,6 +189,35 @@
 
 void IICInitialize(void);
 
+///////////////////////////////////////////////////////////////////////////////
+/// IICSetBitRate
+///
+/// Set the bus rate: the fastest the TWI can make that is no faster than
+/// asked for, or its slowest. Do not call with a transaction in progress.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: hz - unsigned long. Rate wanted, Hz
+/// @return: unsigned long. Rate set, Hz
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long IICSetBitRate(unsigned long hz);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICGetBitRate
+///
+/// Get the bus rate
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: NONE
+/// @return: unsigned long. Rate, Hz
+///
+///////////////////////////////////////////////////////////////////////////////
+
+unsigned long IICGetBitRate(void);
+
 ///////////////////////////////////////////////////////////////////////////////
 /// IICWrite
 ///
@@ -37,6 +228,9 @@ void IICInitialize(void);
 /// @param: addr - unsigned char. Address. Top 7 bits used
 /// @param: dbyte - pointer to unsigned char. Data to send
 /// @param: nToSend - number of bytes to send.
+/// @return: int. IIC_OK, or IIC_ERR_xx. With IIC_ASYNC the write is posted:
+///          the data is copied, and IIC_OK returned once it is queued, or
+///          IIC_ERR_BUSY if there is no free slot to queue it in.
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
@@ -53,9 +247,203 @@ int IICWrite(unsigned char addr,unsigned char * dbytes, unsigned int nToSend);
 /// @param: dbytes - unsigned char * Pointer to buffer big enough to receive
 ///                  data
 /// @param: nToRecv - number of bytes to receive
+/// @return: int. IIC_OK, or IIC_ERR_xx
 ///
 ///////////////////////////////////////////////////////////////////////////////
 
 int IICRead(unsigned char addr,unsigned char * dbytes, unsigned int nToRecv);
 
+///////////////////////////////////////////////////////////////////////////////
+/// IICWriteRead
+///
+/// Write, then read after a repeated start, holding the bus throughout. For a
+/// register read, write the register address and read the value. With no
+/// bytes to read it is a plain write that waits for the result, which with
+/// IIC_ASYNC a posted IICWrite does not.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: wbytes - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send
+/// @param: rbytes - pointer to unsigned char. Buffer for the data read
+/// @param: nToRecv - number of bytes to receive
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICWriteRead(unsigned char addr,unsigned char * wbytes, unsigned int nToSend,unsigned char * rbytes, unsigned int nToRecv);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICTransfer
+///
+/// Carry out several parts as one transaction, joined by repeated starts:
+/// for each part its write, then its read after another repeated start. For
+/// a run of register writes and reads that nothing may come between, such
+/// as driving an output and reading the inputs it affects. Each part is
+/// allowed IIC_TIMEOUT_US.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: segs - IICSEG *. The parts, in order
+/// @param: nsegs - unsigned char. How many
+/// @return: int. IIC_OK, or IIC_ERR_xx from the part that failed. Parts
+///          before it have been carried out.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICTransfer(IICSEG * segs, unsigned char nsegs);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICRecover
+///
+/// Free a stuck bus: clock SCL nine times, send a stop condition and set the
+/// TWI up again. The driver does this itself after a timeout or bus error.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICRecover(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICGetStats
+///
+/// Copy the failure counters
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: pStats - IICSTATS *. Where to put them
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICGetStats(IICSTATS * pStats);
+
+#ifdef IIC_PROFILE
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICGetProfile
+///
+/// Copy the per-device bus use. Bus utilization is the sum of the busy
+/// times over the elapsed time.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: pTable - IICDEVSTATS *. Where to put the entries
+/// @param: nMax - int. Room in pTable, entries
+/// @param: pElapsed - unsigned long *. Where to put the time since the reset,
+///                    us, or NULL. Wraps after 71 minutes.
+/// @return: int. Number of entries copied
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICGetProfile(IICDEVSTATS * pTable, int nMax, unsigned long * pElapsed);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICResetProfile
+///
+/// Clear the per-device bus use and restart the elapsed time
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICResetProfile(void);
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICLock
+///
+/// Take the bus lock, for a sequence of transactions that must not be
+/// interleaved with other tasks' traffic. Nests.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: int. IIC_OK, or IIC_ERR_BUSY if another task holds the lock
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICLock(void);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICUnlock
+///
+/// Release the bus lock. Each IICLock that succeeded needs one IICUnlock.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: NONE
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICUnlock(void);
+
+#ifdef IIC_ASYNC
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICSubmit
+///
+/// Queue a transfer. It goes after any queued transfers of the same or higher
+/// priority, and starts at once if the bus is idle. On completion its status
+/// is set, then its callback is called or, if there is none, its message is
+/// posted. A part with nothing to write or read sends the address alone, as
+/// the polled driver does, to see whether the device answers.
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: xfer - IICXFER *. The transfer. Must not already be queued.
+/// @return: int. 0, once queued
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICSubmit(IICXFER * xfer);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICPost
+///
+/// Posted write with a completion callback: as IICWrite, but the callback is
+/// called from the TWI interrupt once the write is done, with the posted
+/// block, its status and the context given here. A write too long to post is
+/// waited for, its result returned and the callback not called.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: addr - unsigned char. Address. Top 7 bits used
+/// @param: dbytes - pointer to unsigned char. Data to send
+/// @param: nToSend - number of bytes to send.
+/// @param: callback - PFNIICDONE. Called on completion, or NULL
+/// @param: context - void *. Put in the block's context for the callback
+/// @return: int. IIC_OK once queued, IIC_ERR_BUSY if no slot is free,
+///          IIC_ERR_LENGTH, or the result of an unposted write
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICPost(unsigned char addr,unsigned char * dbytes, unsigned int nToSend,PFNIICDONE callback,void * context);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICIsBusy
+///
+/// Check whether a transfer is still queued or on the bus
+///
+/// @scope: EXPORTED
+/// @context: ANY
+/// @param: xfer - IICXFER *. The transfer
+/// @return: int. Nonzero while the transfer is pending
+///
+///////////////////////////////////////////////////////////////////////////////
+
+inline int IICIsBusy(IICXFER * xfer) { return xfer->status==IIC_PENDING; }
+
+#endif
+
 #endif
@@ -0,0 +1,112 @@
+///////////////////////////////////////////////////////////////////////////////
+/// IICBENCH.CPP
+///
+/// IIC throughput benchmark
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include "iicbench.h"
+#include "iic.h"
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICBenchPerSecond
+///
+/// Turn a count and the time it took into a rate
+///
+/// @scope: INTERNAL
+/// @context: ANY
+/// @param: count - unsigned int. Transactions done
+/// @param: us - unsigned long. Time taken, microseconds
+/// @return: unsigned int. Transactions per second
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static unsigned int IICBenchPerSecond(unsigned int count, unsigned long us)
+{
+	return us?(unsigned int)((unsigned long)count*1000000UL/us):0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICBenchmark
+///
+/// Measure throughput at one bus rate. Each transaction waits for its
+/// result, so the interrupt-driven driver is timed end to end as well.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: hz - unsigned long. Bus rate wanted, Hz
+/// @param: pResult - IICBENCH *. Where to put the results
+/// @return: int. IIC_OK, or IIC_ERR_BUSY if another task holds the bus
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICBenchmark(unsigned long hz, IICBENCH * pResult)
+{
+	unsigned char reg=0x12;			// GPIOA
+	unsigned char port;
+	unsigned char lcd=0x08;			// backlight on, E low: the LCD ignores it
+	unsigned long start;
+
+	int rc=IICLock();
+	if(rc!=IIC_OK) {
+		return rc;
+	}
+	pResult->rate=IICSetBitRate(hz);
+	pResult->errors=0;
+
+	start=micros();
+	for(int idx=0;idx<IICBENCH_COUNT;idx++) {
+		if(IICWriteRead(IICBENCH_KEY_ADDR,&reg,1,&port,1)!=IIC_OK) {
+			pResult->errors++;
+		}
+	}
+	pResult->keyreads=IICBenchPerSecond(IICBENCH_COUNT,micros()-start);
+
+	pResult->lcdwrites=0;
+	if(pResult->rate<=IICBENCH_LCD_MAXRATE) {
+		start=micros();
+		for(int idx=0;idx<IICBENCH_COUNT;idx++) {
+			if(IICWriteRead(IICBENCH_LCD_ADDR,&lcd,1,NULL,0)!=IIC_OK) {
+				pResult->errors++;
+			}
+		}
+		pResult->lcdwrites=IICBenchPerSecond(IICBENCH_COUNT,micros()-start);
+	}
+
+	IICUnlock();
+	return IIC_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICBenchmarkReport
+///
+/// Measure throughput at each standard rate and print a table
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: out - Print&. Where to print, Serial say
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICBenchmarkReport(Print& out)
+{
+	static const unsigned long rates[]={IIC_RATE_STANDARD,IIC_RATE_FAST};
+	IICBENCH result;
+
+	out.println(F("IIC Hz\tkey/s\tlcd/s\terrors"));
+	for(unsigned int idx=0;idx<sizeof(rates)/sizeof(rates[0]);idx++) {
+		if(IICBenchmark(rates[idx],&result)!=IIC_OK) {
+			out.println(F("bus busy"));
+			break;
+		}
+		out.print(result.rate);
+		out.print(F("\t"));
+		out.print(result.keyreads);
+		out.print(F("\t"));
+		out.print(result.lcdwrites);
+		out.print(F("\t"));
+		out.println(result.errors);
+	}
+	IICSetBitRate(IIC_BITRATE);
+}
@@ -0,0 +1,71 @@
+///////////////////////////////////////////////////////////////////////////////
+/// IICBENCH.H
+///
+/// IIC throughput benchmark
+///
+/// Measures, at a given bus rate, how many keypad port reads and LCD writes
+/// the bus carries per second. A keypad read is the register read the keypad
+/// task does every poll: a register address write, a repeated start and a
+/// one byte read, 39 bit times on the bus. An LCD write is one byte to the
+/// backpack's port expander, 20 bit times; the LCD library sends six of
+/// these per character.
+///
+/// The benchmark owns the bus while it runs, so run it from UserInit, before
+/// the keypad task starts polling, or on the bench. It leaves the bus at
+/// IIC_BITRATE.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef IICBENCH_H_
+#define IICBENCH_H_
+
+#include <Arduino.h>
+
+#define IICBENCH_KEY_ADDR		0x40		// keypad MCP23017, as in keypad.cpp
+#define IICBENCH_LCD_ADDR		(0x3f<<1)	// LCD backpack PCF8574: display.h gives the 7 bit address
+#define IICBENCH_COUNT			200			// transactions timed per measurement
+#define IICBENCH_LCD_MAXRATE	IIC_RATE_STANDARD	// the PCF8574's rating
+
+//
+// Results at one bus rate
+
+typedef struct _IICBENCH {
+	unsigned long	rate;			// bus rate set, Hz
+	unsigned int	keyreads;		// keypad port reads per second
+	unsigned int	lcdwrites;		// LCD expander writes per second, 0 if not measured
+	unsigned int	errors;			// transactions that failed
+} IICBENCH;
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICBenchmark
+///
+/// Measure throughput at one bus rate. The LCD is only written at rates up
+/// to IICBENCH_LCD_MAXRATE.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: hz - unsigned long. Bus rate wanted, Hz
+/// @param: pResult - IICBENCH *. Where to put the results
+/// @return: int. IIC_OK, or IIC_ERR_BUSY if another task holds the bus
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int IICBenchmark(unsigned long hz, IICBENCH * pResult);
+
+///////////////////////////////////////////////////////////////////////////////
+/// IICBenchmarkReport
+///
+/// Measure throughput at 100kHz and 400kHz, the rates the TWI is specified
+/// for, and print a table. The keypad's MCP23017 is rated for both; the LCD's
+/// PCF8574 for 100kHz only, so it is left out at 400kHz.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: out - Print&. Where to print, Serial say
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void IICBenchmarkReport(Print& out);
+
+#endif
@@ -11,9 +11,14 @@
 #include "keypad.h"
 #include "kernel.h"
 #include "iic.h"
+#include "mcp23017.h"
 
 #define KEY_ADDR_IIC	0x40
 
+#define KEY_COLUMNS		3				// on GPA0-2, driven low one at a time
+#define KEY_ROWS		4				// on GPA3-6, read inverted: 1 for a key down
+#define KEY_ROW_MASK	0b01111000
+
 //
 // This enum defines the states used by the state machine
 
@@ -28,13 +33,184 @@ typedef enum _KEYSTATE {
 
 // The single task timer used in this module
 
-static Kernel::OSTimer	KeyTimer(10);
+static Kernel::Timer<unsigned char>	KeyTimer(10);
+
+// The port expander the keypad is on. Its output and configuration registers
+// are shadowed, so only changes go out on the bus.
+
+static MCPDEV KeyExp;
+
+#ifdef KEY_INTERRUPT
+
+// INTA from the expander comes in on PD2, PCINT18
+
+#define KEY_INT_MASK	(1<<2)
+
+// Idle calls that make a whole column cycle: one when each call scans every
+// column
+
+#ifdef KEY_FULLSCAN
+#define KEY_QUIET_CALLS	1
+#else
+#define KEY_QUIET_CALLS	KEY_COLUMNS
+#endif
+
+#define KEY_EV_ACTIVITY	0x01			// INTA has gone low: a key is down
+
+static Kernel::EventFlags KeyEvents;
+static unsigned char KeyScanning;		// nonzero while the keypad is being scanned
+static unsigned char KeyQuiet;			// calls in a row with the state machine idle
+static unsigned char KeyColumn=0x06;	// column drive to resume the scan with
+
+#endif
+
+static unsigned char KeyReg=MCP_GPIOA;
+
+// The full matrix scan, as one transaction. For each column, a write of the
+// column drive to GPIOA, then a read of GPIOA after a repeated start. The
+// expander stays in sequential mode for MCPFlush, so its register pointer
+// moves on after each byte and every part sets it again.
+
+static unsigned char KeyScanDrive[KEY_COLUMNS][2]={
+	{MCP_GPIOA,0x06},
+	{MCP_GPIOA,0x05},
+	{MCP_GPIOA,0x03}
+};
+static unsigned char KeyScanPort[KEY_COLUMNS];	// port as read with each column driven
+static IICSEG KeyScanSeg[2*KEY_COLUMNS]={
+	{KEY_ADDR_IIC,KeyScanDrive[0],2,NULL,0},
+	{KEY_ADDR_IIC,&KeyReg,1,&KeyScanPort[0],1},
+	{KEY_ADDR_IIC,KeyScanDrive[1],2,NULL,0},
+	{KEY_ADDR_IIC,&KeyReg,1,&KeyScanPort[1],1},
+	{KEY_ADDR_IIC,KeyScanDrive[2],2,NULL,0},
+	{KEY_ADDR_IIC,&KeyReg,1,&KeyScanPort[2],1}
+};
+
+#ifdef IIC_ASYNC
+
+// The port read, done in the background by the IIC interrupt: a write of the
+// GPIOA register address, then a one byte read after a repeated start.
+
+static unsigned char KeyPort;			// where the read puts the port value
+static IICXFER KeyRead={NULL,KEY_ADDR_IIC,IIC_PRIO_NORMAL,&KeyReg,1,&KeyPort,1,IIC_OK,NULL,MSG_ID_NOMESSAGE,NULL,NULL,0};
+
+#ifdef KEY_FULLSCAN
+
+// The full scan in the background: the first column's write in the transfer
+// itself, the rest as its further parts
+
+static IICXFER KeyFullScan={NULL,KEY_ADDR_IIC,IIC_PRIO_NORMAL,KeyScanDrive[0],2,NULL,0,IIC_OK,NULL,MSG_ID_NOMESSAGE,NULL,&KeyScanSeg[1],2*KEY_COLUMNS-1};
+static IICXFER * KeyPending=&KeyFullScan;	// the read in progress
+
+#else
+static IICXFER * KeyPending=&KeyRead;
+#endif
+
+#endif
 
 //
 // Forward definition of keypad task handler
 
 void KEYTaskHandler(void * context);
 
+///////////////////////////////////////////////////////////////////////////////
+/// KEYScanDone
+///
+/// A full scan has finished: bring the expander's shadow up to date with the
+/// column drives it wrote, and leave the first column with a key down driven,
+/// so the state machine's reads while it debounces see that key
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: rc - int. How the scan went
+/// @param: pMatrix - unsigned char *. Where to put the port as read with the
+///         column driven, as a single column read would give it
+/// @return: int. rc, or IIC_ERR_xx from driving the column
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static int KEYScanDone(int rc, unsigned char * pMatrix)
+{
+	unsigned char col;
+
+	if(rc!=IIC_OK) {
+		// Where it stopped is unknown: send the column drive again next flush
+		MCPWritten(&KeyExp,MCP_OLATA,MCPGetRegister(&KeyExp,MCP_OLATA),0);
+		return rc;
+	}
+	MCPWritten(&KeyExp,MCP_OLATA,KeyScanDrive[KEY_COLUMNS-1][1],1);
+
+	for(col=0;col<KEY_COLUMNS-1;col++) {
+		if(KeyScanPort[col]&KEY_ROW_MASK) {
+			MCPWritePort(&KeyExp,MCP_PORTA,KeyScanDrive[col][1]);
+			rc=MCPFlush(&KeyExp);
+			break;
+		}
+	}
+	*pMatrix=KeyScanPort[col];
+	return rc;
+}
+
+#ifdef KEY_INTERRUPT
+
+///////////////////////////////////////////////////////////////////////////////
+/// KEYScanStart
+///
+/// A key has been touched: drive the column the scan had reached when it
+/// stopped, so the state machine carries on stepping from where it was, and
+/// start reading
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void KEYScanStart(void)
+{
+	KeyScanning=1;
+	KeyQuiet=0;
+#ifdef KEY_FULLSCAN
+	// The full scan drives the columns itself
+#ifdef IIC_ASYNC
+	KeyPending=&KeyFullScan;
+	IICSubmit(KeyPending);
+#endif
+#else
+	MCPWritePort(&KeyExp,MCP_PORTA,KeyColumn);
+	MCPFlush(&KeyExp);
+#ifdef IIC_ASYNC
+	IICSubmit(&KeyRead);				// queued behind the column write
+#endif
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// KEYScanStop
+///
+/// No key is down: drop every column so that any key pulls its row low and
+/// raises INTA, and stop reading. Events seen during the scan are discarded;
+/// a key pressed since is caught by INTA, which stays low while it is held.
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void KEYScanStop(void)
+{
+	KeyScanning=0;
+	KeyEvents.ConsumeAny(KEY_EV_ACTIVITY);
+	KeyColumn=MCPGetRegister(&KeyExp,MCP_OLATA);
+	MCPWritePort(&KeyExp,MCP_PORTA,0x00);
+	MCPFlush(&KeyExp);
+}
+
+#endif
+
 //
 // Exported functions
 
@@ -51,32 +227,53 @@ void KEYTaskHandler(void * context);
 
 void KEYInitializeKeypad(void)
 {
-	unsigned char iicreg[2]; // space to put our required I2C data in.
-
 	// Configure the port expander. We want GPIA0,1 and 2 as outputs
 	// We also need GPIA3-7 as inputs. We can then usefully construct
 	// these into a byte we only need to read once.
 
-	iicreg[0]=0x00;		// IODIRA
-	iicreg[1]=0xf8;		// bottom 3 pins output
-	IICWrite(KEY_ADDR_IIC,iicreg,2);
+	MCPInitialize(&KeyExp,KEY_ADDR_IIC);
+	MCPSetDirection(&KeyExp,MCP_PORTA,0xf8);		// bottom 3 pins output
 
 	// Now, to start with we want only the LSB low (remember
 	// keypad has reverse logic because unfortunately the hardware designer
 	// slipped up and pulled EVERYTHING high. If you design hardware, be
 	// sympathetic to your firmware designers!
 
-	iicreg[0]=0x12;		// GPIOA
-	iicreg[1]=0x06;		// bottommost bit zero
-	IICWrite(KEY_ADDR_IIC,iicreg,2);
+	MCPWritePort(&KeyExp,MCP_PORTA,0x06);			// bottommost bit zero
 
 	// Now, because the hardware designer pulled everything
 	// high and used inverse logic, we set the relevant bits in
 	// the IPOLA register to put it back to rights
 
-	iicreg[0]=0x02;
-	iicreg[1]=0b01111000;
-	IICWrite(KEY_ADDR_IIC,iicreg,2);
+	MCPSetPolarity(&KeyExp,MCP_PORTA,0b01111000);
+
+#ifdef KEY_INTERRUPT
+	// In interrupt mode the keypad idles with every column low instead, so
+	// that any key pulls its row low. The rows interrupt on change compared
+	// with their idle high level, so INTA stays low while a key is held.
+
+	MCPWritePort(&KeyExp,MCP_PORTA,0x00);
+	MCPSetRegister(&KeyExp,MCP_DEFVALA,0b01111000);
+	MCPSetRegister(&KeyExp,MCP_INTCONA,0b01111000);
+	MCPSetRegister(&KeyExp,MCP_GPINTENA,0b01111000);
+#endif
+
+	// Send it all: the configuration registers in one transaction and the
+	// output latch in another
+
+	MCPFlush(&KeyExp);
+
+#ifdef KEY_INTERRUPT
+	// INTA in on PD2, pulled up in case it is not wired, on a pin change
+	// interrupt
+
+	DDRD&=~KEY_INT_MASK;
+	PORTD|=KEY_INT_MASK;
+	PCMSK2|=KEY_INT_MASK;
+	PCICR|=(1<<PCIE2);
+#elif defined(IIC_ASYNC)
+	IICSubmit(KeyPending);		// the first port read, queued behind the setup
+#endif
 
 	// Register the task handler. We do not need to pass any context
 	// as in this module, our timer is declared with the scope limited
@@ -84,6 +281,53 @@ void KEYInitializeKeypad(void)
 
 }
 
+///////////////////////////////////////////////////////////////////////////////
+/// KEYScan
+///
+/// Read the whole key matrix in one bus transaction
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: pKeys - unsigned int *. Where to put the keys down, bit row*3+col
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int KEYScan(unsigned int * pKeys)
+{
+	unsigned char matrix;
+	unsigned int keys=0;
+
+#if defined(IIC_ASYNC) && defined(KEY_FULLSCAN)
+	// the task handler's background scan uses the same parts and buffers
+	if(IICIsBusy(&KeyFullScan)) {
+		return IIC_ERR_BUSY;
+	}
+#endif
+	int rc=KEYScanDone(IICTransfer(KeyScanSeg,2*KEY_COLUMNS),&matrix);
+
+#ifdef KEY_INTERRUPT
+	// Between scans every column idles low, for INTA
+	if(!KeyScanning) {
+		MCPWritePort(&KeyExp,MCP_PORTA,0x00);
+		MCPFlush(&KeyExp);
+	}
+#endif
+	if(rc!=IIC_OK) {
+		return rc;
+	}
+	for(unsigned char col=0;col<KEY_COLUMNS;col++) {
+		unsigned char rows=KeyScanPort[col]>>3;
+		for(unsigned char row=0;row<KEY_ROWS;row++) {
+			if(rows&(1<<row)) {
+				keys|=1<<(row*KEY_COLUMNS+col);
+			}
+		}
+	}
+	*pKeys=keys;
+	return IIC_OK;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 /// KEYTaskHandler
 ///
@@ -97,19 +341,61 @@ void KEYInitializeKeypad(void)
 
 void KEYTaskHandler(void * context)
 {
-	unsigned char matrix;					        // Key state in this current cycle
-	unsigned char iicreg[2];				      // IIC data buffer
 	static unsigned char lastpressed;		  // needs to be remembered across calls to KEYTaskHandler
 	static KEYSTATE keystate = KEY_IDLE;	// needs to hold state across calls to KEYTaskHandler
 
+#ifdef KEY_INTERRUPT
+	// While no key is touched there is nothing to read. INTA going low, seen
+	// by the interrupt or still held low, starts a scan.
+
+	if(!KeyScanning) {
+		if(!KeyEvents.ConsumeAny(KEY_EV_ACTIVITY) && (PIND&KEY_INT_MASK)) {
+			return;
+		}
+		KEYScanStart();
+	}
+#endif
+
 	// The first thing we need to do is read back the port value
+#ifdef IIC_ASYNC
+	//
+	// The read was started at the end of the last call and runs in the
+	// background. Until it is back there is nothing to do, so return and
+	// look again next time round rather than wait for the bus.
+
+	if(IICIsBusy(KeyPending)) {
+		return;
+	}
+	int rc=KeyPending->status;
+	unsigned char& matrix=KeyPort;			// Key state in this current cycle, as read
+	(void)matrix;							// until the state machine below looks at it
+#ifdef KEY_FULLSCAN
+	if(KeyPending==&KeyFullScan) {
+		rc=KEYScanDone(rc,&matrix);
+	}
+#endif
+	if(rc!=IIC_OK) {
+		IICSubmit(KeyPending);			// no reading this time: try again
+		return;
+	}
+#else
 	//
-	// We can't use IIC repeat starts here because we don't know if anything
-	// else will want to use I2C in the meantime, between calls to this task
+	// The register address write and the read go in one bus transaction with
+	// a repeated start between them, so nothing else can get in between.
   // Following this operation, the value of Port A will be stored in the variable 'matrix'
-	iicreg[0]=0x12;						        // GPIOA register address
-	IICWrite(KEY_ADDR_IIC,iicreg,1);	// write the address.
-	IICRead(KEY_ADDR_IIC,&matrix,1);	// read the value
+	unsigned char matrix;					        // Key state in this current cycle
+	int rc;
+#ifdef KEY_FULLSCAN
+	// While idle, every column is read in the one transaction
+	if(keystate==KEY_IDLE) {
+		rc=KEYScanDone(IICTransfer(KeyScanSeg,2*KEY_COLUMNS),&matrix);
+	} else
+#endif
+	rc=MCPReadPort(&KeyExp,MCP_PORTA,&matrix);
+	if(rc!=IIC_OK) {
+		return;							// no reading this time: try again next pass
+	}
+#endif
 
 	// then check the state machine
 
@@ -129,12 +415,18 @@ void KEYTaskHandler(void * context)
       // Otherwise move onto the next column. Set the current column
       // to logic 1 and the next column to logic 0. Wrap round to
       // the first column if necessary
-      unsigned int col;
+      unsigned int col=MCPGetRegister(&KeyExp,MCP_OLATA);	// the column driven now
       // TO DO.......
 
-			// Then write the column to the I2C
-			iicreg[1]=col;
-			IICWrite(KEY_ADDR_IIC,iicreg,2);
+#ifndef KEY_FULLSCAN
+			// Then write the column to the I2C. Only a change of column
+			// goes out on the bus. A full scan has been through every
+			// column already, and drives them itself.
+			MCPWritePort(&KeyExp,MCP_PORTA,col);
+			MCPFlush(&KeyExp);
+#else
+			(void)col;
+#endif
       break;
     }
 		
@@ -174,4 +466,49 @@ void KEYTaskHandler(void * context)
 			keystate=KEY_IDLE;
 			break;
 	}
+
+#ifdef KEY_INTERRUPT
+	// Once a whole column cycle has found no key down, stop scanning
+
+	if(keystate!=KEY_IDLE) {
+		KeyQuiet=0;
+	} else if(++KeyQuiet>=KEY_QUIET_CALLS) {
+		KEYScanStop();
+		return;
+	}
+#endif
+
+#ifdef IIC_ASYNC
+	// Start the next read. It is queued behind any column write made above,
+	// so it sees the new column.
+
+#ifdef KEY_FULLSCAN
+	KeyPending=(keystate==KEY_IDLE)?&KeyFullScan:&KeyRead;
+#endif
+	IICSubmit(KeyPending);
+#endif
+}
+
+#ifdef KEY_INTERRUPT
+
+///////////////////////////////////////////////////////////////////////////////
+/// ISR(PCINT2_vect)
+///
+/// Interrupt Service Routine: INTA from the keypad's port expander has
+/// changed. Going low, it means a key is down: tell the task.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: none
+/// @return: none
+///
+///////////////////////////////////////////////////////////////////////////////
+
+ISR(PCINT2_vect)
+{
+	if(!(PIND&KEY_INT_MASK)) {
+		KeyEvents.SetFromISR(KEY_EV_ACTIVITY);
+	}
 }
+
+#endif
@@ -10,6 +10,27 @@
 #ifndef KEYPAD_H_
 #define KEYPAD_H_
 
+// Define KEY_INTERRUPT to read the keypad only when a key is touched. While
+// idle, every column is held low and the port expander's interrupt on change
+// watches the rows: INTA, wired to D2 (PD2, PCINT18), goes low as soon as a
+// key pulls its row low. The task handler then scans as in polled mode, and
+// stops once a whole column cycle finds no key down, so an idle keypad puts
+// nothing on the bus.
+//
+// This needs the INTA wire added to the board, and defines the pin change
+// interrupt for port D (PCINT2_vect).
+
+//#define KEY_INTERRUPT
+
+// Define KEY_FULLSCAN to look at every column on each call while no key is
+// down, rather than one column per call. Each column is driven and its rows
+// read back in a single bus transaction (see KEYScan), so a press anywhere
+// is seen on the next call instead of up to three calls later. Each idle
+// call puts about three times as many bits on the bus, so this goes best
+// with KEY_INTERRUPT, which only scans while a key is touched.
+
+//#define KEY_FULLSCAN
+
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -25,5 +46,25 @@
 
 void KEYInitializeKeypad(void);
 
+///////////////////////////////////////////////////////////////////////////////
+/// KEYScan
+///
+/// Read the whole key matrix at once: drive each column low in turn and read
+/// the rows back, all in one bus transaction. The column drive is left on the
+/// first column with a key down, or on the last column if there is none, as
+/// the task handler's own full scan leaves it.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: pKeys - unsigned int *. Where to put the keys down: bit row*3+col
+///         for each, so bits 0-11
+/// @return: int. IIC_OK, or IIC_ERR_xx. With IIC_ASYNC and KEY_FULLSCAN,
+///          IIC_ERR_BUSY while the task handler's own scan, which shares
+///          its buffers, is on the bus.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int KEYScan(unsigned int * pKeys);
+
 
 #endif
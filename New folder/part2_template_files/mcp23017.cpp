@@ -0,0 +1,316 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MCP23017.CPP
+///
+/// MCP23017 port expander driver
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#include <Arduino.h>
+#include "mcp23017.h"
+#include "iic.h"
+
+// A gap of up to this many unchanged registers is sent within a run rather
+// than splitting it: each costs 9 bit times, against about 20 for another
+// start, address, register and stop.
+
+#define MCP_GAP				2
+
+#define MCPBIT(reg)			(1UL<<(reg))
+#define MCPWRITABLE(reg)	((reg)<MCP_INTFA || (reg)>=MCP_OLATA)
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPSetBit
+///
+/// Set or clear one pin's bit in a pair of A/B registers
+///
+/// @scope: INTERNAL
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: rega - unsigned char. The port A register of the pair
+/// @param: pin - MCPPIN. Which pin
+/// @param: set - unsigned char. Nonzero to set the bit
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void MCPSetBit(MCPDEV * dev, unsigned char rega, MCPPIN pin, unsigned char set)
+{
+	unsigned char reg=rega+(pin>>3);
+	unsigned char mask=1<<(pin&7);
+
+	MCPSetRegister(dev,reg,set?(dev->shadow[reg]|mask):(dev->shadow[reg]&~mask));
+}
+
+#ifdef IIC_ASYNC
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPostDone
+///
+/// Completion of a posted MCPFlush write. If it failed, mark its registers
+/// for the next MCPFlush to send again: their dirty bits were cleared when
+/// it was queued, so setting the same values would not.
+///
+/// @scope: INTERNAL
+/// @context: INTERRUPT
+/// @param: xfer - IICXFER *. The posted block: the register address, then
+///         the values; the expander in its context
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+static void MCPPostDone(IICXFER * xfer)
+{
+	if(xfer->status!=IIC_OK) {
+		MCPDEV * dev=(MCPDEV *)xfer->context;
+		for(unsigned char n=1;n<xfer->nwrite;n++) {
+			dev->resend|=MCPBIT(xfer->wbuf[0]+n-1);
+		}
+	}
+}
+
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPInitialize
+///
+/// Set up the shadow with the power-on values, all to be sent
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: addr - unsigned char. Its IIC address, top 7 bits used
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPInitialize(MCPDEV * dev, unsigned char addr)
+{
+	dev->addr=addr;
+	memset(dev->shadow,0,sizeof(dev->shadow));
+	dev->shadow[MCP_IODIRA]=0xff;
+	dev->shadow[MCP_IODIRA+1]=0xff;
+	dev->dirty=0;
+	dev->resend=0;
+	for(unsigned char reg=0;reg<MCP_NREGS;reg++) {
+		if(MCPWRITABLE(reg)) {
+			dev->dirty|=MCPBIT(reg);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPSetRegister
+///
+/// Set a shadowed register, marking it for sending if it changes
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: reg - unsigned char. MCP_xx register address, below MCP_NREGS
+/// @param: value - unsigned char. New value
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPSetRegister(MCPDEV * dev, unsigned char reg, unsigned char value)
+{
+	if(dev->shadow[reg]!=value) {
+		dev->shadow[reg]=value;
+		dev->dirty|=MCPBIT(reg);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPWritten
+///
+/// Record a register written to the expander outside MCPFlush
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: reg - unsigned char. MCP_xx register address, below MCP_NREGS
+/// @param: value - unsigned char. The value written, or to be
+/// @param: sent - unsigned char. Nonzero if the write succeeded
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPWritten(MCPDEV * dev, unsigned char reg, unsigned char value, unsigned char sent)
+{
+	dev->shadow[reg]=value;
+	if(sent) {
+		dev->dirty&=~MCPBIT(reg);
+	} else {
+		dev->dirty|=MCPBIT(reg);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinMode
+///
+/// Make a pin an output, an input, or an input with its pull-up on
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: mode - MCPMODE. What it is to be
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPPinMode(MCPDEV * dev, MCPPIN pin, MCPMODE mode)
+{
+	MCPSetBit(dev,MCP_IODIRA,pin,mode!=MCP_OUTPUT);
+	MCPSetBit(dev,MCP_GPPUA,pin,mode==MCP_INPUT_PULLUP);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinInvert
+///
+/// Set whether a pin reads inverted
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: invert - unsigned char. Nonzero to invert
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPPinInvert(MCPDEV * dev, MCPPIN pin, unsigned char invert)
+{
+	MCPSetBit(dev,MCP_IPOLA,pin,invert);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinWrite
+///
+/// Set an output pin high or low
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: value - unsigned char. Nonzero for high
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPPinWrite(MCPDEV * dev, MCPPIN pin, unsigned char value)
+{
+	MCPSetBit(dev,MCP_OLATA,pin,value);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPFlush
+///
+/// Send the registers that have changed. Each run starts at a changed
+/// register and goes on while there is another changed one within MCP_GAP
+/// registers, stopping at the read-only registers.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int MCPFlush(MCPDEV * dev)
+{
+	unsigned char buf[MCP_NREGS+1];		// register address, then the values
+
+#ifdef IIC_ASYNC
+	// take back the registers of posted writes that failed
+
+	if(dev->resend) {
+		unsigned char sreg=SREG;
+		cli();
+		dev->dirty|=dev->resend;
+		dev->resend=0;
+		SREG=sreg;
+	}
+#endif
+
+	for(unsigned char reg=0;dev->dirty && reg<MCP_NREGS;reg++) {
+		if(!(dev->dirty&MCPBIT(reg))) {
+			continue;
+		}
+
+		// find the end of the run
+
+		unsigned char last=reg;
+		for(unsigned char next=reg+1;next<MCP_NREGS && MCPWRITABLE(next) && next-last<=MCP_GAP+1;next++) {
+			if(dev->dirty&MCPBIT(next)) {
+				last=next;
+			}
+		}
+
+		// send it
+
+		unsigned char n=last-reg+1;
+		buf[0]=reg;
+		memcpy(&buf[1],&dev->shadow[reg],n);
+#ifdef IIC_ASYNC
+		int rc=IICPost(dev->addr,buf,n+1,MCPPostDone,dev);
+#else
+		int rc=IICWrite(dev->addr,buf,n+1);
+#endif
+		if(rc!=IIC_OK) {
+			return rc;
+		}
+		for(;reg<=last;reg++) {
+			dev->dirty&=~MCPBIT(reg);
+		}
+		reg=last;
+	}
+	return IIC_OK;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPReadPort
+///
+/// Read a port's input pins from the expander, in one transaction: the
+/// register address, a repeated start and the read
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: port - MCPPORT. Which port
+/// @param: value - unsigned char *. Where to put the pin states
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int MCPReadPort(MCPDEV * dev, MCPPORT port, unsigned char * value)
+{
+	unsigned char reg=MCP_GPIOA+port;
+
+	return IICWriteRead(dev->addr,&reg,1,value,1);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinRead
+///
+/// Read one pin from the expander
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: value - unsigned char *. Where to put it: 1 high, 0 low
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int MCPPinRead(MCPDEV * dev, MCPPIN pin, unsigned char * value)
+{
+	unsigned char port;
+	int rc=MCPReadPort(dev,(MCPPORT)(pin>>3),&port);
+
+	if(rc==IIC_OK) {
+		*value=(port>>(pin&7))&1;
+	}
+	return rc;
+}
@@ -0,0 +1,272 @@
+///////////////////////////////////////////////////////////////////////////////
+/// MCP23017.H
+///
+/// MCP23017 port expander driver
+///
+/// The driver keeps a copy in RAM (the shadow) of the expander's
+/// configuration and output latch registers. Changing a pin or a port only
+/// changes the shadow, so a read-modify-write needs no bus read, and setting
+/// a value that is already there costs nothing. MCPFlush then sends what has
+/// changed. Registers next to each other go in one sequential write, which
+/// the expander takes with its register address incrementing. A gap of one or
+/// two unchanged registers inside a run is filled in from the shadow, since
+/// that is cheaper than a second transaction.
+///
+///	MCPPinMode(&Exp,MCP_GPA0,MCP_OUTPUT);
+///	MCPPinWrite(&Exp,MCP_GPA0,0);
+///	MCPFlush(&Exp);					// one transaction, if anything changed
+///
+/// The expander must be left in its power-on register layout: IOCON.BANK=0,
+/// with sequential addressing (IOCON.SEQOP=0). MCPInitialize puts it there.
+/// Inputs are read from the expander every time; only outputs are cached.
+///
+/// With IIC_ASYNC, runs of up to IIC_POSTED_MAX-1 registers are posted
+/// writes, so MCPFlush reports only that they were queued. If a posted write
+/// fails, its registers are marked to be resent by the next MCPFlush.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+#ifndef MCP23017_H_
+#define MCP23017_H_
+
+//
+// Register addresses, IOCON.BANK=0. A register's B twin is one above it.
+
+#define MCP_IODIRA			0x00		// direction: 1 input, 0 output
+#define MCP_IPOLA			0x02		// input polarity: 1 inverted
+#define MCP_GPINTENA		0x04		// interrupt on change enable
+#define MCP_DEFVALA			0x06		// compare value for interrupt on change
+#define MCP_INTCONA			0x08		// 1 compare with DEFVAL, 0 with last value
+#define MCP_IOCON			0x0a		// configuration, also at 0x0b
+#define MCP_GPPUA			0x0c		// 100k pull-ups
+#define MCP_INTFA			0x0e		// interrupt flags, read only
+#define MCP_INTCAPA			0x10		// port at interrupt, read only
+#define MCP_GPIOA			0x12		// port
+#define MCP_OLATA			0x14		// output latch
+
+#define MCP_NREGS			0x16		// registers shadowed, 0 to MCP_OLATB
+
+//
+// Ports and pins
+
+typedef enum _MCPPORT {
+
+	MCP_PORTA,
+	MCP_PORTB
+
+} MCPPORT;
+
+typedef enum _MCPPIN {
+
+	MCP_GPA0, MCP_GPA1, MCP_GPA2, MCP_GPA3, MCP_GPA4, MCP_GPA5, MCP_GPA6, MCP_GPA7,
+	MCP_GPB0, MCP_GPB1, MCP_GPB2, MCP_GPB3, MCP_GPB4, MCP_GPB5, MCP_GPB6, MCP_GPB7
+
+} MCPPIN;
+
+typedef enum _MCPMODE {
+
+	MCP_OUTPUT,
+	MCP_INPUT,
+	MCP_INPUT_PULLUP
+
+} MCPMODE;
+
+//
+// One expander. Owned by the caller; use the functions below to change it.
+
+typedef struct _MCPDEV {
+	unsigned char	addr;					// IIC address, top 7 bits used
+	unsigned char	shadow[MCP_NREGS];		// register values, as they are to be
+	unsigned long	dirty;					// bit per register not yet sent
+	volatile unsigned long resend;			// IIC_ASYNC: bit per register whose posted write failed
+} MCPDEV;
+
+//
+// Exported functions
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPInitialize
+///
+/// Set up the shadow with the expander's power-on values: all pins inputs,
+/// everything else zero. Every register is marked changed, so the next
+/// MCPFlush puts the expander in this state, whatever it was left in.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: addr - unsigned char. Its IIC address, top 7 bits used
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPInitialize(MCPDEV * dev, unsigned char addr);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPSetRegister
+///
+/// Set a shadowed register. Marked for sending only if it changes.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: reg - unsigned char. MCP_xx register address, below MCP_NREGS
+/// @param: value - unsigned char. New value
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPSetRegister(MCPDEV * dev, unsigned char reg, unsigned char value);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPWritten
+///
+/// Bring the shadow up to date with a register the caller has written to
+/// the expander itself, in a transaction of its own (with IICTransfer, say).
+/// If the write went out, the register is not sent again; if it may not
+/// have, value is sent by the next MCPFlush.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: reg - unsigned char. MCP_xx register address, below MCP_NREGS
+/// @param: value - unsigned char. The value written, or to be
+/// @param: sent - unsigned char. Nonzero if the write succeeded
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPWritten(MCPDEV * dev, unsigned char reg, unsigned char value, unsigned char sent);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPGetRegister
+///
+/// Get a shadowed register, as it is or is about to be in the expander
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: reg - unsigned char. MCP_xx register address, below MCP_NREGS
+/// @return: unsigned char. The value
+///
+///////////////////////////////////////////////////////////////////////////////
+
+inline unsigned char MCPGetRegister(MCPDEV * dev, unsigned char reg) { return dev->shadow[reg]; }
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPSetDirection, MCPSetPolarity, MCPSetPullups, MCPWritePort
+///
+/// Set a whole port's direction (1 input), input polarity (1 inverted),
+/// pull-ups (1 on) or outputs
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: port - MCPPORT. Which port
+/// @param: value - unsigned char. Bit per pin
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+inline void MCPSetDirection(MCPDEV * dev, MCPPORT port, unsigned char value) { MCPSetRegister(dev,MCP_IODIRA+port,value); }
+inline void MCPSetPolarity(MCPDEV * dev, MCPPORT port, unsigned char value) { MCPSetRegister(dev,MCP_IPOLA+port,value); }
+inline void MCPSetPullups(MCPDEV * dev, MCPPORT port, unsigned char value) { MCPSetRegister(dev,MCP_GPPUA+port,value); }
+inline void MCPWritePort(MCPDEV * dev, MCPPORT port, unsigned char value) { MCPSetRegister(dev,MCP_OLATA+port,value); }
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinMode
+///
+/// Make a pin an output, an input, or an input with its pull-up on
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: mode - MCPMODE. What it is to be
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPPinMode(MCPDEV * dev, MCPPIN pin, MCPMODE mode);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinInvert
+///
+/// Set whether a pin reads inverted
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: invert - unsigned char. Nonzero to invert
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPPinInvert(MCPDEV * dev, MCPPIN pin, unsigned char invert);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinWrite
+///
+/// Set an output pin high or low
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: value - unsigned char. Nonzero for high
+/// @return: NONE
+///
+///////////////////////////////////////////////////////////////////////////////
+
+void MCPPinWrite(MCPDEV * dev, MCPPIN pin, unsigned char value);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPFlush
+///
+/// Send the registers that have changed, adjacent ones in one transaction.
+/// Does nothing if none have.
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @return: int. IIC_OK, or IIC_ERR_xx. Registers not sent stay marked, so
+///          the next MCPFlush tries them again; with IIC_ASYNC, so do those
+///          of a posted write that fails after it was queued.
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int MCPFlush(MCPDEV * dev);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPReadPort
+///
+/// Read a port's input pins from the expander
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: port - MCPPORT. Which port
+/// @param: value - unsigned char *. Where to put the pin states
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int MCPReadPort(MCPDEV * dev, MCPPORT port, unsigned char * value);
+
+///////////////////////////////////////////////////////////////////////////////
+/// MCPPinRead
+///
+/// Read one pin from the expander
+///
+/// @scope: EXPORTED
+/// @context: TASK
+/// @param: dev - MCPDEV *. The expander
+/// @param: pin - MCPPIN. Which pin
+/// @param: value - unsigned char *. Where to put it: 1 high, 0 low
+/// @return: int. IIC_OK, or IIC_ERR_xx
+///
+///////////////////////////////////////////////////////////////////////////////
+
+int MCPPinRead(MCPDEV * dev, MCPPIN pin, unsigned char * value);
+
+#endif
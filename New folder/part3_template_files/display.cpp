@@ -99,7 +99,7 @@ void DISPInitialize(void)
 
 void DISPTask(void * context)
 {
-	static Kernel::OSTimer *errtimer;	// timeout for error.
+	static Kernel::Timer<unsigned int,false,2000> errtimer;	// timeout for error. 2 bytes, no heap
 
 	switch(state) {
 
@@ -118,8 +118,7 @@ void DISPTask(void * context)
       // whether the EnteredRPM value is out of range or not.	
 		  if(1) 
 		  {
-			  errtimer=new Kernel::OSTimer(2000);
-				errtimer->Set(2000);
+				errtimer.Set();
 
         // TODO: Add code to display error message
 										
@@ -135,9 +134,7 @@ void DISPTask(void * context)
 			break;
 
 		case DISPSTATE_ERROR:		
-		  if(errtimer->isExpired()) {
-		    // we won't need the timer now, free mem associated with it.
-				delete errtimer;
+		  if(errtimer.isExpired()) {
 
         // refresh the display to EnteredRPM
         // TODO: Display the EnteredRPM on the display
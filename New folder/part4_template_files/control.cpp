@@ -10,25 +10,28 @@
 #include "kernel.h"
 #include "common.h" // we need the message ID.
 
-typedef struct _TIMERSTRUCT
-{
-	Kernel::OSTimer *	LEDTimer;
-	Kernel::OSTimer *	TestRPSTimer;
-} TIMERSTRUCT;
+// Task state. The timers live in a static object rather than on the heap,
+// and the task ring calls its Run function directly (see RegisterTask).
+
+class ControlState {
+	public:
+		Kernel::Timer<unsigned int>	LEDTimer;
+		Kernel::OSTimer	TestRPSTimer;
+		void Run(void);			// the control task
+};
 
-typedef TIMERSTRUCT * PTIMERSTRUCT;
+static ControlState Control;
 
 // the rps value needs to be seen by more than one function, so make it
 // module scope.
 
 static int demandrps=RPS_MIN;
 
-// Prototype the control task function and encoder callback here as it does not need to be
+// Prototype the encoder and keypad callbacks here as they do not need to be
 // seen outside this module
 
 void CTRLEncoderClicked(void * context);	// someone's tweaked the encoder
 void CTRLNewRPS(void * context);			// if someone enters rps from keypad
-void ControlTask(void * context);
 
 ///////////////////////////////////////////////////////////////////////////////
 /// CONTROLInitialize
@@ -42,25 +45,12 @@ void ControlTask(void * context);
 
 void CONTROLInitialize(void)
 {
-	// 1) Each test code block needs its own timer. We thus create a structure
-	//    containing pointers to two timer objects. Then we create two new
-	//    non-blocking timer objects and assign them to the pointers in the structure
-	//    This allows us to pass a single pointer to the task handler.
-	//
-	//    This is not the only way of achieving this. We could use static
-	//    or module-global variables. The memory burden is the same.
-	//    We need the timer objects to enable the delay between messages sent
-	//    to the LED driver We declare this pointer as static
-	//    as we need it to stay in place once this function exits.
-	//
-	//    We only want to do this once.
-	//
-	//    We should really check the pointers to see if they were allocated
-	//    successfully by the OS.
+	// 1) Each test code block needs its own timer. The timers are members of the
+	//    static Control object, so they exist from startup and need no allocation
+	//    (and there are no pointers to check). We just start them here.
 
-	PTIMERSTRUCT taskcontext=new TIMERSTRUCT;
-	taskcontext->LEDTimer=new Kernel::OSTimer(750);	// times out in 750ms
-	taskcontext->TestRPSTimer=new Kernel::OSTimer(1000); // times out in 200ms
+	Control.LEDTimer.Set(750);			// times out in 750ms
+	Control.TestRPSTimer.SetPeriodic(1000);	// every 1000ms, locked to the first start
 
 	// Register to receive messages from the encoder.
 
@@ -71,29 +61,25 @@ void CONTROLInitialize(void)
 	Kernel::OS.MessageQueue.Subscribe(MSG_ID_NEW_RPS_KEYPAD, CTRLNewRPS);
 
 	//
-	// 2) Register our repetitive task. We pass the user parameter 'context' as a
-	//    pointer to our timer structure. Note that the task handler now takes 'ownership'
-	//    of the timer pointer structure. If it required to release the memory associated with it,
-	//    this would take place here. However, this task is running until someone turns the power
-	//    off, so we don't have to worry here about freeing memory. As the pointer is generic, we use
-	//    casting in our ControlTask function to recover the timer object.
+	// 2) Register our repetitive task. The task ring calls Control.Run() each time
+	//    round, so the task works on its own members directly: there is no context
+	//    pointer to cast, and nothing was allocated that would need to be freed.
 
-	Kernel::OS.TaskManager.RegisterTaskHandler(ControlTask,(void *)taskcontext);
+	Kernel::OS.TaskManager.RegisterTask(Control);
 
 }
 
 //////////////////////////////////////////////////////////////////////////////
-/// ControlTask
+/// ControlState::Run
 ///
 /// This is our main control task. It must not block, as the system as a whole
 /// is single-tasked.
 ///
-/// It is passed the timer in the context variable. We could use a module global
-/// here, but this is just to demonstrate one use of the context variable
+/// The timers it uses are members of the Control object it is called on.
 ///
 //////////////////////////////////////////////////////////////////////////////
 
-void ControlTask(void * context)
+void ControlState::Run(void)
 {
 	// Code in this task function CAN NOT BLOCK. If it blocks, it will grab the
 	// CPU and other tasks will not be able to run.
@@ -102,9 +88,7 @@ void ControlTask(void * context)
 
 	static int ledstate=0;	// declared static as we want to preserve its value across calls
 
-	PTIMERSTRUCT	timers = static_cast<PTIMERSTRUCT>(context);
-
-	if(timers->LEDTimer->isExpired()) {
+	if(LEDTimer.isExpired()) {
 
 		// CODE FOR TESTING THE SUBSYSTEMS. YOU MAY WELL NEED TO CHANGE THIS IN YOUR FINAL DESIGN
 		//-----------------------------------------------------------------------------------------
@@ -115,7 +99,7 @@ void ControlTask(void * context)
 		// timer at all.
 
 		// It simply flips the value of ledstate: if ledstate==0 it changes to 1, if 1 it is changed to 0
-		// Because ledstate is declared static, it's value is held over subsequent calls to ControlTask.
+		// Because ledstate is declared static, it's value is held over subsequent calls to Run.
 
 		ledstate=(ledstate==1)?0:1;
 
@@ -130,9 +114,9 @@ void ControlTask(void * context)
 		//----------------------------------------------------------------------------------------------
 
 		// The timer needs to be reset. If it isn't, it will always be expired and the code within
-		// the 'if' statement will run every time the ControlTask is called by the task manager
+		// the 'if' statement will run every time Run is called by the task manager
 
-		timers->LEDTimer->Set(750);
+		LEDTimer.Set(750);
 
 	}
 
@@ -143,7 +127,7 @@ void ControlTask(void * context)
 
 	// Check the RPS test timer. This just increments the RPS display by one.
 
-	if(timers->TestRPSTimer->isExpired()) {
+	if(TestRPSTimer.isExpired()) {
 
 		static int actualrps=0;		// declared static as we want it to survive repeated calls to this task
 
@@ -151,7 +135,8 @@ void ControlTask(void * context)
 
 		Kernel::OS.MessageQueue.Post(MSG_ID_NEW_ACTUAL_RPS, (void *)actualrps, Kernel::MQ_OWNER_CALLER, Kernel::MQ_CONTEXT_TASK);
 
-		timers->TestRPSTimer->Set(1000);
+		// Periodic: already re-armed from its previous deadline, so the
+		// sampling does not drift with the task's polling latency.
 	}
 
 }